@@ -237,6 +237,36 @@ public:
 			sanityCheck();
 	}
 
+	// Splits an allocated chunk into chunks of order zero.
+	// Afterwards, each page of the chunk needs to be freed individually.
+	void split(AddressType address, int order) {
+		assert(address >= _baseAddress);
+		assert(order >= 0 && order <= tableOrder_);
+
+		AddressType index = (address - _baseAddress) >> _sizeShift;
+		assert(index % (size_t(1) << order) == 0);
+
+		int currentOrder = tableOrder_;
+		int8_t *slice = buddyPointer_;
+
+		while(currentOrder > order) {
+			slice += size_t(numRoots_) << (tableOrder_ - currentOrder);
+			currentOrder--;
+		}
+		assert(slice[index >> order] == -1);
+
+		// Mark all descendants as allocated. Superior elements do not change.
+		while(currentOrder > 0) {
+			slice += size_t(numRoots_) << (tableOrder_ - currentOrder);
+			currentOrder--;
+			for(AddressType i = 0; i < (AddressType{1} << (order - currentOrder)); ++i)
+				slice[(index >> currentOrder) + i] = -1;
+		}
+
+		if constexpr (enableBuddySanityChecking)
+			sanityCheck();
+	}
+
 	void sanityCheck() {
 		for(size_t i = 0; i < size_t(numRoots_); ++i)
 			traverseForSanityCheck(buddyPointer_, tableOrder_, i);
@@ -261,6 +261,35 @@ initgraph::Edge bootProcessorReadyEdge{
 	getFibersAvailableStage()
 };
 
+namespace {
+	constexpr bool logTopology = false;
+
+	// Derives the core and LLC IDs from MPIDR_EL1. If the MT bit is set,
+	// Aff0 distinguishes SMT siblings and Aff1 distinguishes cores within a cluster.
+	void detectCpuTopology(CpuData *cpuData) {
+		uint64_t mpidr;
+		asm volatile ("mrs %0, mpidr_el1" : "=r"(mpidr));
+		uint32_t affinity = (mpidr & 0xFF'FFFF) | ((mpidr >> 8) & 0xFF00'0000);
+		bool mt = mpidr & (uint64_t(1) << 24);
+
+		// CLIDR_EL1 only describes the caches of this CPU but not which CPUs share them.
+		// If there are caches beyond L1, we assume that the cluster shares the LLC.
+		uint64_t clidr;
+		asm volatile ("mrs %0, clidr_el1" : "=r"(clidr));
+		int llcLevel = 0;
+		for(int i = 0; i < 7; i++) {
+			if((clidr >> (3 * i)) & 0b111)
+				llcLevel = i + 1;
+		}
+
+		cpuData->coreId = mt ? (affinity >> 8) : affinity;
+		cpuData->llcId = (llcLevel > 1) ? (cpuData->coreId >> 8) : cpuData->coreId;
+		if(logTopology)
+			infoLogger() << "thor: CPU #" << cpuData->cpuIndex << " is part of core "
+					<< cpuData->coreId << ", LLC " << cpuData->llcId << frg::endlog;
+	}
+}
+
 void initializeThisProcessor() {
 	auto cpu_data = getCpuData();
 
@@ -280,6 +309,9 @@ void initializeThisProcessor() {
 	cpu_data->cpuIndex = allCpuContexts->size();
 	allCpuContexts->push(cpu_data);
 
+	detectCpuTopology(cpu_data);
+	linkCpuTopology(cpu_data);
+
 	cpu_data->irqStack = UniqueKernelStack::make();
 	cpu_data->detachedStack = UniqueKernelStack::make();
 	cpu_data->idleStack = UniqueKernelStack::make();
@@ -21,6 +21,33 @@ void suspendSelf() {
 	enableIntsAndHaltForever();
 }
 
+bool haveIdleMonitor() {
+	return true;
+}
+
+void suspendSelfMonitored(std::atomic<bool> *flag) {
+	assert(!intsAreEnabled());
+	while(true) {
+		getCpuData()->currentDomain = static_cast<uint64_t>(Domain::idle);
+
+		// The exclusive load arms the exclusive monitor. Stores of other CPUs
+		// to the flag clear the monitor, which generates a WFE wake-up event.
+		// Thus, wakers do not need to execute SEV.
+		uint32_t value;
+		asm volatile ("ldaxrb %w0, [%1]" : "=r"(value) : "r"(flag) : "memory");
+		if(value) {
+			handleIdleWake();
+			continue;
+		}
+
+		// IRQs also end WFE. Exception returns set the event register,
+		// hence we do not miss IRQs that are taken right before WFE.
+		enableInts();
+		asm volatile ("wfe");
+		disableInts();
+	}
+}
+
 extern frg::manual_box<GicDistributor> dist;
 
 void sendPingIpi(int id) {
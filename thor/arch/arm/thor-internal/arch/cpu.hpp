@@ -387,6 +387,10 @@ void armPreemption(uint64_t nanos);
 void disarmPreemption();
 uint64_t getRawTimestampCounter();
 
+inline void pause() {
+	asm volatile ("yield");
+}
+
 void setupBootCpuContext();
 
 void setupCpuContext(AssemblyCpuData *context);
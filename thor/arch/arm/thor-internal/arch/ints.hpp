@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+
 #include <frg/spinlock.hpp>
 #include <thor-internal/debug.hpp>
 
@@ -27,6 +29,13 @@ inline void halt() {
 
 void suspendSelf();
 
+// Returns true if suspendSelfMonitored() is supported.
+bool haveIdleMonitor();
+
+// Like suspendSelf() but additionally monitors the flag using WFE.
+// Whenever the flag is set, handleIdleWake() is called (with IRQs disabled).
+[[noreturn]] void suspendSelfMonitored(std::atomic<bool> *flag);
+
 void sendPingIpi(int id);
 void sendShootdownIpi();
 
@@ -13,7 +13,9 @@ namespace thor {
 
 enum {
 	kPageSize = 0x1000,
-	kPageShift = 12
+	kPageShift = 12,
+	kHugePageSize = 0x200000,
+	kHugePageShift = 21
 };
 
 constexpr Word kPfAccess = 1;
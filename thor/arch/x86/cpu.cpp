@@ -451,6 +451,15 @@ static initgraph::Task enumerateCpuFeaturesTask{&globalInitEngine, "x86.enumerat
 					<< frg::endlog;
 		}
 
+		if(common::x86::cpuid(0x01)[2] & (1 << 3)) {
+			infoLogger() << "\e[37mthor: CPUs support MONITOR/MWAIT\e[39m"
+					<< frg::endlog;
+			globalCpuFeatures.haveMwait = true;
+		}else{
+			infoLogger() << "\e[37mthor: CPUs do not support MONITOR/MWAIT!\e[39m"
+					<< frg::endlog;
+		}
+
 		auto intelPmLeaf = common::x86::cpuid(0xA)[0];
 		if(intelPmLeaf & 0xFF) {
 			infoLogger() << "\e[37mthor: CPUs support Intel performance counters\e[39m"
@@ -560,6 +569,67 @@ static initgraph::Task initBootProcessorTask{&globalInitEngine, "x86.init-boot-p
 	}
 };
 
+namespace {
+	constexpr bool logTopology = false;
+
+	// Number of bits that are needed to distinguish n IDs.
+	unsigned int topologyShift(uint32_t n) {
+		if(n <= 1)
+			return 0;
+		return 32 - __builtin_clz(n - 1);
+	}
+
+	// Derives the core and LLC IDs from the APIC ID. The lower bits of the APIC ID
+	// distinguish SMT siblings (and CPUs that share a cache); CPUID reports their number.
+	void detectCpuTopology(CpuData *cpuData) {
+		uint32_t apicId = cpuData->localApicId;
+		auto maxLeaf = common::x86::cpuid(0)[0];
+		auto maxExtLeaf = common::x86::cpuid(0x8000'0000)[0];
+		bool haveTopoExt = maxExtLeaf >= 0x8000'001E
+				&& (common::x86::cpuid(0x8000'0001)[2] & (uint32_t(1) << 22));
+
+		unsigned int smtShift = 0;
+		if(maxLeaf >= 0xB && common::x86::cpuid(0xB, 0)[1]) {
+			// The first level of the extended topology leaf is the SMT level.
+			auto leaf = common::x86::cpuid(0xB, 0);
+			smtShift = leaf[0] & 0x1F;
+			apicId = leaf[3];
+		}else if(haveTopoExt) {
+			smtShift = topologyShift(((common::x86::cpuid(0x8000'001E)[1] >> 8) & 0xFF) + 1);
+		}
+
+		// Intel reports the deterministic cache parameters in leaf 4, AMD in leaf 0x8000001D.
+		uint32_t cacheLeaf = 0;
+		if(maxLeaf >= 4 && (common::x86::cpuid(4, 0)[0] & 0x1F)) {
+			cacheLeaf = 4;
+		}else if(haveTopoExt) {
+			cacheLeaf = 0x8000'001D;
+		}
+
+		// Without cache information, assume that all CPUs share the LLC.
+		unsigned int llcShift = 32;
+		if(cacheLeaf) {
+			unsigned int llcLevel = 0;
+			for(uint32_t i = 0; i < 16; i++) {
+				auto leaf = common::x86::cpuid(cacheLeaf, i);
+				if(!(leaf[0] & 0x1F))
+					break;
+				auto level = (leaf[0] >> 5) & 0x7;
+				if(level < llcLevel)
+					continue;
+				llcLevel = level;
+				llcShift = topologyShift(((leaf[0] >> 14) & 0xFFF) + 1);
+			}
+		}
+
+		cpuData->coreId = apicId >> smtShift;
+		cpuData->llcId = (llcShift < 32) ? (apicId >> llcShift) : 0;
+		if(logTopology)
+			infoLogger() << "thor: CPU #" << cpuData->cpuIndex << " is part of core "
+					<< cpuData->coreId << ", LLC " << cpuData->llcId << frg::endlog;
+	}
+}
+
 void initializeThisProcessor() {
 	auto cpuData = getCpuData();
 
@@ -567,6 +637,9 @@ void initializeThisProcessor() {
 	cpuData->cpuIndex = allCpuContexts->size();
 	allCpuContexts->push(cpuData);
 
+	detectCpuTopology(cpuData);
+	linkCpuTopology(cpuData);
+
 	// Allocate per-CPU areas.
 	cpuData->irqStack = UniqueKernelStack::make();
 	cpuData->dfStack = UniqueKernelStack::make();
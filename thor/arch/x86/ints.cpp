@@ -545,5 +545,24 @@ void suspendSelf() {
 	enableIntsAndHaltForever();
 }
 
+extern "C" void enableIntsAndMwaitForever(std::atomic<bool> *flag);
+
+// enableIntsAndMwaitForever() compares a single byte.
+static_assert(sizeof(std::atomic<bool>) == 1);
+
+bool haveIdleMonitor() {
+	return getGlobalCpuFeatures()->haveMwait;
+}
+
+void suspendSelfMonitored(std::atomic<bool> *flag) {
+	assert(!intsAreEnabled());
+	enableIntsAndMwaitForever(flag);
+	__builtin_unreachable();
+}
+
+extern "C" void onPlatformIdleWake() {
+	handleIdleWake();
+}
+
 } // namespace thor
 
@@ -76,11 +76,38 @@ enum {
 	kPagePat = 0x80,
 	kPageGlobal = 0x100,
 	kPageXd = 0x8000000000000000,
-	kPageAddress = 0x000FFFFFFFFFF000
+	kPageAddress = 0x000FFFFFFFFFF000,
+	// Bits of PDEs that map huge pages.
+	kPageHuge = 0x80,
+	kPageHugePat = 0x1000,
+	kPageHugeAddress = 0x000FFFFFFFE00000
 };
 
 namespace thor {
 
+namespace {
+	// Replaces a PDE that maps a huge page by a page table with equivalent PTEs.
+	void splitHugePage(arch::scalar_variable<uint64_t> *tbl2, int index2) {
+		auto entry = tbl2[index2].load();
+		assert(entry & kPageHuge);
+		// We only map write-back memory as huge pages.
+		// Otherwise, we would need to translate the PAT bit.
+		assert(!(entry & kPageHugePat));
+
+		auto tbl_address = physicalAllocator->allocate(kPageSize);
+		assert(tbl_address != PhysicalAddr(-1) && "OOM");
+		PageAccessor accessor{tbl_address};
+		auto tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor.get());
+
+		// Huge pages are always marked as dirty if they are writable (see mapSingle2m()).
+		auto bits = entry & (kPageXd | (kPageSize - 1)) & ~kPageHuge;
+		for(int i = 0; i < 512; i++)
+			tbl1[i].store(((entry & kPageHugeAddress) + i * kPageSize) | bits);
+
+		tbl2[index2].store(tbl_address | kPagePresent | kPageWrite | (entry & kPageUser));
+	}
+}
+
 // --------------------------------------------------------
 
 PageContext::PageContext()
@@ -701,7 +728,8 @@ ClientPageSpace::~ClientPageSpace() {
 		PageAccessor accessor{ps};
 		auto tbl = reinterpret_cast<uint64_t *>(accessor.get());
 		for(int i = 0; i < 512; i++) {
-			if(tbl[i] & kPagePresent)
+			// Huge pages are owned by the memory object, not by the page space.
+			if((tbl[i] & kPagePresent) && !(tbl[i] & kPageHuge))
 				physicalAllocator->free(tbl[i] & kPageAddress, kPageSize);
 		}
 	};
@@ -795,6 +823,8 @@ void ClientPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical,
 	// Make sure there is a PT.
 	tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor2.get());
 	if(tbl2[index2].load() & kPagePresent) {
+		// Callers unmap the page first; this splits huge pages.
+		assert(!(tbl2[index2].load() & kPageHuge));
 		accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 	}else{
 		auto tbl_address = physicalAllocator->allocate(kPageSize);
@@ -870,6 +900,8 @@ PageStatus ClientPageSpace::unmapSingle4k(VirtualAddr pointer) {
 	if(!(tbl2[index2].load() & kPagePresent))
 		return 0;
 	assert(tbl2[index2].load() & kPagePresent);
+	if(tbl2[index2].load() & kPageHuge)
+		splitHugePage(tbl2, index2);
 	accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 	auto tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor1.get());
 
@@ -922,6 +954,8 @@ PageStatus ClientPageSpace::cleanSingle4k(VirtualAddr pointer) {
 	if(!(tbl2[index2].load() & kPagePresent))
 		return 0;
 	assert(tbl2[index2].load() & kPagePresent);
+	if(tbl2[index2].load() & kPageHuge)
+		splitHugePage(tbl2, index2);
 	accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 	auto tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor1.get());
 
@@ -976,6 +1010,8 @@ bool ClientPageSpace::isMapped(VirtualAddr pointer) {
 	// Find the PT.
 	if(!(tbl2[index2].load() & kPagePresent))
 		return false;
+	if(tbl2[index2].load() & kPageHuge)
+		return true;
 	accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 	tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor1.get());
 
@@ -986,6 +1022,110 @@ bool ClientPageSpace::updatePageAccess(VirtualAddr) {
 	return false;
 }
 
+PhysicalAddr ClientPageSpace::mapSingle2m(VirtualAddr pointer, PhysicalAddr physical,
+		bool user_page, uint32_t flags, CachingMode caching_mode) {
+	assert(!(pointer & (kHugePageSize - 1)));
+	assert(!(physical & (kHugePageSize - 1)));
+	// See splitHugePage(); we do not support the PAT bit for huge pages.
+	assert(caching_mode == CachingMode::null || caching_mode == CachingMode::writeBack);
+
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	PageAccessor accessor4;
+	PageAccessor accessor3;
+	PageAccessor accessor2;
+
+	auto index4 = (int)((pointer >> 39) & 0x1FF);
+	auto index3 = (int)((pointer >> 30) & 0x1FF);
+	auto index2 = (int)((pointer >> 21) & 0x1FF);
+
+	// The PML4 does always exist.
+	accessor4 = PageAccessor{rootTable()};
+
+	// Make sure there is a PDPT.
+	auto tbl4 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor4.get());
+	if(tbl4[index4].load() & kPagePresent) {
+		accessor3 = PageAccessor{tbl4[index4].load() & 0x000FFFFFFFFFF000};
+	}else{
+		auto tbl_address = physicalAllocator->allocate(kPageSize);
+		assert(tbl_address != PhysicalAddr(-1) && "OOM");
+		accessor3 = PageAccessor{tbl_address};
+		memset(accessor3.get(), 0, kPageSize);
+
+		uint64_t new_entry = tbl_address | kPagePresent | kPageWrite;
+		if(user_page)
+			new_entry |= kPageUser;
+		tbl4[index4].store(new_entry);
+	}
+
+	// Make sure there is a PD.
+	auto tbl3 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor3.get());
+	if(tbl3[index3].load() & kPagePresent) {
+		accessor2 = PageAccessor{tbl3[index3].load() & 0x000FFFFFFFFFF000};
+	}else{
+		auto tbl_address = physicalAllocator->allocate(kPageSize);
+		assert(tbl_address != PhysicalAddr(-1) && "OOM");
+		accessor2 = PageAccessor{tbl_address};
+		memset(accessor2.get(), 0, kPageSize);
+
+		uint64_t new_entry = tbl_address | kPagePresent | kPageWrite;
+		if(user_page)
+			new_entry |= kPageUser;
+		tbl3[index3].store(new_entry);
+	}
+
+	// Replace the PT (if any) by the new PDE.
+	auto tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor2.get());
+	auto old_entry = tbl2[index2].load();
+	assert(!(old_entry & kPageHuge));
+
+	uint64_t new_entry = physical | kPagePresent | kPageHuge;
+	if(user_page)
+		new_entry |= kPageUser;
+	// Until shootdown completes, other CPUs can still set dirty bits in the old PTEs.
+	// Instead of collecting them, we conservatively mark writable huge pages as dirty.
+	if(flags & page_access::write)
+		new_entry |= kPageWrite | kPageDirty;
+	if(!(flags & page_access::execute))
+		new_entry |= kPageXd;
+	tbl2[index2].store(new_entry);
+
+	if(!(old_entry & kPagePresent))
+		return PhysicalAddr(-1);
+	return old_entry & 0x000FFFFFFFFFF000;
+}
+
+bool ClientPageSpace::isMapped2m(VirtualAddr pointer) {
+	assert(!(pointer & (kHugePageSize - 1)));
+
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	auto index4 = (int)((pointer >> 39) & 0x1FF);
+	auto index3 = (int)((pointer >> 30) & 0x1FF);
+	auto index2 = (int)((pointer >> 21) & 0x1FF);
+
+	// The PML4 is always present.
+	PageAccessor accessor4{rootTable()};
+	auto tbl4 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor4.get());
+
+	// Find the PDPT.
+	if(!(tbl4[index4].load() & kPagePresent))
+		return false;
+	PageAccessor accessor3{tbl4[index4].load() & 0x000FFFFFFFFFF000};
+	auto tbl3 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor3.get());
+
+	// Find the PD.
+	if(!(tbl3[index3].load() & kPagePresent))
+		return false;
+	PageAccessor accessor2{tbl3[index3].load() & 0x000FFFFFFFFFF000};
+	auto tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor2.get());
+
+	auto entry = tbl2[index2].load();
+	return (entry & kPagePresent) && (entry & kPageHuge);
+}
+
 ClientPageSpace::Walk::Walk(ClientPageSpace *space)
 : _space{space} {
 	irqMutex().lock();
@@ -1005,14 +1145,20 @@ void ClientPageSpace::Walk::walkTo(uintptr_t address) {
 	_accessor3 = PageAccessor{};
 	_accessor2 = PageAccessor{};
 	_accessor1 = PageAccessor{};
+	_hugeEntry = 0;
 }
 
 PageFlags ClientPageSpace::Walk::peekFlags() {
 	_update();
-	assert(_accessor1);
 
-	auto tbl = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor1.get());
-	auto ent = tbl[(_address >> 12) & 0x1FF].load();
+	uint64_t ent;
+	if(_hugeEntry) {
+		ent = _hugeEntry;
+	}else{
+		assert(_accessor1);
+		auto tbl = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor1.get());
+		ent = tbl[(_address >> 12) & 0x1FF].load();
+	}
 	assert(ent & kPagePresent);
 
 	PageFlags flags = 0;
@@ -1025,6 +1171,11 @@ PageFlags ClientPageSpace::Walk::peekFlags() {
 
 PhysicalAddr ClientPageSpace::Walk::peekPhysical() {
 	_update();
+
+	// Collapsed ranges are mapped by 2 MiB PDEs (see mapSingle2m()).
+	if(_hugeEntry)
+		return (_hugeEntry & kPageHugeAddress) + (_address & (kHugePageSize - 1));
+
 	assert(_accessor1);
 
 	auto tbl = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor1.get());
@@ -1053,10 +1204,14 @@ void ClientPageSpace::Walk::_update() {
 		return;
 	_accessor2 = PageAccessor{tbl3[index3].load() & 0x000FFFFFFFFFF000};
 
-	// Make sure there is a PT.
+	// Make sure there is a PT (unless the range is mapped by a huge page).
 	auto tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor2.get());
 	if(!(tbl2[index2].load() & kPagePresent))
 		return;
+	if(tbl2[index2].load() & kPageHuge) {
+		_hugeEntry = tbl2[index2].load();
+		return;
+	}
 	_accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 }
 
@@ -522,6 +522,7 @@ struct CpuFeatures {
 	bool haveZmm;
 	bool haveInvariantTsc;
 	bool haveTscDeadline;
+	bool haveMwait;
 	bool haveVmx;
 	uint32_t profileFlags;
 	size_t xsaveRegionSize;
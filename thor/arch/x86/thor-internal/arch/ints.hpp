@@ -34,6 +34,13 @@ inline void halt() {
 
 void suspendSelf();
 
+// Returns true if suspendSelfMonitored() is supported (i.e., MONITOR/MWAIT is available).
+bool haveIdleMonitor();
+
+// Like suspendSelf() but additionally monitors the flag using MONITOR/MWAIT.
+// Whenever the flag is set, handleIdleWake() is called (with IRQs disabled).
+[[noreturn]] void suspendSelfMonitored(std::atomic<bool> *flag);
+
 void sendPingIpi(int id);
 
 } // namespace thor
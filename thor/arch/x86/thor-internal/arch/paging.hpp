@@ -13,7 +13,9 @@ namespace thor {
 
 enum {
 	kPageSize = 0x1000,
-	kPageShift = 12
+	kPageShift = 12,
+	kHugePageSize = 0x200000,
+	kHugePageShift = 21
 };
 
 constexpr Word kPfAccess = 1;
@@ -339,6 +341,9 @@ public:
 		PageAccessor _accessor3;
 		PageAccessor _accessor2;
 		PageAccessor _accessor1; // Finest level (page table).
+
+		// PDE that maps _address if it is part of a huge page (zero otherwise).
+		uint64_t _hugeEntry = 0;
 	};
 
 	ClientPageSpace();
@@ -356,6 +361,13 @@ public:
 	bool isMapped(VirtualAddr pointer);
 	bool updatePageAccess(VirtualAddr pointer);
 
+	// Replaces the page table that maps a 2 MiB range by a single huge page.
+	// Returns the old page table (or PhysicalAddr(-1) if there was none);
+	// it must only be freed after TLB shootdown.
+	PhysicalAddr mapSingle2m(VirtualAddr pointer, PhysicalAddr physical, bool user_access,
+			uint32_t flags, CachingMode caching_mode);
+	bool isMapped2m(VirtualAddr pointer);
+
 private:
 	frg::ticket_spinlock _mutex;
 };
@@ -0,0 +1,94 @@
+#include <new>
+
+#include <thor-internal/action-arena.hpp>
+#include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/kernel-locks.hpp>
+
+namespace thor {
+
+ActionArena::~ActionArena() {
+	while(_cached) {
+		auto block = _cached;
+		_cached = block->next;
+		kernelAlloc->deallocate(block, blockSize);
+	}
+}
+
+void *ActionArena::allocate() {
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		if(_cached) {
+			auto block = _cached;
+			_cached = block->next;
+			_numCached--;
+			_numHits++;
+			return block;
+		}
+		_numMisses++;
+	}
+
+	return kernelAlloc->allocate(blockSize);
+}
+
+void ActionArena::free(void *pointer) {
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		if(_numCached < maxCachedBlocks) {
+			auto block = new (pointer) FreeBlock{_cached};
+			_cached = block;
+			_numCached++;
+			return;
+		}
+	}
+
+	kernelAlloc->deallocate(pointer, blockSize);
+}
+
+ActionArena::Stats ActionArena::getStats() {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	return Stats{
+		.numHits = _numHits,
+		.numMisses = _numMisses
+	};
+}
+
+namespace {
+	// Stored in front of each coroutine frame.
+	// The header keeps the arena alive until the frame is freed.
+	struct alignas(16) FrameHeader {
+		smarter::shared_ptr<ActionArena> arena;
+	};
+}
+
+void *allocateArenaFrame(smarter::shared_ptr<ActionArena> arena, size_t size) {
+	void *pointer;
+	if(arena && sizeof(FrameHeader) + size <= ActionArena::blockSize) {
+		pointer = arena->allocate();
+	}else{
+		arena = nullptr;
+		pointer = kernelAlloc->allocate(sizeof(FrameHeader) + size);
+	}
+
+	auto header = new (pointer) FrameHeader{std::move(arena)};
+	return header + 1;
+}
+
+void freeArenaFrame(void *frame, size_t size) {
+	auto header = reinterpret_cast<FrameHeader *>(frame) - 1;
+	auto arena = std::move(header->arena);
+	header->~FrameHeader();
+
+	if(arena) {
+		arena->free(header);
+	}else{
+		kernelAlloc->deallocate(header, sizeof(FrameHeader) + size);
+	}
+}
+
+} // namespace thor
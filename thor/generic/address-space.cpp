@@ -4,7 +4,9 @@
 #include <thor-internal/coroutine.hpp>
 #include <thor-internal/physical.hpp>
 #include <thor-internal/fiber.hpp>
+#include <thor-internal/huge-pages.hpp>
 #include <frg/container_of.hpp>
+#include <frg/vector.hpp>
 #include <thor-internal/types.hpp>
 
 namespace thor {
@@ -32,6 +34,18 @@ namespace {
 				<< (physicalAllocator->numUsedPages() * 4) << " KiB, kernel usage: "
 				<< (kernelMemoryUsage / 1024) << " KiB" << frg::endlog;
 	}
+
+	// Translates the protection of a mapping back to kMapProt* flags.
+	VirtualSpace::MapFlags protectionOf(Mapping *mapping) {
+		VirtualSpace::MapFlags protection = 0;
+		if(mapping->flags & MappingFlags::protRead)
+			protection |= VirtualSpace::kMapProtRead;
+		if(mapping->flags & MappingFlags::protWrite)
+			protection |= VirtualSpace::kMapProtWrite;
+		if(mapping->flags & MappingFlags::protExecute)
+			protection |= VirtualSpace::kMapProtExecute;
+		return protection;
+	}
 }
 
 // --------------------------------------------------------
@@ -146,6 +160,19 @@ size_t VirtualOperations::getRss() {
 	return 0;
 }
 
+bool VirtualOperations::supportsHugePages() {
+	return false;
+}
+
+bool VirtualOperations::isHugePage(VirtualAddr) {
+	return false;
+}
+
+PhysicalAddr VirtualOperations::mapHugePage(VirtualAddr, PhysicalAddr, PageFlags, CachingMode) {
+	panicLogger() << "thor: VirtualOperations do not support huge pages" << frg::endlog;
+	__builtin_unreachable();
+}
+
 // --------------------------------------------------------
 
 MemorySlice::MemorySlice(smarter::shared_ptr<MemoryView> view,
@@ -275,6 +302,11 @@ Mapping::resolveRange(ptrdiff_t offset) {
 	return frg::tuple<PhysicalAddr, CachingMode>{bundle_range.get<0>(), bundle_range.get<1>()};
 }
 
+void Mapping::TreeRelease::reclaim() {
+	auto self = frg::container_of(this, &Mapping::treeRelease);
+	self->selfPtr.ctr()->decrement();
+}
+
 coroutine<void> Mapping::runEvictionLoop() {
 	while(true) {
 		auto eviction = co_await view->pollEviction(&observer, cancelEviction);
@@ -320,7 +352,8 @@ coroutine<void> Mapping::runEvictionLoop() {
 // --------------------------------------------------------
 
 CowChain::CowChain(smarter::shared_ptr<CowChain> chain)
-: _superChain{std::move(chain)}, _pages{*kernelAlloc} {
+: _superChain{std::move(chain)}, _pages{*kernelAlloc},
+		_depth{_superChain ? _superChain->_depth + 1 : 1} {
 }
 
 CowChain::~CowChain() {
@@ -361,6 +394,8 @@ void VirtualSpace::retire() {
 	if(logCleanup)
 		infoLogger() << "\e[31mthor: VirtualSpace is cleared\e[39m" << frg::endlog;
 
+	getHugePageCollapser()->unregisterSpace(this);
+
 	// TODO: Set some flag to make sure that no mappings are added/deleted.
 	auto mapping = _mappings.first();
 	while(mapping) {
@@ -381,7 +416,14 @@ void VirtualSpace::retire() {
 
 		while(self->_mappings.get_root()) {
 			auto mapping = self->_mappings.get_root();
-			self->_mappings.remove(mapping);
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto lock = frg::guard(&self->_snapshotMutex);
+
+				self->_beginMappingUpdate();
+				self->_mappings.remove(mapping);
+				self->_endMappingUpdate();
+			}
 
 			assert(mapping->state == MappingState::zombie);
 			mapping->state = MappingState::retired;
@@ -391,7 +433,7 @@ void VirtualSpace::retire() {
 				co_await mapping->evictionDoneEvent.wait();
 			}
 			mapping->view->removeObserver(&mapping->observer);
-			mapping->selfPtr.ctr()->decrement();
+			rcuRetire(&mapping->treeRelease);
 		}
 	}(selfPtr.lock()));
 }
@@ -405,33 +447,61 @@ VirtualSpace::map(smarter::borrowed_ptr<MemorySlice> slice,
 	if(offset + length > slice->length())
 		co_return Error::bufferTooSmall;
 
-	co_await _consistencyMutex.async_lock();
-	frg::unique_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
-	bool needsShootdown = false;
+	VirtualRangeLock::Node rangeNode;
+	VirtualAddr actualAddress;
+	if(flags & kMapFixed) {
+		assert(address);
+		assert((address % kPageSize) == 0);
+
+		co_await _lockRange(&rangeNode, address, length);
+		co_await _splitMappings(address, length);
+		co_await _unmapMappings(address, length);
+
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto spaceLock = frg::guard(&_snapshotMutex);
+
+			actualAddress = _allocateAt(address, length);
+		}
+		// The range is not part of the address space.
+		if(!actualAddress) {
+			_rangeLock.unlock(&rangeNode);
+			co_return Error::illegalArgs;
+		}
+	}else{
+		// The hole needs to be reserved and locked atomically. Otherwise, a concurrent
+		// kMapFixed operation could take (or split) the same hole in between.
+		while(true) {
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto spaceLock = frg::guard(&_snapshotMutex);
 
-	if (flags & kMapFixed) {
-		auto [start, end] = co_await _splitMappings(address, length);
-		assert(start || (!start && !end));
-		needsShootdown = co_await _unmapMappings(address, length, start, end);
+				actualAddress = _allocate(length, flags);
+				if(!actualAddress)
+					co_return Error::noMemory;
+
+				rangeNode.address = actualAddress;
+				rangeNode.length = length;
+				if(_rangeLock.tryLock(&rangeNode))
+					break;
+
+				// An operation on a larger range (that covered the hole) is still in progress.
+				_freeHole(actualAddress, length);
+			}
+
+			// Wait for that operation to finish before retrying.
+			co_await _rangeLock.lock(&rangeNode);
+			_rangeLock.unlock(&rangeNode);
+		}
 	}
+	assert(actualAddress);
 
 	// The shared_ptr to the new Mapping needs to survive until the locks are released.
-	VirtualAddr actualAddress;
 	smarter::shared_ptr<Mapping> mapping;
 	{
 		auto irqLock = frg::guard(&irqMutex());
 		auto spaceLock = frg::guard(&_snapshotMutex);
 
-		if(flags & kMapFixed) {
-			assert(address);
-			assert((address % kPageSize) == 0);
-
-			actualAddress = _allocateAt(address, length);
-		}else{
-			actualAddress = _allocate(length, flags);
-		}
-		assert(actualAddress);
-
 	//	infoLogger() << "Creating new mapping at " << (void *)actualAddress
 	//			<< ", length: " << (void *)length << frg::endlog;
 
@@ -472,11 +542,15 @@ VirtualSpace::map(smarter::borrowed_ptr<MemorySlice> slice,
 
 		// Install the new mapping object.
 		mapping->tie(selfPtr.lock(), actualAddress);
-		_mappings.insert(mapping.get());
 
+		// Lookups can observe the mapping as soon as it is inserted.
 		assert(mapping->state == MappingState::null);
 		mapping->state = MappingState::active;
 
+		_beginMappingUpdate();
+		_mappings.insert(mapping.get());
+		_endMappingUpdate();
+
 		// We keep one reference until the detach the observer.
 		mapping.ctr()->increment();
 		mapping->view->addObserver(&mapping->observer);
@@ -494,15 +568,13 @@ VirtualSpace::map(smarter::borrowed_ptr<MemorySlice> slice,
 		assert(mapOutcome);
 	}
 
-	if (needsShootdown)
-		co_await _ops->shootdown(actualAddress, length);
-
 	// Only enable eviction after the peekRange() loop above.
 	// Since eviction is not yet enabled in that loop, we do not have
 	// to take the evictionMutex.
 	if(mapping->view->canEvictMemory())
 		async::detach_with_allocator(*kernelAlloc, mapping->runEvictionLoop());
 
+	_rangeLock.unlock(&rangeNode);
 	co_return actualAddress;
 }
 
@@ -532,73 +604,78 @@ VirtualSpace::protect(VirtualAddr address, size_t length, uint32_t flags) {
 		assert(!(flags & mask));
 	}
 
-	co_await _consistencyMutex.async_lock();
-	frg::unique_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
+	VirtualRangeLock::Node rangeNode;
+	co_await _lockRange(&rangeNode, address, length);
+	co_await _splitMappings(address, length);
+
+	// After splitting, all mappings that start within the range are completely inside of it.
+	auto cursor = address;
+	while(true) {
+		smarter::shared_ptr<Mapping> mapping;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_snapshotMutex);
 
-	auto [start, end] = co_await _splitMappings(address, length);
-	assert(start || (!start && !end));
-	for (auto it = start; it != end;) {
-		auto mapping = it->selfPtr.lock();
-		it = MappingTree::successor(it);
+			if(auto next = _firstMappingIn(cursor, address + length); next)
+				mapping = next->selfPtr.lock();
+		}
+		if(!mapping)
+			break;
+		cursor = mapping->address + mapping->length;
+		assert(cursor <= address + length);
 
-		if (address >= mapping->address && (address + length) <= (mapping->address + mapping->length)) {
-			mapping->protect(static_cast<MappingFlags>(mappingFlags));
+		mapping->protect(static_cast<MappingFlags>(mappingFlags));
 
-			assert(mapping->state == MappingState::active);
+		assert(mapping->state == MappingState::active);
 
-			uint32_t pageFlags = 0;
-			if((mapping->flags & MappingFlags::permissionMask) & MappingFlags::protWrite)
-				pageFlags |= page_access::write;
-			if((mapping->flags & MappingFlags::permissionMask) & MappingFlags::protExecute)
-				pageFlags |= page_access::execute;
-			if((mapping->flags & MappingFlags::permissionMask) & MappingFlags::protRead)
-				pageFlags |= page_access::read;
+		uint32_t pageFlags = 0;
+		if((mapping->flags & MappingFlags::permissionMask) & MappingFlags::protWrite)
+			pageFlags |= page_access::write;
+		if((mapping->flags & MappingFlags::permissionMask) & MappingFlags::protExecute)
+			pageFlags |= page_access::execute;
+		if((mapping->flags & MappingFlags::permissionMask) & MappingFlags::protRead)
+			pageFlags |= page_access::read;
 
-			co_await mapping->evictionMutex.async_lock();
-			frg::unique_lock evictionLock{frg::adopt_lock, mapping->evictionMutex};
+		co_await mapping->evictionMutex.async_lock();
+		frg::unique_lock evictionLock{frg::adopt_lock, mapping->evictionMutex};
 
-			auto remapOutcome = _ops->remapPresentPages(mapping->address, mapping->view.get(),
-					mapping->viewOffset, mapping->length, pageFlags);
-			assert(remapOutcome);
-		}
+		auto remapOutcome = _ops->remapPresentPages(mapping->address, mapping->view.get(),
+				mapping->viewOffset, mapping->length, pageFlags);
+		assert(remapOutcome);
 	}
 
 	co_await _ops->shootdown(address, length);
+	_rangeLock.unlock(&rangeNode);
 	co_return {};
 }
 
 coroutine<frg::expected<Error>> VirtualSpace::unmap(VirtualAddr address, size_t length) {
-	co_await _consistencyMutex.async_lock();
-	frg::unique_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
+	VirtualRangeLock::Node rangeNode;
+	co_await _lockRange(&rangeNode, address, length);
 
-	auto [start, end] = co_await _splitMappings(address, length);
-	assert(start || (!start && !end));
-	auto needsShootdown = co_await _unmapMappings(address, length, start, end);
-
-	if (needsShootdown)
-		co_await _ops->shootdown(address, length);
+	co_await _splitMappings(address, length);
+	co_await _unmapMappings(address, length);
 
+	_rangeLock.unlock(&rangeNode);
 	co_return {};
 }
 
 coroutine<frg::expected<Error>>
 VirtualSpace::synchronize(VirtualAddr address, size_t size) {
-	co_await _consistencyMutex.async_lock_shared();
-	frg::shared_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
-
 	auto misalign = address & (kPageSize - 1);
 	auto alignedAddress = address & ~(kPageSize - 1);
 	auto alignedSize = (size + misalign + kPageSize - 1) & ~(kPageSize - 1);
 
+	// Splitting a mapping requires a lock on the entire mapping; hence, locking
+	// the range that we clean is enough to keep all mappings stable.
+	VirtualRangeLock::Node rangeNode;
+	rangeNode.address = alignedAddress;
+	rangeNode.length = alignedSize;
+	co_await _rangeLock.lock(&rangeNode);
+
 	size_t overallProgress = 0;
 	while(overallProgress < alignedSize) {
-		smarter::shared_ptr<Mapping> mapping;
-		{
-			auto irqLock = frg::guard(&irqMutex());
-			auto spaceGuard = frg::guard(&_snapshotMutex);
-
-			mapping = _findMapping(alignedAddress + overallProgress);
-		}
+		auto mapping = _findMapping(alignedAddress + overallProgress);
 		assert(mapping);
 
 		auto mappingOffset = alignedAddress + overallProgress - mapping->address;
@@ -615,37 +692,33 @@ VirtualSpace::synchronize(VirtualAddr address, size_t size) {
 	}
 	co_await _ops->shootdown(alignedAddress, alignedSize);
 
+	_rangeLock.unlock(&rangeNode);
 	co_return {};
 }
 
 coroutine<frg::expected<Error>>
 VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 		smarter::shared_ptr<WorkQueue> wq) {
-	co_await _consistencyMutex.async_lock_shared();
-	frg::shared_lock consistencyLock{frg::adopt_lock, _consistencyMutex};
+	// We do not take _rangeLock here such that faults do not contend on shared
+	// cache lines. Instead, we check the state of the mapping under its evictionMutex:
+	// unmap() and the mapping splitting code turn mappings into zombies under that mutex.
 
-	smarter::shared_ptr<Mapping> mapping;
-	{
-		auto irq_lock = frg::guard(&irqMutex());
-		auto space_guard = frg::guard(&_snapshotMutex);
-
-		mapping = _findMapping(address);
-	}
+	auto mapping = _findMapping(address);
 	if(!mapping)
 		co_return Error::fault;
 
-	// Check access attributes.
-	if((faultFlags & VirtualSpace::kFaultWrite)
-			&& !((mapping->flags & MappingFlags::protWrite)))
-		co_return Error::fault;
-	if((faultFlags & VirtualSpace::kFaultExecute)
-			&& !((mapping->flags & MappingFlags::protExecute)))
-		co_return Error::fault;
+	while(true) {
+		// Check access attributes.
+		if((faultFlags & VirtualSpace::kFaultWrite)
+				&& !((mapping->flags & MappingFlags::protWrite)))
+			co_return Error::fault;
+		if((faultFlags & VirtualSpace::kFaultExecute)
+				&& !((mapping->flags & MappingFlags::protExecute)))
+			co_return Error::fault;
 
-	// TODO: Aligning should not be necessary here.
-	auto offset = (address - mapping->address) & ~(kPageSize - 1);
+		// TODO: Aligning should not be necessary here.
+		auto offset = (address - mapping->address) & ~(kPageSize - 1);
 
-	while(true) {
 		FetchFlags fetchFlags = 0;
 		if(mapping->flags & MappingFlags::dontRequireBacking)
 			fetchFlags |= fetchDisallowBacking;
@@ -656,6 +729,17 @@ VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 		co_await mapping->evictionMutex.async_lock();
 		frg::unique_lock evictionLock{frg::adopt_lock, mapping->evictionMutex};
 
+		if(mapping->state != MappingState::active) {
+			// The mapping was split or unmapped concurrently.
+			// If it was split, the lookup returns one of the new mappings.
+			evictionLock.unlock();
+			auto newMapping = _findMapping(address);
+			if(!newMapping || newMapping == mapping)
+				co_return Error::fault;
+			mapping = std::move(newMapping);
+			continue;
+		}
+
 		auto remapOutcome = _ops->faultPage(address & ~(kPageSize - 1),
 				mapping->view.get(), mapping->viewOffset + offset,
 				mapping->compilePageFlags());
@@ -678,15 +762,9 @@ VirtualSpace::handleFault(VirtualAddr address, uint32_t faultFlags,
 
 coroutine<frg::expected<Error, PhysicalAddr>>
 VirtualSpace::retrievePhysical(VirtualAddr address, smarter::shared_ptr<WorkQueue> wq) {
-	// We do not take _consistencyMutex here since we are only interested in a snapshot.
-
-	smarter::shared_ptr<Mapping> mapping;
-	{
-		auto irq_lock = frg::guard(&irqMutex());
-		auto space_guard = frg::guard(&_snapshotMutex);
+	// We do not take _rangeLock here since we are only interested in a snapshot.
 
-		mapping = _findMapping(address);
-	}
+	auto mapping = _findMapping(address);
 	if(!mapping)
 		co_return Error::fault;
 
@@ -712,21 +790,140 @@ VirtualSpace::retrievePhysical(VirtualAddr address, smarter::shared_ptr<WorkQueu
 	}
 }
 
-smarter::shared_ptr<Mapping> VirtualSpace::_findMapping(VirtualAddr address) {
+frg::optional<VirtualAddr> VirtualSpace::findHugePageCandidate(VirtualAddr address) {
+	if(!_ops->supportsHugePages())
+		return frg::null_opt;
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_snapshotMutex);
+
+	// Find the lowest mapping that ends above address.
+	Mapping *mapping = nullptr;
 	auto current = _mappings.get_root();
 	while(current) {
-		if(address < current->address) {
+		if(current->address + current->length > address) {
+			mapping = current;
 			current = MappingTree::get_left(current);
-		}else if(address >= current->address + current->length) {
-			current = MappingTree::get_right(current);
 		}else{
-			assert(address >= current->address
-					&& address < current->address + current->length);
-			return current->selfPtr.lock();
+			current = MappingTree::get_right(current);
+		}
+	}
+
+	for(; mapping; mapping = MappingTree::successor(mapping)) {
+		if(!mapping->compilePageFlags())
+			continue;
+		// The view offset needs to have the same alignment as the virtual address.
+		if((mapping->address - mapping->viewOffset) & (kHugePageSize - 1))
+			continue;
+
+		auto candidate = (frg::max(address, mapping->address) + kHugePageSize - 1)
+				& ~(kHugePageSize - 1);
+		if(candidate + kHugePageSize <= mapping->address + mapping->length)
+			return candidate;
+	}
+	return frg::null_opt;
+}
+
+coroutine<frg::expected<Error>> VirtualSpace::collapseHugePage(VirtualAddr address) {
+	assert(!(address & (kHugePageSize - 1)));
+
+	if(!_ops->supportsHugePages())
+		co_return Error::noHardwareSupport;
+
+	VirtualRangeLock::Node rangeNode;
+	rangeNode.address = address;
+	rangeNode.length = kHugePageSize;
+	co_await _rangeLock.lock(&rangeNode);
+
+	auto outcome = co_await _collapseHugePage(address);
+
+	_rangeLock.unlock(&rangeNode);
+	co_return outcome;
+}
+
+coroutine<frg::expected<Error>> VirtualSpace::_collapseHugePage(VirtualAddr address) {
+	// Since we hold the range lock, the mapping cannot be split or unmapped.
+	auto mapping = _findMapping(address);
+	if(!mapping || mapping->address > address
+			|| address + kHugePageSize > mapping->address + mapping->length)
+		co_return Error::fault;
+	if((mapping->address - mapping->viewOffset) & (kHugePageSize - 1))
+		co_return Error::fault;
+
+	auto pageFlags = mapping->compilePageFlags();
+	if(!pageFlags)
+		co_return Error::fault;
+
+	if(_ops->isHugePage(address))
+		co_return Error::spuriousOperation;
+
+	auto offset = mapping->viewOffset + (address - mapping->address);
+	auto physical = FRG_CO_TRY(co_await mapping->view->collapseRange(offset));
+	assert(!(physical & (kHugePageSize - 1)));
+
+	PhysicalAddr oldTable;
+	{
+		co_await mapping->evictionMutex.async_lock();
+		frg::unique_lock evictionLock{frg::adopt_lock, mapping->evictionMutex};
+
+		if(mapping->state != MappingState::active)
+			co_return Error::fault;
+
+		// Pages can be evicted again after collapseRange() returns, so verify the result.
+		// Evictions that start after this point split the huge page again.
+		for(size_t progress = 0; progress < kHugePageSize; progress += kPageSize) {
+			auto physicalRange = mapping->view->peekRange(offset + progress);
+			if(physicalRange.get<0>() != physical + progress)
+				co_return Error::cancelled;
+			if(physicalRange.get<1>() != CachingMode::null)
+				co_return Error::illegalObject;
 		}
+
+		oldTable = _ops->mapHugePage(address, physical, pageFlags, CachingMode::null);
 	}
 
-	return nullptr;
+	co_await _ops->shootdown(address, kHugePageSize);
+
+	if(oldTable != PhysicalAddr(-1))
+		physicalAllocator->free(oldTable, kPageSize);
+	co_return {};
+}
+
+smarter::shared_ptr<Mapping> VirtualSpace::_findMapping(VirtualAddr address) {
+	// The tree can be rebalanced while we traverse it. Rotations can make us miss
+	// the mapping or even (transiently) create cycles; hence, we bound the number of steps
+	// and validate the result against _mappingSeq. RCU ensures that all nodes that we
+	// visit stay alive (and keep their tree reference) until we leave the critical section.
+	constexpr int maxSteps = 128;
+
+	auto irqLock = frg::guard(&irqMutex());
+	RcuReadGuard rcuGuard;
+
+	while(true) {
+		auto seq = _mappingSeq.load(std::memory_order_acquire);
+		// If seq is odd, a writer is active.
+		if(seq & 1)
+			continue;
+
+		smarter::shared_ptr<Mapping> result;
+		auto current = _mappings.get_root();
+		for(int n = 0; current && n < maxSteps; ++n) {
+			if(address < current->address) {
+				current = MappingTree::get_left(current);
+			}else if(address >= current->address + current->length) {
+				current = MappingTree::get_right(current);
+			}else{
+				// Taking a reference is safe since the tree's reference is only
+				// dropped after the RCU grace period.
+				result = current->selfPtr.lock();
+				break;
+			}
+		}
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(_mappingSeq.load(std::memory_order_relaxed) == seq)
+			return result;
+	}
 }
 
 VirtualAddr VirtualSpace::_allocate(size_t length, MapFlags flags) {
@@ -789,8 +986,8 @@ VirtualAddr VirtualSpace::_allocateAt(VirtualAddr address, size_t length) {
 
 	auto current = _holes.get_root();
 	while(true) {
-		// TODO: Otherwise, this method fails.
-		assert(current);
+		if(!current)
+			return 0;
 
 		if(address < current->address()) {
 			current = HoleTree::get_left(current);
@@ -802,6 +999,8 @@ VirtualAddr VirtualSpace::_allocateAt(VirtualAddr address, size_t length) {
 			break;
 		}
 	}
+	if(address + length > current->address() + current->length())
+		return 0;
 
 	_splitHole(current, address - current->address(), length);
 	return address;
@@ -827,235 +1026,273 @@ void VirtualSpace::_splitHole(Hole *hole, VirtualAddr offset, size_t length) {
 	frg::destruct(*kernelAlloc, hole);
 }
 
-coroutine<frg::tuple<Mapping *, Mapping *>> VirtualSpace::_splitMappings(uintptr_t address, size_t size) {
-	// _consistencyMutex is held here by the caller
-
-	auto left = _mappings.get_root();
-	while (left) {
-		if (auto next = MappingTree::get_left(left))
-			left = next;
-		else
-			break;
+Mapping *VirtualSpace::_firstMappingIn(VirtualAddr address, VirtualAddr limit) {
+	// Find the lowest mapping that starts at or above address.
+	Mapping *result = nullptr;
+	auto current = _mappings.get_root();
+	while(current) {
+		if(current->address >= address) {
+			result = current;
+			current = MappingTree::get_left(current);
+		}else{
+			current = MappingTree::get_right(current);
+		}
 	}
 
-	Mapping *start = nullptr, *end = nullptr;
-	for (auto it = left; it;) {
-		if ((it->address + it->length) <= address) {
-			it = MappingTree::successor(it);
-			start = it;
-			continue;
-		}
+	if(!result || result->address >= limit)
+		return nullptr;
+	return result;
+}
 
-		if (it->address >= (address + size)) {
-			// If no mapping fell into the range, don't set the end iterator
-			if (start)
-				end = it;
+void VirtualSpace::_freeHole(VirtualAddr address, size_t length) {
+	// Find the holes that preceede/succeede the range.
+	Hole *pre;
+	Hole *succ;
 
-			break;
+	auto current = _holes.get_root();
+	while(true) {
+		assert(current);
+		if(address < current->address()) {
+			if(HoleTree::get_left(current)) {
+				current = HoleTree::get_left(current);
+			}else{
+				pre = HoleTree::predecessor(current);
+				succ = current;
+				break;
+			}
+		}else{
+			assert(address >= current->address() + current->length());
+			if(HoleTree::get_right(current)) {
+				current = HoleTree::get_right(current);
+			}else{
+				pre = current;
+				succ = HoleTree::successor(current);
+				break;
+			}
 		}
+	}
 
-		if (!start)
-			start = it;
+	// Try to merge the new hole and the existing ones.
+	if(pre && pre->address() + pre->length() == address
+			&& succ && address + length == succ->address()) {
+		auto hole = frg::construct<Hole>(*kernelAlloc, pre->address(),
+				pre->length() + length + succ->length());
+
+		_holes.remove(pre);
+		_holes.remove(succ);
+		_holes.insert(hole);
+		frg::destruct(*kernelAlloc, pre);
+		frg::destruct(*kernelAlloc, succ);
+	}else if(pre && pre->address() + pre->length() == address) {
+		auto hole = frg::construct<Hole>(*kernelAlloc,
+				pre->address(), pre->length() + length);
+
+		_holes.remove(pre);
+		_holes.insert(hole);
+		frg::destruct(*kernelAlloc, pre);
+	}else if(succ && address + length == succ->address()) {
+		auto hole = frg::construct<Hole>(*kernelAlloc,
+				address, length + succ->length());
+
+		_holes.remove(succ);
+		_holes.insert(hole);
+		frg::destruct(*kernelAlloc, succ);
+	}else{
+		auto hole = frg::construct<Hole>(*kernelAlloc,
+				address, length);
 
-		auto mapping = it->selfPtr.lock();
-		auto at = address;
+		_holes.insert(hole);
+	}
+}
 
-		// Starting split not within mapping, consider end split
-		if (at <= mapping->address)
-			at = address + size;
+coroutine<void> VirtualSpace::_lockRange(VirtualRangeLock::Node *node,
+		VirtualAddr address, size_t length) {
+	auto lockAddress = address;
+	auto lockLimit = address + length;
+	while(true) {
+		node->address = lockAddress;
+		node->length = lockLimit - lockAddress;
+		co_await _rangeLock.lock(node);
+
+		// Mappings that straddle the boundaries of the range are replaced by
+		// _splitMappings(); hence, we need to lock them completely.
+		// Since we hold the lock now, these mappings cannot change anymore.
+		auto newAddress = lockAddress;
+		auto newLimit = lockLimit;
+		if(auto mapping = _findMapping(address); mapping)
+			newAddress = frg::min(newAddress, mapping->address);
+		if(auto mapping = _findMapping(address + length - 1); mapping)
+			newLimit = frg::max(newLimit, mapping->address + mapping->length);
+
+		if(newAddress == lockAddress && newLimit == lockLimit)
+			co_return;
+
+		// Retry with the extended range. This is rare since it requires
+		// the straddling mapping to be created concurrently.
+		_rangeLock.unlock(node);
+		lockAddress = newAddress;
+		lockLimit = newLimit;
+	}
+}
 
-		if (at > mapping->address && at < (mapping->address + mapping->length)) {
-			// Split mapping into left and right part
-			smarter::shared_ptr<Mapping> leftMapping = nullptr;
-			smarter::shared_ptr<Mapping> rightMapping = nullptr;
+coroutine<void> VirtualSpace::_splitMappingAt(VirtualAddr at) {
+	auto mapping = _findMapping(at);
+	if(!mapping || mapping->address == at)
+		co_return;
+	assert(at > mapping->address && at < (mapping->address + mapping->length));
 
-			assert(mapping->state == MappingState::active);
-			mapping->state = MappingState::zombie;
+	// Split mapping into left and right part
+	smarter::shared_ptr<Mapping> leftMapping = nullptr;
+	smarter::shared_ptr<Mapping> rightMapping = nullptr;
 
-			{
-				auto leftSize = at - mapping->address;
-				leftMapping = smarter::allocate_shared<Mapping>(Allocator{},
-						leftSize, mapping->flags, mapping->slice,
-						mapping->viewOffset);
-				leftMapping->selfPtr = leftMapping;
+	{
+		auto leftSize = at - mapping->address;
+		leftMapping = smarter::allocate_shared<Mapping>(Allocator{},
+				leftSize, mapping->flags, mapping->slice,
+				mapping->viewOffset);
+		leftMapping->selfPtr = leftMapping;
 
-				leftMapping->tie(selfPtr.lock(), mapping->address);
-			}
+		leftMapping->tie(selfPtr.lock(), mapping->address);
+	}
 
-			{
-				auto rightOffset = at - mapping->address;
-				rightMapping = smarter::allocate_shared<Mapping>(Allocator{},
-						mapping->length - rightOffset, mapping->flags, mapping->slice,
-						mapping->viewOffset + rightOffset);
-				rightMapping->selfPtr = rightMapping;
+	{
+		auto rightOffset = at - mapping->address;
+		rightMapping = smarter::allocate_shared<Mapping>(Allocator{},
+				mapping->length - rightOffset, mapping->flags, mapping->slice,
+				mapping->viewOffset + rightOffset);
+		rightMapping->selfPtr = rightMapping;
 
-				rightMapping->tie(selfPtr.lock(), at);
-			}
+		rightMapping->tie(selfPtr.lock(), at);
+	}
 
-			assert(leftMapping && rightMapping);
+	assert(leftMapping && rightMapping);
 
-			// Now remove the mapping and insert the new mappings.
-			{
-				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&_snapshotMutex);
+	// Concurrent page faults check the state while holding the evictionMutex.
+	// Since the old mapping becomes a zombie at the same time as the new mappings
+	// become visible, faults that observe the zombie find the new mappings.
+	co_await mapping->evictionMutex.async_lock();
 
-				_mappings.remove(mapping.get());
+	// Now remove the mapping and insert the new mappings.
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_snapshotMutex);
 
-				_mappings.insert(leftMapping.get());
-				assert(leftMapping->state == MappingState::null);
-				leftMapping->state = MappingState::active;
+		assert(mapping->state == MappingState::active);
+		mapping->state = MappingState::zombie;
 
-				_mappings.insert(rightMapping.get());
-				assert(rightMapping->state == MappingState::null);
-				rightMapping->state = MappingState::active;
-			}
+		_beginMappingUpdate();
+		_mappings.remove(mapping.get());
 
-			// Retire the old mapping and start using the new ones.
-			// We keep one reference until the detach the observer.
-			leftMapping.ctr()->increment();
-			leftMapping->view->addObserver(&leftMapping->observer);
-			if (leftMapping->view->canEvictMemory())
-				async::detach_with_allocator(*kernelAlloc, leftMapping->runEvictionLoop());
+		_mappings.insert(leftMapping.get());
+		assert(leftMapping->state == MappingState::null);
+		leftMapping->state = MappingState::active;
 
-			// We keep one reference until the detach the observer.
-			rightMapping.ctr()->increment();
-			rightMapping->view->addObserver(&rightMapping->observer);
-			if (rightMapping->view->canEvictMemory())
-				async::detach_with_allocator(*kernelAlloc, rightMapping->runEvictionLoop());
+		_mappings.insert(rightMapping.get());
+		assert(rightMapping->state == MappingState::null);
+		rightMapping->state = MappingState::active;
+		_endMappingUpdate();
+	}
 
-			assert(mapping->state == MappingState::zombie);
-			mapping->state = MappingState::retired;
+	mapping->evictionMutex.unlock();
 
-			if (mapping->view->canEvictMemory()) {
-				mapping->cancelEviction.cancel();
-				co_await mapping->evictionDoneEvent.wait();
-			}
-			mapping->view->removeObserver(&mapping->observer);
-			mapping->selfPtr.ctr()->decrement();
+	// Retire the old mapping and start using the new ones.
+	// We keep one reference until the detach the observer.
+	leftMapping.ctr()->increment();
+	leftMapping->view->addObserver(&leftMapping->observer);
+	if (leftMapping->view->canEvictMemory())
+		async::detach_with_allocator(*kernelAlloc, leftMapping->runEvictionLoop());
 
-			// If start pointed to the freshly-removed mapping,
-			// point it to the left side of the split instead
-			if (start == it)
-				start = leftMapping.get();
+	// We keep one reference until the detach the observer.
+	rightMapping.ctr()->increment();
+	rightMapping->view->addObserver(&rightMapping->observer);
+	if (rightMapping->view->canEvictMemory())
+		async::detach_with_allocator(*kernelAlloc, rightMapping->runEvictionLoop());
 
-			it = rightMapping.get();
-		} else {
-			it = MappingTree::successor(it);
-		}
-	}
+	assert(mapping->state == MappingState::zombie);
+	mapping->state = MappingState::retired;
 
-	co_return frg::make_tuple(start, end);
+	if (mapping->view->canEvictMemory()) {
+		mapping->cancelEviction.cancel();
+		co_await mapping->evictionDoneEvent.wait();
+	}
+	mapping->view->removeObserver(&mapping->observer);
+	rcuRetire(&mapping->treeRelease);
 }
 
-coroutine<bool> VirtualSpace::_unmapMappings(VirtualAddr address, size_t length, Mapping *start, Mapping *end) {
-	bool needsShootdown = false;
-
-	for (auto it = start; it != end;) {
-		auto mapping = it->selfPtr.lock();
-		it = MappingTree::successor(it);
+coroutine<void> VirtualSpace::_unmapMappings(VirtualAddr address, size_t length) {
+	// Ranges that need to be returned to the hole tree.
+	frg::vector<frg::tuple<VirtualAddr, size_t>, KernelAlloc> freedRanges{*kernelAlloc};
 
-		if (mapping->address >= address && (mapping->address + mapping->length) <= (address + length)) {
-			needsShootdown = true;
+	// After splitting, all mappings that start within the range are completely inside of it.
+	auto cursor = address;
+	while(true) {
+		smarter::shared_ptr<Mapping> mapping;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_snapshotMutex);
 
-			assert(mapping->state == MappingState::active);
-			mapping->state = MappingState::zombie;
+			if(auto next = _firstMappingIn(cursor, address + length); next)
+				mapping = next->selfPtr.lock();
+		}
+		if(!mapping)
+			break;
+		cursor = mapping->address + mapping->length;
+		assert(cursor <= address + length);
 
-			// Mark pages as dirty and unmap without holding a lock.
-			auto unmapOutcome = _ops->unmapPages(mapping->address, mapping->view.get(),
-						mapping->viewOffset, mapping->length);
-			assert(unmapOutcome);
+		// Concurrent page faults check the state while holding the evictionMutex.
+		// Once we have set the zombie state, faults cannot map pages anymore.
+		co_await mapping->evictionMutex.async_lock();
+		assert(mapping->state == MappingState::active);
+		mapping->state = MappingState::zombie;
+		mapping->evictionMutex.unlock();
 
-			_mappings.remove(mapping.get());
+		// Mark pages as dirty and unmap without holding a lock.
+		auto unmapOutcome = _ops->unmapPages(mapping->address, mapping->view.get(),
+					mapping->viewOffset, mapping->length);
+		assert(unmapOutcome);
 
-			assert(mapping->state == MappingState::zombie);
-			mapping->state = MappingState::retired;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_snapshotMutex);
 
-			if(mapping->view->canEvictMemory()) {
-				mapping->cancelEviction.cancel();
-				co_await mapping->evictionDoneEvent.wait();
-			}
-			mapping->view->removeObserver(&mapping->observer);
-			mapping->selfPtr.ctr()->decrement();
-
-			// Finally, coalesce the hole in the hole tree.
-
-			// Find the holes that preceede/succeede mapping.
-			Hole *pre;
-			Hole *succ;
-
-			auto current = _holes.get_root();
-			while(true) {
-				assert(current);
-				if(mapping->address < current->address()) {
-					if(HoleTree::get_left(current)) {
-						current = HoleTree::get_left(current);
-					}else{
-						pre = HoleTree::predecessor(current);
-						succ = current;
-						break;
-					}
-				}else{
-					assert(mapping->address >= current->address() + current->length());
-					if(HoleTree::get_right(current)) {
-						current = HoleTree::get_right(current);
-					}else{
-						pre = current;
-						succ = HoleTree::successor(current);
-						break;
-					}
-				}
-			}
+			_beginMappingUpdate();
+			_mappings.remove(mapping.get());
+			_endMappingUpdate();
+		}
 
-			// Try to merge the new hole and the existing ones.
-			if(pre && pre->address() + pre->length() == mapping->address
-					&& succ && mapping->address + mapping->length == succ->address()) {
-				auto hole = frg::construct<Hole>(*kernelAlloc, pre->address(),
-						pre->length() + mapping->length + succ->length());
-
-				_holes.remove(pre);
-				_holes.remove(succ);
-				_holes.insert(hole);
-				frg::destruct(*kernelAlloc, pre);
-				frg::destruct(*kernelAlloc, succ);
-			}else if(pre && pre->address() + pre->length() == mapping->address) {
-				auto hole = frg::construct<Hole>(*kernelAlloc,
-						pre->address(), pre->length() + mapping->length);
-
-				_holes.remove(pre);
-				_holes.insert(hole);
-				frg::destruct(*kernelAlloc, pre);
-			}else if(succ && mapping->address + mapping->length == succ->address()) {
-				auto hole = frg::construct<Hole>(*kernelAlloc,
-						mapping->address, mapping->length + succ->length());
-
-				_holes.remove(succ);
-				_holes.insert(hole);
-				frg::destruct(*kernelAlloc, succ);
-			}else{
-				auto hole = frg::construct<Hole>(*kernelAlloc,
-						mapping->address, mapping->length);
+		assert(mapping->state == MappingState::zombie);
+		mapping->state = MappingState::retired;
 
-				_holes.insert(hole);
-			}
+		if(mapping->view->canEvictMemory()) {
+			mapping->cancelEviction.cancel();
+			co_await mapping->evictionDoneEvent.wait();
 		}
+		mapping->view->removeObserver(&mapping->observer);
+		freedRanges.push_back(frg::make_tuple(mapping->address, mapping->length));
+		rcuRetire(&mapping->treeRelease);
 	}
 
-	co_return needsShootdown;
+	if(freedRanges.empty())
+		co_return;
+
+	co_await _ops->shootdown(address, length);
+
+	// Finally, coalesce the holes in the hole tree. This needs to happen after shootdown:
+	// otherwise, concurrent map() calls could reuse addresses that are still in the TLBs.
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_snapshotMutex);
+
+	for(auto [freedAddress, freedLength] : freedRanges)
+		_freeHole(freedAddress, freedLength);
 }
 
 coroutine<size_t> VirtualSpace::readPartialSpace(uintptr_t address,
 		void *buffer, size_t size, smarter::shared_ptr<WorkQueue> wq) {
-	// We do not take _consistencyMutex here since we are only interested in a snapshot.
+	// We do not take _rangeLock here since we are only interested in a snapshot.
 
 	size_t progress = 0;
 	while(progress < size) {
-		smarter::shared_ptr<Mapping> mapping;
-		{
-			auto irqLock = frg::guard(&irqMutex());
-			auto spaceGuard = frg::guard(&_snapshotMutex);
-
-			mapping = _findMapping(address);
-		}
+		auto mapping = _findMapping(address);
 		if(!mapping)
 			co_return progress;
 
@@ -1119,17 +1356,11 @@ coroutine<size_t> VirtualSpace::readPartialSpace(uintptr_t address,
 
 coroutine<size_t> VirtualSpace::writePartialSpace(uintptr_t address,
 		const void *buffer, size_t size, smarter::shared_ptr<WorkQueue> wq) {
-	// We do not take _consistencyMutex here since we are only interested in a snapshot.
+	// We do not take _rangeLock here since we are only interested in a snapshot.
 
 	size_t progress = 0;
 	while(progress < size) {
-		smarter::shared_ptr<Mapping> mapping;
-		{
-			auto irqLock = frg::guard(&irqMutex());
-			auto spaceGuard = frg::guard(&_snapshotMutex);
-
-			mapping = _findMapping(address);
-		}
+		auto mapping = _findMapping(address);
 		if(!mapping)
 			co_return progress;
 
@@ -1191,10 +1422,119 @@ coroutine<size_t> VirtualSpace::writePartialSpace(uintptr_t address,
 	co_return progress;
 }
 
+coroutine<frg::expected<Error>> VirtualSpace::pinRange(uintptr_t address, size_t size,
+		PinnedVirtualRange &pin, smarter::shared_ptr<WorkQueue> wq) {
+	// We do not take _rangeLock here; like for writePartialSpace(), a snapshot is sufficient.
+	// The pin keeps the mappings alive and the MemoryViews locked.
+	pin.address = address;
+	pin.size = size;
+
+	size_t progress = 0;
+	while(progress < size) {
+		auto mapping = _findMapping(address + progress);
+		if(!mapping)
+			co_return Error::fault;
+		if(!(mapping->flags & MappingFlags::protWrite))
+			co_return Error::fault;
+
+		auto startInMapping = address + progress - mapping->address;
+		auto limitInMapping = frg::min(size - progress, mapping->length - startInMapping);
+		// Otherwise, _findMapping() would have returned garbage.
+		assert(limitInMapping);
+
+		FRG_CO_TRY(co_await mapping->lockVirtualRange(startInMapping, limitInMapping, wq));
+		pin._locks.push(PinnedVirtualRange::Lock{mapping, startInMapping, limitInMapping});
+
+		FetchFlags fetchFlags = 0;
+		if(mapping->flags & MappingFlags::dontRequireBacking)
+			fetchFlags |= fetchDisallowBacking;
+
+		// This loop iterates until we hit the end of the mapping.
+		while(progress < size) {
+			auto offsetInMapping = address + progress - mapping->address;
+			if(offsetInMapping == mapping->length)
+				break;
+			assert(offsetInMapping < mapping->length);
+
+			FRG_CO_TRY(co_await mapping->view->fetchRange(
+					(mapping->viewOffset + offsetInMapping) & ~(kPageSize - 1), fetchFlags, wq));
+
+			auto [physical, cacheMode] = mapping->resolveRange(
+					offsetInMapping & ~(kPageSize - 1));
+			// Since we have locked the MemoryView, the physical address remains valid here.
+			assert(physical != PhysicalAddr(-1));
+			pin.pages.push(physical);
+
+			auto misalign = offsetInMapping & (kPageSize - 1);
+			progress += frg::min(size - progress, kPageSize - misalign);
+		}
+	}
+
+	co_return {};
+}
+
+frg::expected<Error, VirtualSpace::MapFlags>
+VirtualSpace::queryProtection(uintptr_t address, size_t size) {
+	// We do not take _rangeLock here since we are only interested in a snapshot.
+	auto mapping = _findMapping(address);
+	if(!mapping)
+		return Error::fault;
+	if(size > mapping->length - (address - mapping->address))
+		return Error::illegalArgs;
+	return protectionOf(mapping.get());
+}
+
+coroutine<frg::expected<Error, smarter::shared_ptr<MemorySlice>>>
+VirtualSpace::lendRange(uintptr_t address, size_t size, MapFlags &protection) {
+	if((address & (kPageSize - 1)) || (size & (kPageSize - 1)))
+		co_return Error::illegalArgs;
+
+	// We do not take _rangeLock here since we are only interested in a snapshot.
+	auto mapping = _findMapping(address);
+	if(!mapping)
+		co_return Error::fault;
+	if(!(mapping->flags & MappingFlags::protRead))
+		co_return Error::fault;
+
+	auto startInMapping = address - mapping->address;
+	if(size > mapping->length - startInMapping)
+		co_return Error::illegalArgs;
+
+	// Forking evicts the lent pages from all existing mappings of the view.
+	// Hence, subsequent writes by the lender trigger copy-on-write faults.
+	auto forkedView = FRG_CO_TRY(co_await mapping->view->forkRange(
+			mapping->viewOffset + startInMapping, size));
+	protection = protectionOf(mapping.get());
+
+	co_return smarter::allocate_shared<MemorySlice>(*kernelAlloc,
+			std::move(forkedView), 0, size);
+}
+
+// --------------------------------------------------------
+// PinnedVirtualRange
+// --------------------------------------------------------
+
+PinnedVirtualRange::~PinnedVirtualRange() {
+	for(auto &lock : _locks) {
+		auto misalign = lock.offset & (kPageSize - 1);
+		lock.mapping->view->markDirty(lock.mapping->viewOffset + lock.offset - misalign,
+				(misalign + lock.size + kPageSize - 1) & ~(kPageSize - 1));
+		lock.mapping->unlockVirtualRange(lock.offset, lock.size);
+	}
+}
+
 // --------------------------------------------------------
 // AddressSpace
 // --------------------------------------------------------
 
+smarter::shared_ptr<AddressSpace, BindableHandle> AddressSpace::create() {
+	auto ptr = smarter::allocate_shared<AddressSpace>(Allocator{});
+	ptr->selfPtr = ptr;
+	ptr->setupInitialHole(0x100000, 0x7ffffff00000);
+	getHugePageCollapser()->registerSpace(ptr.get());
+	return constructHandle(std::move(ptr));
+}
+
 void AddressSpace::activate(smarter::shared_ptr<AddressSpace, BindableHandle> space) {
 	auto pageSpace = &space->pageSpace_;
 	PageSpace::activate(smarter::shared_ptr<PageSpace>{space->selfPtr.lock(), pageSpace});
@@ -0,0 +1,350 @@
+#include <string.h>
+
+#include <frg/manual_box.hpp>
+#include <frg/utility.hpp>
+#include <thor-internal/compressed-pool.hpp>
+#include <thor-internal/cpu-data.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/kernel-locks.hpp>
+#include <thor-internal/physical.hpp>
+
+namespace thor {
+
+namespace {
+	constexpr bool logPool = false;
+
+	// Parameters of the LZ4 block format.
+	constexpr size_t minMatch = 4;
+	// The last match must start at least 12 bytes before the end of the input.
+	constexpr size_t matchFindLimit = 12;
+	// The last 5 bytes are always encoded as literals.
+	constexpr size_t lastLiterals = 5;
+
+	constexpr int hashLog = 10;
+
+	uint32_t read32(const uint8_t *p) {
+		uint32_t v;
+		memcpy(&v, p, sizeof(uint32_t));
+		return v;
+	}
+
+	uint32_t hashSequence(uint32_t seq) {
+		return (seq * 2654435761U) >> (32 - hashLog);
+	}
+
+	// Writes the extension bytes of a literal or match length.
+	bool writeLength(uint8_t *&op, uint8_t *end, size_t length) {
+		while(length >= 255) {
+			if(op == end)
+				return false;
+			*op++ = 255;
+			length -= 255;
+		}
+		if(op == end)
+			return false;
+		*op++ = length;
+		return true;
+	}
+
+	bool readLength(const uint8_t *&ip, const uint8_t *end, size_t &length) {
+		uint8_t b;
+		do {
+			if(ip == end)
+				return false;
+			b = *ip++;
+			length += b;
+		} while(b == 255);
+		return true;
+	}
+
+	bool emitSequence(uint8_t *&op, uint8_t *end,
+			const uint8_t *literals, size_t numLiterals,
+			size_t offset, size_t matchLength) {
+		if(op == end)
+			return false;
+		auto token = op++;
+		*token = frg::min(numLiterals, size_t(15)) << 4;
+		if(numLiterals >= 15 && !writeLength(op, end, numLiterals - 15))
+			return false;
+
+		if(static_cast<size_t>(end - op) < numLiterals)
+			return false;
+		memcpy(op, literals, numLiterals);
+		op += numLiterals;
+
+		// The final sequence only consists of literals.
+		if(!matchLength)
+			return true;
+
+		if(end - op < 2)
+			return false;
+		*op++ = offset & 0xFF;
+		*op++ = offset >> 8;
+
+		auto extra = matchLength - minMatch;
+		*token |= frg::min(extra, size_t(15));
+		if(extra >= 15 && !writeLength(op, end, extra - 15))
+			return false;
+		return true;
+	}
+}
+
+// --------------------------------------------------------
+// LZ4 block compression.
+// --------------------------------------------------------
+
+size_t compressPage(const void *page, void *dest, size_t destSize) {
+	auto src = reinterpret_cast<const uint8_t *>(page);
+	auto op = reinterpret_cast<uint8_t *>(dest);
+	auto end = op + destSize;
+
+	// Positions are page offsets, hence they always fit into 16 bits.
+	uint16_t table[size_t(1) << hashLog];
+	memset(table, 0, sizeof(table));
+
+	size_t ip = 0;
+	size_t anchor = 0;
+	while(ip < kPageSize - matchFindLimit) {
+		auto seq = read32(src + ip);
+		auto h = hashSequence(seq);
+		size_t candidate = table[h];
+		table[h] = ip;
+
+		if(candidate >= ip || read32(src + candidate) != seq) {
+			++ip;
+			continue;
+		}
+
+		size_t length = minMatch;
+		while(ip + length < kPageSize - lastLiterals
+				&& src[candidate + length] == src[ip + length])
+			++length;
+
+		if(!emitSequence(op, end, src + anchor, ip - anchor, ip - candidate, length))
+			return 0;
+		ip += length;
+		anchor = ip;
+	}
+
+	if(!emitSequence(op, end, src + anchor, kPageSize - anchor, 0, 0))
+		return 0;
+	return op - reinterpret_cast<uint8_t *>(dest);
+}
+
+bool decompressPage(const void *source, size_t size, void *page) {
+	auto ip = reinterpret_cast<const uint8_t *>(source);
+	auto end = ip + size;
+	auto dest = reinterpret_cast<uint8_t *>(page);
+	size_t op = 0;
+
+	while(ip != end) {
+		auto token = *ip++;
+
+		size_t numLiterals = token >> 4;
+		if(numLiterals == 15 && !readLength(ip, end, numLiterals))
+			return false;
+		if(static_cast<size_t>(end - ip) < numLiterals || kPageSize - op < numLiterals)
+			return false;
+		memcpy(dest + op, ip, numLiterals);
+		ip += numLiterals;
+		op += numLiterals;
+
+		if(ip == end)
+			break;
+
+		if(end - ip < 2)
+			return false;
+		size_t offset = ip[0] | (size_t(ip[1]) << 8);
+		ip += 2;
+		if(!offset || offset > op)
+			return false;
+
+		size_t length = token & 0xF;
+		if(length == 15 && !readLength(ip, end, length))
+			return false;
+		length += minMatch;
+		if(kPageSize - op < length)
+			return false;
+
+		// Matches may overlap their own output; copy byte by byte.
+		for(size_t i = 0; i < length; ++i)
+			dest[op + i] = dest[op - offset + i];
+		op += length;
+	}
+
+	return op == kPageSize;
+}
+
+// --------------------------------------------------------
+// CompressedPool.
+// --------------------------------------------------------
+
+CompressedPool::CompressedPool() = default;
+
+frg::optional<CompressedPool::Handle> CompressedPool::store(PhysicalAddr physical) {
+	// Compress into the scratch page of the local CPU. If it is already in use
+	// (e.g., since its owner was preempted), fall back to a temporary page.
+	auto cpuData = getCpuData();
+	bool claimed = !cpuData->compressionScratchBusy.exchange(true, std::memory_order_acquire);
+	PhysicalAddr scratch;
+	if(claimed) {
+		if(cpuData->compressionScratch == PhysicalAddr(-1))
+			cpuData->compressionScratch = physicalAllocator->allocate(kPageSize);
+		scratch = cpuData->compressionScratch;
+	}else{
+		scratch = physicalAllocator->allocate(kPageSize);
+	}
+
+	auto releaseScratch = [&] {
+		if(claimed) {
+			cpuData->compressionScratchBusy.store(false, std::memory_order_release);
+		}else if(scratch != PhysicalAddr(-1)) {
+			physicalAllocator->free(scratch, kPageSize);
+		}
+	};
+
+	if(scratch == PhysicalAddr(-1)) {
+		releaseScratch();
+		return frg::null_opt;
+	}
+
+	PageAccessor pageAccessor{physical};
+	PageAccessor scratchAccessor{scratch};
+	auto size = compressPage(pageAccessor.get(), scratchAccessor.get(), maxObjectSize);
+	if(!size) {
+		releaseScratch();
+
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		_rejectedPages++;
+		return frg::null_opt;
+	}
+
+	unsigned int sizeClass = (size - 1) >> classShift;
+	assert(sizeClass < numClasses);
+
+	// Reserve a slot. New pool pages are allocated without holding _mutex.
+	ZsPage *zp = nullptr;
+	ZsPage *spare = nullptr;
+	unsigned int slot;
+	while(true) {
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			if(_partialPages[sizeClass].empty() && spare) {
+				_partialPages[sizeClass].push_back(spare);
+				_poolPages++;
+				spare = nullptr;
+			}
+
+			if(!_partialPages[sizeClass].empty()) {
+				zp = _partialPages[sizeClass].front();
+				assert(zp->numFree);
+				slot = __builtin_ctzll(~zp->usedMap);
+				zp->usedMap |= uint64_t(1) << slot;
+				if(!(--zp->numFree))
+					_partialPages[sizeClass].erase(_partialPages[sizeClass].iterator_to(zp));
+
+				_storedPages++;
+				_storedBytes += size;
+				break;
+			}
+		}
+
+		auto zsPhysical = physicalAllocator->allocate(kPageSize);
+		if(zsPhysical == PhysicalAddr(-1)) {
+			releaseScratch();
+			return frg::null_opt;
+		}
+
+		spare = frg::construct<ZsPage>(*kernelAlloc);
+		spare->physical = zsPhysical;
+		spare->sizeClass = sizeClass;
+		spare->numFree = slotsPerPage_(sizeClass);
+	}
+
+	// Another store() added a page to the size class in the meantime.
+	if(spare) {
+		physicalAllocator->free(spare->physical, kPageSize);
+		frg::destruct(*kernelAlloc, spare);
+	}
+
+	// The slot is ours until the handle is discarded; hence, we can fill it without the lock.
+	PageAccessor zsAccessor{zp->physical};
+	memcpy(reinterpret_cast<uint8_t *>(zsAccessor.get()) + (slot << classShift) * (sizeClass + 1),
+			scratchAccessor.get(), size);
+	releaseScratch();
+
+	return Handle{zp, static_cast<uint16_t>(slot), static_cast<uint16_t>(size)};
+}
+
+void CompressedPool::load(Handle handle, PhysicalAddr physical) {
+	// Note that we do not need to take _mutex: the slot stays allocated
+	// until the owner of the handle calls discard().
+	auto zp = handle.page;
+	assert(zp->usedMap & (uint64_t(1) << handle.slot));
+
+	PageAccessor zsAccessor{zp->physical};
+	PageAccessor pageAccessor{physical};
+	auto object = reinterpret_cast<uint8_t *>(zsAccessor.get())
+			+ (handle.slot << classShift) * (zp->sizeClass + 1);
+	if(!decompressPage(object, handle.size, pageAccessor.get()))
+		panicLogger() << "thor: Compressed page is corrupted" << frg::endlog;
+}
+
+void CompressedPool::discard(Handle handle) {
+	PhysicalAddr freePhysical = PhysicalAddr(-1);
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		auto zp = handle.page;
+		assert(zp->usedMap & (uint64_t(1) << handle.slot));
+		zp->usedMap &= ~(uint64_t(1) << handle.slot);
+		if(!(zp->numFree++))
+			_partialPages[zp->sizeClass].push_back(zp);
+
+		_storedPages--;
+		_storedBytes -= handle.size;
+
+		// Release pages that became empty.
+		if(zp->numFree == slotsPerPage_(zp->sizeClass)) {
+			_partialPages[zp->sizeClass].erase(_partialPages[zp->sizeClass].iterator_to(zp));
+			freePhysical = zp->physical;
+			frg::destruct(*kernelAlloc, zp);
+			_poolPages--;
+		}
+	}
+
+	if(freePhysical != PhysicalAddr(-1))
+		physicalAllocator->free(freePhysical, kPageSize);
+}
+
+CompressedPool::Stats CompressedPool::getStats() {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	if(logPool)
+		infoLogger() << "thor: Compressed pool holds " << _storedPages << " pages in "
+				<< _poolPages << " pool pages" << frg::endlog;
+
+	return Stats{
+		.storedPages = _storedPages,
+		.storedBytes = _storedBytes,
+		.poolPages = _poolPages,
+		.rejectedPages = _rejectedPages
+	};
+}
+
+namespace {
+	frg::eternal<CompressedPool> globalCompressedPool;
+}
+
+CompressedPool *getCompressedPool() {
+	return &globalCompressedPool.get();
+}
+
+} // namespace thor
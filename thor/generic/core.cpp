@@ -244,4 +244,29 @@ ExecutorContext::ExecutorContext() { }
 CpuData::CpuData()
 : scheduler{this}, activeFiber{nullptr}, heartbeat{0} { }
 
+void linkCpuTopology(CpuData *cpuData) {
+	auto link = [cpuData] (std::atomic<CpuData *> CpuData::*next, CpuData *peer) {
+		// Initialize our successor before publishing ourselves to concurrent readers.
+		(cpuData->*next).store((peer->*next).load(std::memory_order_relaxed),
+				std::memory_order_relaxed);
+		(peer->*next).store(cpuData, std::memory_order_release);
+	};
+
+	bool haveSibling = false;
+	bool havePeer = false;
+	for(int i = 0; i < getCpuCount(); i++) {
+		auto other = getCpuData(i);
+		if(other == cpuData)
+			continue;
+		if(!haveSibling && other->coreId == cpuData->coreId) {
+			link(&CpuData::nextSmtSibling, other);
+			haveSibling = true;
+		}
+		if(!havePeer && other->llcId == cpuData->llcId) {
+			link(&CpuData::nextLlcPeer, other);
+			havePeer = true;
+		}
+	}
+}
+
 } // namespace thor
@@ -101,8 +101,27 @@ void KernelFiber::invoke() {
 	restoreExecutor(&_executor);
 }
 
-void KernelFiber::handlePreemption(IrqImageAccessor) {
-	// Do nothing (do not preempt fibers for now).
+void KernelFiber::handlePreemption(IrqImageAccessor image) {
+	assert(!intsAreEnabled());
+
+	// Fibers generally expect to run until they block. Deadline fibers are the exception:
+	// they must be preempted such that their budgets and deadlines can be enforced.
+	if(policy() != SchedulePolicy::deadline)
+		return;
+
+	localScheduler()->update();
+	if(localScheduler()->maybeReschedule()) {
+		saveExecutor(&_executor, image);
+		getCpuData()->executorContext = nullptr;
+		getCpuData()->activeFiber = nullptr;
+
+		runOnStack([] (Continuation cont, IrqImageAccessor image) {
+			scrubStack(image, cont);
+			localScheduler()->commitReschedule();
+		}, getCpuData()->detachedStack.base(), image);
+	}else{
+		localScheduler()->renewSchedule();
+	}
 }
 
 void KernelFiber::AssociatedWorkQueue::wakeup() {
@@ -3,17 +3,21 @@
 
 #include <async/algorithm.hpp>
 #include <async/cancellation.hpp>
+#include <async/oneshot-event.hpp>
 #include <frg/container_of.hpp>
 #include <frg/dyn_array.hpp>
 #include <frg/small_vector.hpp>
 #include <thor-internal/event.hpp>
+#include <thor-internal/huge-pages.hpp>
 #include <thor-internal/coroutine.hpp>
 #include <thor-internal/io.hpp>
 #include <thor-internal/ipc-queue.hpp>
 #include <thor-internal/irq.hpp>
 #include <thor-internal/kernlet.hpp>
 #include <thor-internal/physical.hpp>
+#include <thor-internal/pi-futex.hpp>
 #include <thor-internal/random.hpp>
+#include <thor-internal/rcu.hpp>
 #include <thor-internal/stream.hpp>
 #include <thor-internal/thread.hpp>
 #include <thor-internal/timer.hpp>
@@ -27,6 +31,13 @@
 using namespace thor;
 
 namespace {
+	// Shortest period (in ns) of bandwidth limits that user space can configure.
+	// Shorter periods would cause excessive preemption to enforce the limits.
+	constexpr uint64_t minSchedulingPeriod = 1'000'000;
+	// Shortest runtime (in ns) of deadline reservations. Shorter runtimes would be
+	// dominated by the overhead of scheduling and timer interrupts.
+	constexpr uint64_t minDeadlineRuntime = 10'000;
+
 	// TODO: Replace this by a function that returns the type of special descriptor.
 	bool isSpecialMemoryView(HelHandle handle) {
 		return handle == kHelZeroMemory;
@@ -36,6 +47,22 @@ namespace {
 		assert(handle == kHelZeroMemory);
 		return getZeroMemory();
 	}
+
+	// Checks that the handle refers to a KernelControlDescriptor.
+	HelError checkKernelControl(HelHandle handle) {
+		auto thisThread = getCurrentThread();
+		auto thisUniverse = thisThread->getUniverse();
+
+		auto irqLock = frg::guard(&irqMutex());
+		RcuReadGuard rcuGuard;
+
+		auto wrapper = thisUniverse->getDescriptor(rcuGuard, handle);
+		if(!wrapper)
+			return kHelErrNoDescriptor;
+		if(!wrapper->is<KernelControlDescriptor>())
+			return kHelErrBadDescriptor;
+		return kHelErrNone;
+	}
 }
 
 extern "C" int doCopyFromUser(void *dest, const void *src, size_t size);
@@ -96,6 +123,9 @@ size_t ipcSourceSize(size_t size) {
 	return (size + 7) & ~size_t(7);
 }
 
+// Receive size of kHelActionRecvInline if the action does not specify one.
+constexpr size_t defaultInlineLength = 128;
+
 // TODO: one translate function per error source?
 HelError translateError(Error error) {
 	switch(error) {
@@ -108,6 +138,7 @@ HelError translateError(Error error) {
 	case Error::bufferTooSmall: return kHelErrBufferTooSmall;
 	case Error::fault: return kHelErrFault;
 	case Error::remoteFault: return kHelErrRemoteFault;
+	case Error::illegalArgs: return kHelErrIllegalArgs;
 	default:
 		assert(!"Unexpected error");
 		__builtin_unreachable();
@@ -145,9 +176,9 @@ HelError helSubmitAsyncNop(HelHandle queueHandle, uintptr_t context) {
 	smarter::shared_ptr<IpcQueue> queue;
 	{
 		auto irqLock = frg::guard(&irqMutex());
-		Universe::Guard universeGuard(thisUniverse->lock);
+		RcuReadGuard rcuGuard;
 
-		auto queueWrapper = thisUniverse->getDescriptor(universeGuard, queueHandle);
+		auto queueWrapper = thisUniverse->getDescriptor(rcuGuard, queueHandle);
 		if(!queueWrapper)
 			return kHelErrNoDescriptor;
 		if(!queueWrapper->is<QueueDescriptor>())
@@ -165,6 +196,84 @@ HelError helSubmitAsyncNop(HelHandle queueHandle, uintptr_t context) {
 	return kHelErrNone;
 }
 
+namespace {
+	HelError dispatchSubmission(const HelSubmission &entry, uint64_t &result) {
+		switch(entry.opcode) {
+		case kHelSubmitOpAsyncNop:
+			return helSubmitAsyncNop(entry.queue, entry.context);
+		case kHelSubmitOpAwaitClock:
+			return helSubmitAwaitClock(entry.args[0], entry.queue, entry.context, &result);
+		case kHelSubmitOpAwaitEvent:
+			return helSubmitAwaitEvent(entry.handle, entry.args[0],
+					entry.queue, entry.context);
+		case kHelSubmitOpAsync:
+			return helSubmitAsync(entry.handle,
+					reinterpret_cast<const HelAction *>(entry.args[0]), entry.args[1],
+					entry.queue, entry.context, entry.flags);
+		case kHelSubmitOpReadMemory:
+			return helSubmitReadMemory(entry.handle, entry.args[0], entry.args[1],
+					reinterpret_cast<void *>(entry.args[2]), entry.queue, entry.context);
+		case kHelSubmitOpWriteMemory:
+			return helSubmitWriteMemory(entry.handle, entry.args[0], entry.args[1],
+					reinterpret_cast<const void *>(entry.args[2]), entry.queue, entry.context);
+		default:
+			return kHelErrIllegalArgs;
+		}
+	}
+}
+
+HelError helEnterSubmission(HelSubmissionRing *ringPtr, unsigned int ringShift,
+		unsigned int *numConsumed) {
+	// Bound the amount of work that we do in a single syscall.
+	if(ringShift > 12)
+		return kHelErrIllegalArgs;
+	unsigned int ringSize = 1u << ringShift;
+
+	// User space produces entries at the tail, the kernel consumes them at the head.
+	// Both indices are free-running; the syscall entry orders the reads below
+	// against user space's writes.
+	unsigned int head, tail;
+	if(!readUserObject(&ringPtr->head, head))
+		return kHelErrFault;
+	if(!readUserObject(&ringPtr->tail, tail))
+		return kHelErrFault;
+	if(tail - head > ringSize)
+		return kHelErrIllegalArgs;
+
+	unsigned int n = 0;
+	HelError error = kHelErrNone;
+	while(head != tail) {
+		auto entryPtr = &ringPtr->entries[head & (ringSize - 1)];
+		HelSubmission entry;
+		if(!readUserObject(entryPtr, entry)) {
+			error = kHelErrFault;
+			break;
+		}
+
+		// Consume the entry before dispatching it. Otherwise, if writing back the result
+		// faults, user space would resubmit the entry and the operation would run twice.
+		if(!writeUserObject(&ringPtr->head, head + 1)) {
+			error = kHelErrFault;
+			break;
+		}
+		++head;
+		++n;
+
+		// Per-entry results are reported in the ring. If they cannot be written back,
+		// the call fails; the last consumed entry then has no result.
+		uint64_t result = 0;
+		auto entryError = dispatchSubmission(entry, result);
+		if(!writeUserObject(&entryPtr->error, entryError)
+				|| !writeUserObject(&entryPtr->result, result)) {
+			error = kHelErrFault;
+			break;
+		}
+	}
+
+	*numConsumed = n;
+	return error;
+}
+
 HelError helCreateUniverse(HelHandle *handle) {
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
@@ -191,9 +300,9 @@ HelError helTransferDescriptor(HelHandle handle, HelHandle universe_handle,
 	smarter::shared_ptr<Universe> universe;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard lock(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto descriptor_it = this_universe->getDescriptor(lock, handle);
+		auto descriptor_it = this_universe->getDescriptor(rcuGuard, handle);
 		if(!descriptor_it)
 			return kHelErrNoDescriptor;
 		descriptor = *descriptor_it;
@@ -201,7 +310,7 @@ HelError helTransferDescriptor(HelHandle handle, HelHandle universe_handle,
 		if(universe_handle == kHelThisUniverse) {
 			universe = this_universe.lock();
 		}else{
-			auto universe_it = this_universe->getDescriptor(lock, universe_handle);
+			auto universe_it = this_universe->getDescriptor(rcuGuard, universe_handle);
 			if(!universe_it)
 				return kHelErrNoDescriptor;
 			if(!universe_it->is<UniverseDescriptor>())
@@ -226,9 +335,9 @@ HelError helDescriptorInfo(HelHandle handle, HelDescriptorInfo *) {
 	auto this_universe = this_thread->getUniverse();
 
 	auto irq_lock = frg::guard(&irqMutex());
-	Universe::Guard universe_guard(this_universe->lock);
+	RcuReadGuard rcuGuard;
 
-	auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+	auto wrapper = this_universe->getDescriptor(rcuGuard, handle);
 	if(!wrapper)
 		return kHelErrNoDescriptor;
 	switch(wrapper->tag()) {
@@ -247,12 +356,12 @@ HelError helGetCredentials(HelHandle handle, uint32_t flags, char *credentials)
 	smarter::shared_ptr<Thread> thread;
 	{
 		auto irqLock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(thisUniverse->lock);
+		RcuReadGuard rcuGuard;
 
 		if(handle == kHelThisThread) {
 			thread = thisThread.lock();
 		}else{
-			auto threadWrapper = thisUniverse->getDescriptor(universe_guard, handle);
+			auto threadWrapper = thisUniverse->getDescriptor(rcuGuard, handle);
 			if(!threadWrapper)
 				return kHelErrNoDescriptor;
 			if(!threadWrapper->is<ThreadDescriptor>())
@@ -276,9 +385,9 @@ HelError helCloseDescriptor(HelHandle universeHandle, HelHandle handle) {
 		universe = thisUniverse.lock();
 	}else{
 		auto irqLock = frg::guard(&irqMutex());
-		Universe::Guard universeLock(thisUniverse->lock);
+		RcuReadGuard rcuGuard;
 
-		auto universeIt = thisUniverse->getDescriptor(universeLock, universeHandle);
+		auto universeIt = thisUniverse->getDescriptor(rcuGuard, universeHandle);
 		if(!universeIt)
 			return kHelErrNoDescriptor;
 		if(!universeIt->is<UniverseDescriptor>())
@@ -309,11 +418,12 @@ HelError helCreateQueue(HelQueueParameters *paramsPtr, HelHandle *handle) {
 	if(!readUserObject(paramsPtr, params))
 		return kHelErrFault;
 
-	if(params.flags)
+	if(params.flags & ~kHelQueueAdaptiveSpin)
 		return kHelErrIllegalArgs;
 
 	auto queue = smarter::allocate_shared<IpcQueue>(*kernelAlloc,
-			params.ringShift, params.numChunks, params.chunkSize);
+			params.ringShift, params.numChunks, params.chunkSize,
+			params.flags & kHelQueueAdaptiveSpin);
 	queue->setupSelfPtr(queue);
 	{
 		auto irq_lock = frg::guard(&irqMutex());
@@ -333,9 +443,9 @@ HelError helCancelAsync(HelHandle handle, uint64_t async_id) {
 	smarter::shared_ptr<IpcQueue> queue;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto queue_wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -348,6 +458,40 @@ HelError helCancelAsync(HelHandle handle, uint64_t async_id) {
 	return kHelErrNone;
 }
 
+HelError helQueryQueueStats(HelHandle handle, HelQueueStats *user_stats) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	smarter::shared_ptr<IpcQueue> queue;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		RcuReadGuard rcuGuard;
+
+		auto queue_wrapper = this_universe->getDescriptor(rcuGuard, handle);
+		if(!queue_wrapper)
+			return kHelErrNoDescriptor;
+		if(!queue_wrapper->is<QueueDescriptor>())
+			return kHelErrBadDescriptor;
+		queue = queue_wrapper->get<QueueDescriptor>().queue;
+	}
+
+	auto queueStats = queue->getStats();
+
+	HelQueueStats stats;
+	memset(&stats, 0, sizeof(HelQueueStats));
+	stats.numElements = queueStats.numElements;
+	stats.numBatches = queueStats.numBatches;
+	stats.numChunks = queueStats.numChunks;
+	stats.numWakes = queueStats.numWakes;
+	stats.numSpinHints = queueStats.numSpinHints;
+	stats.spinHint = queueStats.spinHint;
+
+	if(!writeUserObject(user_stats, stats))
+		return kHelErrFault;
+
+	return kHelErrNone;
+}
+
 HelError helAllocateMemory(size_t size, uint32_t flags,
 		HelAllocRestrictions *restrictions, HelHandle *handle) {
 	if(!size)
@@ -374,7 +518,11 @@ HelError helAllocateMemory(size_t size, uint32_t flags,
 		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits,
 				size, kPageSize);
 	}else if(flags & kHelAllocOnDemand) {
-		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits);
+		// Swappable memory is compressed under memory pressure. This is opt-in since
+		// drivers may use on-demand memory for DMA (see helPointerPhysical()).
+		bool swappable = (flags & kHelAllocSwappable) && !restrictions;
+		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits,
+				kPageSize, kPageSize, swappable);
 	}else{
 		// TODO: 
 		memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits);
@@ -399,9 +547,9 @@ HelError helResizeMemory(HelHandle handle, size_t newSize) {
 	smarter::shared_ptr<MemoryView> memory;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(!wrapper->is<MemoryViewDescriptor>())
@@ -462,10 +610,10 @@ HelError helCopyOnWrite(HelHandle memoryHandle,
 
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
 		if(memoryHandle >= 0) {
-			auto wrapper = this_universe->getDescriptor(universe_guard, memoryHandle);
+			auto wrapper = this_universe->getDescriptor(rcuGuard, memoryHandle);
 			if(!wrapper)
 				return kHelErrNoDescriptor;
 			if(!wrapper->is<MemoryViewDescriptor>())
@@ -533,16 +681,16 @@ HelError helAlterMemoryIndirection(HelHandle indirectHandle, size_t slot,
 	smarter::shared_ptr<MemoryView> memoryView;
 	{
 		auto irqLock = frg::guard(&irqMutex());
-		Universe::Guard universeLock(thisUniverse->lock);
+		RcuReadGuard rcuGuard;
 
-		auto indirectWrapper = thisUniverse->getDescriptor(universeLock, indirectHandle);
+		auto indirectWrapper = thisUniverse->getDescriptor(rcuGuard, indirectHandle);
 		if(!indirectWrapper)
 			return kHelErrNoDescriptor;
 		if(!indirectWrapper->is<MemoryViewDescriptor>())
 			return kHelErrBadDescriptor;
 		indirectView = indirectWrapper->get<MemoryViewDescriptor>().memory;
 
-		auto memoryWrapper = thisUniverse->getDescriptor(universeLock, memoryHandle);
+		auto memoryWrapper = thisUniverse->getDescriptor(rcuGuard, memoryHandle);
 		if(!memoryWrapper)
 			return kHelErrNoDescriptor;
 		if(!memoryWrapper->is<MemoryViewDescriptor>())
@@ -574,9 +722,9 @@ HelError helCreateSliceView(HelHandle memoryHandle,
 	smarter::shared_ptr<MemoryView> view;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto wrapper = this_universe->getDescriptor(universe_guard, memoryHandle);
+		auto wrapper = this_universe->getDescriptor(rcuGuard, memoryHandle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(!wrapper->is<MemoryViewDescriptor>())
@@ -604,9 +752,9 @@ HelError helForkMemory(HelHandle handle, HelHandle *forkedHandle) {
 	smarter::shared_ptr<MemoryView> view;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto viewWrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto viewWrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!viewWrapper)
 			return kHelErrNoDescriptor;
 		if(!viewWrapper->is<MemoryViewDescriptor>())
@@ -768,9 +916,9 @@ HelError helMapMemory(HelHandle memory_handle, HelHandle space_handle,
 	bool isVspace = false;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto memory_wrapper = this_universe->getDescriptor(universe_guard, memory_handle);
+		auto memory_wrapper = this_universe->getDescriptor(rcuGuard, memory_handle);
 		if(!memory_wrapper)
 			return kHelErrNoDescriptor;
 		if(memory_wrapper->is<MemorySliceDescriptor>()) {
@@ -792,7 +940,7 @@ HelError helMapMemory(HelHandle memory_handle, HelHandle space_handle,
 		if(space_handle == kHelNullHandle) {
 			space = this_thread->getAddressSpace().lock();
 		}else{
-			auto space_wrapper = this_universe->getDescriptor(universe_guard, space_handle);
+			auto space_wrapper = this_universe->getDescriptor(rcuGuard, space_handle);
 			if(!space_wrapper)
 				return kHelErrNoDescriptor;
 			if(space_wrapper->is<AddressSpaceDescriptor>()) {
@@ -818,6 +966,10 @@ HelError helMapMemory(HelHandle memory_handle, HelHandle space_handle,
 	}
 
 	if(!mapResult) {
+		if(mapResult.error() == Error::noMemory)
+			return kHelErrNoMemory;
+		if(mapResult.error() == Error::illegalArgs)
+			return kHelErrIllegalArgs;
 		assert(mapResult.error() == Error::bufferTooSmall);
 		return kHelErrBufferTooSmall;
 	}
@@ -844,12 +996,12 @@ HelError helSubmitProtectMemory(HelHandle space_handle,
 	smarter::shared_ptr<IpcQueue> queue;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
 		if(space_handle == kHelNullHandle) {
 			space = this_thread->getAddressSpace().lock();
 		}else{
-			auto space_wrapper = this_universe->getDescriptor(universe_guard, space_handle);
+			auto space_wrapper = this_universe->getDescriptor(rcuGuard, space_handle);
 			if(!space_wrapper)
 				return kHelErrNoDescriptor;
 			if(!space_wrapper->is<AddressSpaceDescriptor>())
@@ -857,7 +1009,7 @@ HelError helSubmitProtectMemory(HelHandle space_handle,
 			space = space_wrapper->get<AddressSpaceDescriptor>().space;
 		}
 
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(rcuGuard, queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -893,12 +1045,12 @@ HelError helUnmapMemory(HelHandle space_handle, void *pointer, size_t length) {
 	smarter::shared_ptr<AddressSpace, BindableHandle> space;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
 		if(space_handle == kHelNullHandle) {
 			space = this_thread->getAddressSpace().lock();
 		}else{
-			auto space_wrapper = this_universe->getDescriptor(universe_guard, space_handle);
+			auto space_wrapper = this_universe->getDescriptor(rcuGuard, space_handle);
 			if(!space_wrapper)
 				return kHelErrNoDescriptor;
 			if(!space_wrapper->is<AddressSpaceDescriptor>())
@@ -925,12 +1077,12 @@ HelError helSubmitSynchronizeSpace(HelHandle spaceHandle, void *pointer, size_t
 	smarter::shared_ptr<IpcQueue> queue;
 	{
 		auto irqLock = frg::guard(&irqMutex());
-		Universe::Guard universeGuard(thisUniverse->lock);
+		RcuReadGuard rcuGuard;
 
 		if(spaceHandle == kHelNullHandle) {
 			space = thisThread->getAddressSpace().lock();
 		}else{
-			auto spaceWrapper = thisUniverse->getDescriptor(universeGuard, spaceHandle);
+			auto spaceWrapper = thisUniverse->getDescriptor(rcuGuard, spaceHandle);
 			if(!spaceWrapper)
 				return kHelErrNoDescriptor;
 			if(!spaceWrapper->is<AddressSpaceDescriptor>())
@@ -938,7 +1090,7 @@ HelError helSubmitSynchronizeSpace(HelHandle spaceHandle, void *pointer, size_t
 			space = spaceWrapper->get<AddressSpaceDescriptor>().space;
 		}
 
-		auto queueWrapper = thisUniverse->getDescriptor(universeGuard, queueHandle);
+		auto queueWrapper = thisUniverse->getDescriptor(rcuGuard, queueHandle);
 		if(!queueWrapper)
 			return kHelErrNoDescriptor;
 		if(!queueWrapper->is<QueueDescriptor>())
@@ -962,6 +1114,34 @@ HelError helSubmitSynchronizeSpace(HelHandle spaceHandle, void *pointer, size_t
 	return kHelErrNone;
 }
 
+HelError helSetHugePageScanRate(HelHandle controlHandle, size_t rangesPerScan,
+		uint64_t scanInterval) {
+	if(auto error = checkKernelControl(controlHandle); error != kHelErrNone)
+		return error;
+	if(!rangesPerScan || !scanInterval)
+		return kHelErrIllegalArgs;
+
+	getHugePageCollapser()->setScanRate(rangesPerScan, scanInterval);
+
+	return kHelErrNone;
+}
+
+HelError helQueryHugePageStats(HelHugePageStats *userStats) {
+	auto collapserStats = getHugePageCollapser()->getStats();
+
+	HelHugePageStats stats;
+	memset(&stats, 0, sizeof(HelHugePageStats));
+	stats.scannedRanges = collapserStats.scannedRanges;
+	stats.promotions = collapserStats.promotions;
+	stats.failures = collapserStats.failures;
+	stats.skippedRanges = collapserStats.skippedRanges;
+
+	if(!writeUserObject(userStats, stats))
+		return kHelErrFault;
+
+	return kHelErrNone;
+}
+
 HelError helPointerPhysical(const void *pointer, uintptr_t *physical) {
 	auto thisThread = getCurrentThread();
 	auto space = thisThread->getAddressSpace().lock();
@@ -991,14 +1171,14 @@ HelError helSubmitReadMemory(HelHandle handle, uintptr_t address,
 	smarter::shared_ptr<IpcQueue> queue;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universeGuard(thisUniverse->lock);
+		RcuReadGuard rcuGuard;
 
-		auto wrapper = thisUniverse->getDescriptor(universeGuard, handle);
+		auto wrapper = thisUniverse->getDescriptor(rcuGuard, handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		descriptor = *wrapper;
 
-		auto queueWrapper = thisUniverse->getDescriptor(universeGuard, queueHandle);
+		auto queueWrapper = thisUniverse->getDescriptor(rcuGuard, queueHandle);
 		if(!queueWrapper)
 			return kHelErrNoDescriptor;
 		if(!queueWrapper->is<QueueDescriptor>())
@@ -1148,14 +1328,14 @@ HelError helSubmitWriteMemory(HelHandle handle, uintptr_t address,
 	smarter::shared_ptr<IpcQueue> queue;
 	{
 		auto irqLock = frg::guard(&irqMutex());
-		Universe::Guard universeGuard(thisUniverse->lock);
+		RcuReadGuard rcuGuard;
 
-		auto wrapper = thisUniverse->getDescriptor(universeGuard, handle);
+		auto wrapper = thisUniverse->getDescriptor(rcuGuard, handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		descriptor = *wrapper;
 
-		auto queueWrapper = thisUniverse->getDescriptor(universeGuard, queueHandle);
+		auto queueWrapper = thisUniverse->getDescriptor(rcuGuard, queueHandle);
 		if(!queueWrapper)
 			return kHelErrNoDescriptor;
 		if(!queueWrapper->is<QueueDescriptor>())
@@ -1303,9 +1483,9 @@ HelError helMemoryInfo(HelHandle handle, size_t *size) {
 	smarter::shared_ptr<MemoryView> memory;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(!wrapper->is<MemoryViewDescriptor>())
@@ -1325,16 +1505,16 @@ HelError helSubmitManageMemory(HelHandle handle, HelHandle queue_handle, uintptr
 	smarter::shared_ptr<IpcQueue> queue;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto memory_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto memory_wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!memory_wrapper)
 			return kHelErrNoDescriptor;
 		if(!memory_wrapper->is<MemoryViewDescriptor>())
 			return kHelErrBadDescriptor;
 		memory = memory_wrapper->get<MemoryViewDescriptor>().memory;
 
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(rcuGuard, queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -1379,9 +1559,9 @@ HelError helUpdateMemory(HelHandle handle, int type,
 	smarter::shared_ptr<MemoryView> memory;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto memory_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto memory_wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!memory_wrapper)
 			return kHelErrNoDescriptor;
 		if(!memory_wrapper->is<MemoryViewDescriptor>())
@@ -1417,16 +1597,16 @@ HelError helSubmitLockMemoryView(HelHandle handle, uintptr_t offset, size_t size
 	smarter::shared_ptr<IpcQueue> queue;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto memory_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto memory_wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!memory_wrapper)
 			return kHelErrNoDescriptor;
 		if(!memory_wrapper->is<MemoryViewDescriptor>())
 			return kHelErrBadDescriptor;
 		memory = memory_wrapper->get<MemoryViewDescriptor>().memory;
 
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(rcuGuard, queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -1493,9 +1673,9 @@ HelError helLoadahead(HelHandle handle, uintptr_t offset, size_t length) {
 	smarter::shared_ptr<MemoryView> memory;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto memory_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto memory_wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!memory_wrapper)
 			return kHelErrNoDescriptor;
 		if(!memory_wrapper->is<MemoryViewDescriptor>())
@@ -1528,12 +1708,12 @@ HelError helCreateThread(HelHandle universe_handle, HelHandle space_handle,
 	smarter::shared_ptr<AddressSpace, BindableHandle> space;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
 		if(universe_handle == kHelNullHandle) {
 			universe = this_thread->getUniverse().lock();
 		}else{
-			auto universe_wrapper = this_universe->getDescriptor(universe_guard, universe_handle);
+			auto universe_wrapper = this_universe->getDescriptor(rcuGuard, universe_handle);
 			if(!universe_wrapper)
 				return kHelErrNoDescriptor;
 			if(!universe_wrapper->is<UniverseDescriptor>())
@@ -1544,7 +1724,7 @@ HelError helCreateThread(HelHandle universe_handle, HelHandle space_handle,
 		if(space_handle == kHelNullHandle) {
 			space = this_thread->getAddressSpace().lock();
 		}else{
-			auto space_wrapper = this_universe->getDescriptor(universe_guard, space_handle);
+			auto space_wrapper = this_universe->getDescriptor(rcuGuard, space_handle);
 			if(!space_wrapper)
 				return kHelErrNoDescriptor;
 			if(!space_wrapper->is<AddressSpaceDescriptor>())
@@ -1560,6 +1740,9 @@ HelError helCreateThread(HelHandle universe_handle, HelHandle space_handle,
 	auto new_thread = Thread::create(std::move(universe), std::move(space), params);
 	new_thread->self = remove_tag_cast(new_thread);
 
+	// New threads stay in the creator's group, otherwise they would escape its quota.
+	Scheduler::setGroup(new_thread.get(), Scheduler::getGroup(this_thread.get()));
+
 	// Adding a large prime (coprime to getCpuCount()) should yield a good distribution.
 	auto cpu = globalNextCpu.fetch_add(4099, std::memory_order_relaxed) % getCpuCount();
 //	infoLogger() << "thor: New thread on CPU #" << cpu << frg::endlog;
@@ -1588,9 +1771,9 @@ HelError helQueryThreadStats(HelHandle handle, HelThreadStats *user_stats) {
 		thread = this_thread.lock();
 	}else{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1601,6 +1784,29 @@ HelError helQueryThreadStats(HelHandle handle, HelThreadStats *user_stats) {
 	HelThreadStats stats;
 	memset(&stats, 0, sizeof(HelThreadStats));
 	stats.userTime = thread->runTime();
+	stats.numMigrations = thread->numMigrations();
+	stats.deadlineMisses = thread->numDeadlineMisses();
+	stats.budgetOverruns = thread->numBudgetOverruns();
+
+	if(!writeUserObject(user_stats, stats))
+		return kHelErrFault;
+
+	return kHelErrNone;
+}
+
+HelError helQueryCpuStats(int cpu, HelCpuStats *user_stats) {
+	if(cpu < 0 || cpu >= getCpuCount())
+		return kHelErrIllegalArgs;
+
+	auto schedulerStats = getCpuData(cpu)->scheduler.getStats();
+
+	HelCpuStats stats;
+	memset(&stats, 0, sizeof(HelCpuStats));
+	stats.sentPings = schedulerStats.sentPings;
+	stats.avoidedPings = schedulerStats.avoidedPings;
+	stats.rtThrottles = schedulerStats.rtThrottles;
+	stats.dlBandwidth = schedulerStats.dlBandwidth;
+	stats.affineWakeups = schedulerStats.affineWakeups;
 
 	if(!writeUserObject(user_stats, stats))
 		return kHelErrFault;
@@ -1617,9 +1823,9 @@ HelError helSetPriority(HelHandle handle, int priority) {
 		thread = this_thread.lock();
 	}else{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1632,6 +1838,206 @@ HelError helSetPriority(HelHandle handle, int priority) {
 	return kHelErrNone;
 }
 
+HelError helSetSchedulingPolicy(HelHandle controlHandle, HelHandle handle,
+		int policy, int priority) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	SchedulePolicy schedulePolicy;
+	switch(policy) {
+	case kHelSchedulingFair: schedulePolicy = SchedulePolicy::fair; break;
+	case kHelSchedulingFifo: schedulePolicy = SchedulePolicy::fifo; break;
+	case kHelSchedulingRoundRobin: schedulePolicy = SchedulePolicy::roundRobin; break;
+	default:
+		return kHelErrIllegalArgs;
+	}
+	if(priority < 0 || priority >= ScheduleEntity::numRtPriorities)
+		return kHelErrIllegalArgs;
+
+	// Real-time entities can starve fair entities (up to the bandwidth limit).
+	// Hence, only privileged servers can enter the real-time classes.
+	if(schedulePolicy != SchedulePolicy::fair) {
+		if(auto error = checkKernelControl(controlHandle); error != kHelErrNone)
+			return error;
+	}
+
+	smarter::shared_ptr<Thread> thread;
+	if(handle == kHelThisThread) {
+		thread = this_thread.lock();
+	}else{
+		auto irq_lock = frg::guard(&irqMutex());
+		RcuReadGuard rcuGuard;
+
+		auto thread_wrapper = this_universe->getDescriptor(rcuGuard, handle);
+		if(!thread_wrapper)
+			return kHelErrNoDescriptor;
+		if(!thread_wrapper->is<ThreadDescriptor>())
+			return kHelErrBadDescriptor;
+		thread = remove_tag_cast(thread_wrapper->get<ThreadDescriptor>().thread);
+	}
+
+	Scheduler::setPolicy(thread.get(), schedulePolicy, priority);
+
+	return kHelErrNone;
+}
+
+HelError helSetDeadline(HelHandle controlHandle, HelHandle handle,
+		uint64_t runtime, uint64_t deadline, uint64_t period) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	if(runtime < minDeadlineRuntime || runtime > deadline || deadline > period
+			|| period < minSchedulingPeriod)
+		return kHelErrIllegalArgs;
+
+	// Deadline entities preempt both real-time and fair entities and they are not
+	// subject to schedule group quotas. Hence, they are privileged like real-time entities.
+	if(auto error = checkKernelControl(controlHandle); error != kHelErrNone)
+		return error;
+
+	smarter::shared_ptr<Thread> thread;
+	if(handle == kHelThisThread) {
+		thread = this_thread.lock();
+	}else{
+		auto irq_lock = frg::guard(&irqMutex());
+		RcuReadGuard rcuGuard;
+
+		auto thread_wrapper = this_universe->getDescriptor(rcuGuard, handle);
+		if(!thread_wrapper)
+			return kHelErrNoDescriptor;
+		if(!thread_wrapper->is<ThreadDescriptor>())
+			return kHelErrBadDescriptor;
+		thread = remove_tag_cast(thread_wrapper->get<ThreadDescriptor>().thread);
+	}
+
+	// Fails if the period is too long or if the reservation does not fit onto the CPU.
+	if(!Scheduler::setDeadline(thread.get(), {
+		.runtime = runtime,
+		.deadline = deadline,
+		.period = period
+	}))
+		return kHelErrIllegalState;
+
+	return kHelErrNone;
+}
+
+HelError helSetRealTimeConfig(HelHandle controlHandle,
+		uint64_t rrQuantum, uint64_t runtime, uint64_t period) {
+	if(auto error = checkKernelControl(controlHandle); error != kHelErrNone)
+		return error;
+	// The bandwidth limit cannot be disabled: real-time entities always leave
+	// some time to fair entities.
+	if(!rrQuantum || !runtime || period < minSchedulingPeriod || runtime >= period)
+		return kHelErrIllegalArgs;
+
+	Scheduler::setRealTimeConfig({
+		.rrQuantum = rrQuantum,
+		.rtRuntime = runtime,
+		.rtPeriod = period
+	});
+
+	return kHelErrNone;
+}
+
+HelError helCreateScheduleGroup(HelHandle controlHandle, uint64_t weight, uint64_t quota,
+		uint64_t period, HelHandle *handle) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	// Groups isolate servers from each other. Hence, only privileged servers
+	// can create groups (and pick their weights) or change group membership.
+	if(auto error = checkKernelControl(controlHandle); error != kHelErrNone)
+		return error;
+	if(!weight || weight > ScheduleGroup::maxWeight)
+		return kHelErrIllegalArgs;
+	if(quota && (period < minSchedulingPeriod || quota > period))
+		return kHelErrIllegalArgs;
+
+	auto group = smarter::allocate_shared<ScheduleGroup>(*kernelAlloc,
+			weight, quota, quota ? period : 0);
+
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		Universe::Guard universe_guard(this_universe->lock);
+
+		*handle = this_universe->attachDescriptor(universe_guard,
+				ScheduleGroupDescriptor(std::move(group)));
+	}
+
+	return kHelErrNone;
+}
+
+HelError helSetScheduleGroup(HelHandle controlHandle, HelHandle handle,
+		HelHandle groupHandle) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	if(auto error = checkKernelControl(controlHandle); error != kHelErrNone)
+		return error;
+
+	smarter::shared_ptr<Thread> thread;
+	smarter::shared_ptr<ScheduleGroup> group;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		RcuReadGuard rcuGuard;
+
+		if(handle == kHelThisThread) {
+			thread = this_thread.lock();
+		}else{
+			auto thread_wrapper = this_universe->getDescriptor(rcuGuard, handle);
+			if(!thread_wrapper)
+				return kHelErrNoDescriptor;
+			if(!thread_wrapper->is<ThreadDescriptor>())
+				return kHelErrBadDescriptor;
+			thread = remove_tag_cast(thread_wrapper->get<ThreadDescriptor>().thread);
+		}
+
+		// A null handle removes the thread from its group.
+		if(groupHandle != kHelNullHandle) {
+			auto group_wrapper = this_universe->getDescriptor(rcuGuard, groupHandle);
+			if(!group_wrapper)
+				return kHelErrNoDescriptor;
+			if(!group_wrapper->is<ScheduleGroupDescriptor>())
+				return kHelErrBadDescriptor;
+			group = group_wrapper->get<ScheduleGroupDescriptor>().group;
+		}
+	}
+
+	Scheduler::setGroup(thread.get(), std::move(group));
+
+	return kHelErrNone;
+}
+
+HelError helQueryScheduleGroupStats(HelHandle handle, HelScheduleGroupStats *user_stats) {
+	auto this_thread = getCurrentThread();
+	auto this_universe = this_thread->getUniverse();
+
+	smarter::shared_ptr<ScheduleGroup> group;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		RcuReadGuard rcuGuard;
+
+		auto group_wrapper = this_universe->getDescriptor(rcuGuard, handle);
+		if(!group_wrapper)
+			return kHelErrNoDescriptor;
+		if(!group_wrapper->is<ScheduleGroupDescriptor>())
+			return kHelErrBadDescriptor;
+		group = group_wrapper->get<ScheduleGroupDescriptor>().group;
+	}
+
+	auto groupStats = group->getStats();
+
+	HelScheduleGroupStats stats;
+	memset(&stats, 0, sizeof(HelScheduleGroupStats));
+	stats.usage = groupStats.usage;
+	stats.throttles = groupStats.throttles;
+
+	if(!writeUserObject(user_stats, stats))
+		return kHelErrFault;
+
+	return kHelErrNone;
+}
+
 HelError helYield() {
 	Thread::deferCurrent();
 
@@ -1647,16 +2053,16 @@ HelError helSubmitObserve(HelHandle handle, uint64_t inSeq,
 	smarter::shared_ptr<IpcQueue> queue;
 	{
 		auto irqLock = frg::guard(&irqMutex());
-		Universe::Guard universeGuard(thisUniverse->lock);
+		RcuReadGuard rcuGuard;
 
-		auto threadWrapper = thisUniverse->getDescriptor(universeGuard, handle);
+		auto threadWrapper = thisUniverse->getDescriptor(rcuGuard, handle);
 		if(!threadWrapper)
 			return kHelErrNoDescriptor;
 		if(!threadWrapper->is<ThreadDescriptor>())
 			return kHelErrBadDescriptor;
 		thread = remove_tag_cast(threadWrapper->get<ThreadDescriptor>().thread);
 
-		auto queueWrapper = thisUniverse->getDescriptor(universeGuard, queueHandle);
+		auto queueWrapper = thisUniverse->getDescriptor(rcuGuard, queueHandle);
 		if(!queueWrapper)
 			return kHelErrNoDescriptor;
 		if(!queueWrapper->is<QueueDescriptor>())
@@ -1706,9 +2112,9 @@ HelError helKillThread(HelHandle handle) {
 	smarter::shared_ptr<Thread> thread;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1728,9 +2134,9 @@ HelError helInterruptThread(HelHandle handle) {
 	smarter::shared_ptr<Thread> thread;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1750,9 +2156,9 @@ HelError helResume(HelHandle handle) {
 	smarter::shared_ptr<Thread> thread;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(!thread_wrapper->is<ThreadDescriptor>())
@@ -1778,9 +2184,9 @@ HelError helLoadRegisters(HelHandle handle, int set, void *image) {
 	VirtualizedCpuDescriptor vcpu;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(thread_wrapper->is<ThreadDescriptor>()) {
@@ -1890,9 +2296,9 @@ HelError helStoreRegisters(HelHandle handle, int set, const void *image) {
 		thread = this_thread.lock();
 	}else{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto thread_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto thread_wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!thread_wrapper)
 			return kHelErrNoDescriptor;
 		if(thread_wrapper->is<ThreadDescriptor>()) {
@@ -2065,9 +2471,9 @@ HelError helSubmitAwaitClock(uint64_t counter, HelHandle queue_handle, uintptr_t
 	smarter::shared_ptr<IpcQueue> queue;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(rcuGuard, queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -2115,9 +2521,9 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 	smarter::shared_ptr<IpcQueue> queue;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(thisUniverse->lock);
+		RcuReadGuard rcuGuard;
 
-		auto wrapper = thisUniverse->getDescriptor(universe_guard, handle);
+		auto wrapper = thisUniverse->getDescriptor(rcuGuard, handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(wrapper->is<LaneDescriptor>()) {
@@ -2126,7 +2532,7 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 			return kHelErrBadDescriptor;
 		}
 
-		auto queueWrapper = thisUniverse->getDescriptor(universe_guard, queueHandle);
+		auto queueWrapper = thisUniverse->getDescriptor(rcuGuard, queueHandle);
 		if(!queueWrapper)
 			return kHelErrNoDescriptor;
 		if(!queueWrapper->is<QueueDescriptor>())
@@ -2149,21 +2555,221 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 		};
 	};
 
-	frg::dyn_array<Item, KernelAlloc> items{count, *kernelAlloc};
+	struct Closure final : StreamPacket, IpcNode {
+		static void transmitted(Closure *closure) {
+			QueueSource *tail = nullptr;
+			auto link = [&] (QueueSource *source) {
+				if(tail)
+					tail->link = source;
+				tail = source;
+			};
 
-	// Identifies the root chain on the stack below.
-	constexpr size_t noIndex = static_cast<size_t>(-1);
+			for(size_t i = 0; i < closure->count; i++) {
+				auto item = &closure->items[i];
+				HelAction *recipe = &item->recipe;
+				auto node = &item->transmit;
 
-	// Auxiliary stack to compute the list that each item will be linked into.
-	frg::small_vector<size_t, 4, KernelAlloc> linkStack{*kernelAlloc};
-	linkStack.push_back(noIndex);
+				if(recipe->type == kHelActionDismiss) {
+					item->helSimpleResult = {translateError(node->error()), 0};
+					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionOffer) {
+					HelHandle handle = kHelNullHandle;
 
-	// Read the message items from userspace.
-	size_t ipcSize = 0;
+					if(node->error() == Error::success
+							&& (recipe->flags & kHelItemWantLane)) {
+						auto universe = closure->weakUniverse.lock();
+						assert(universe);
+
+						auto irq_lock = frg::guard(&irqMutex());
+						Universe::Guard lock(universe->lock);
+
+						handle = universe->attachDescriptor(lock,
+								LaneDescriptor{node->lane()});
+					}
+
+					item->helHandleResult = {translateError(node->error()), 0, handle};
+					item->mainSource.setup(&item->helSimpleResult, sizeof(HelHandleResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionAccept) {
+					// TODO: This condition should be replaced. Just test if lane is valid.
+					HelHandle handle = kHelNullHandle;
+					if(node->error() == Error::success) {
+						auto universe = closure->weakUniverse.lock();
+						assert(universe);
+
+						auto irq_lock = frg::guard(&irqMutex());
+						Universe::Guard lock(universe->lock);
+
+						handle = universe->attachDescriptor(lock,
+								LaneDescriptor{node->lane()});
+					}
+
+					item->helHandleResult = {translateError(node->error()), 0, handle};
+					item->mainSource.setup(&item->helHandleResult, sizeof(HelHandleResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionImbueCredentials) {
+					item->helSimpleResult = {translateError(node->error()), 0};
+					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionExtractCredentials) {
+					item->helCredentialsResult = {.error = translateError(node->error())};
+					memcpy(item->helCredentialsResult.credentials,
+							node->credentials().data(), 16);
+					item->mainSource.setup(&item->helCredentialsResult,
+							sizeof(HelCredentialsResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionSendFromBuffer
+						|| recipe->type == kHelActionSendFromBufferSg) {
+					item->helSimpleResult = {translateError(node->error()), 0};
+					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionRecvInline) {
+					const void *data = node->_transmitBuffer.data();
+					size_t size = node->_transmitBuffer.size();
+					if(node->_recvStorage) {
+						data = node->_recvStorage;
+						size = node->_actualLength;
+					}
+
+					item->helInlineResult = {translateError(node->error()), 0, size};
+					item->mainSource.setup(&item->helInlineResult, sizeof(HelInlineResultNoFlex));
+					item->dataSource.setup(data, size);
+					link(&item->mainSource);
+					link(&item->dataSource);
+				}else if(recipe->type == kHelActionRecvToBuffer) {
+					item->helLengthResult = {translateError(node->error()),
+							0, node->actualLength()};
+					item->mainSource.setup(&item->helLengthResult, sizeof(HelLengthResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionPushDescriptor) {
+					item->helSimpleResult = {translateError(node->error()), 0};
+					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
+					link(&item->mainSource);
+				}else if(recipe->type == kHelActionPullDescriptor) {
+					// TODO: This condition should be replaced. Just test if lane is valid.
+					HelHandle handle = kHelNullHandle;
+					if(node->error() == Error::success) {
+						auto universe = closure->weakUniverse.lock();
+						assert(universe);
+
+						auto irq_lock = frg::guard(&irqMutex());
+						Universe::Guard lock(universe->lock);
+
+						handle = universe->attachDescriptor(lock, node->descriptor());
+					}
+
+					item->helHandleResult = {translateError(node->error()), 0, handle};
+					item->mainSource.setup(&item->helHandleResult, sizeof(HelHandleResult));
+					link(&item->mainSource);
+				}else{
+					// This cannot happen since we validate recipes at submit time.
+					__builtin_trap();
+				}
+			}
+
+			closure->setupSource(&closure->items[0].mainSource);
+			closure->ipcQueue->submit(closure);
+		}
+
+		// The closure, its items and small buffers share a single memory block.
+		// If possible, the block is taken from the thread's ActionArena.
+		static Closure *create(smarter::shared_ptr<ActionArena> arena, size_t count) {
+			constexpr size_t itemsOffset = (sizeof(Closure) + alignof(Item) - 1)
+					& ~(alignof(Item) - 1);
+			auto headSize = itemsOffset + count * sizeof(Item);
+
+			void *memory;
+			size_t memorySize;
+			if(count <= (ActionArena::blockSize - itemsOffset) / sizeof(Item)) {
+				memory = arena->allocate();
+				memorySize = ActionArena::blockSize;
+			}else{
+				arena = nullptr;
+				memory = kernelAlloc->allocate(headSize);
+				memorySize = headSize;
+			}
+
+			auto closure = new (memory) Closure{std::move(arena), memorySize, headSize};
+			closure->count = count;
+			closure->items = reinterpret_cast<Item *>(
+					reinterpret_cast<char *>(memory) + itemsOffset);
+			for(size_t i = 0; i < count; i++)
+				new (&closure->items[i]) Item{};
+			return closure;
+		}
+
+		static void destroy(Closure *closure) {
+			for(size_t i = 0; i < closure->count; i++)
+				closure->items[i].~Item();
+
+			auto arena = std::move(closure->arena);
+			auto memorySize = closure->memorySize;
+			closure->~Closure();
+			if(arena) {
+				arena->free(closure);
+			}else{
+				kernelAlloc->deallocate(closure, memorySize);
+			}
+		}
+
+		Closure(smarter::shared_ptr<ActionArena> arena, size_t memorySize, size_t dataOffset)
+		: arena{std::move(arena)}, memorySize{memorySize}, dataOffset{dataOffset} { }
+
+		// Carves a buffer from the remainder of the memory block.
+		// Returns nullptr if the block is exhausted.
+		void *carve(size_t size) {
+			if(memorySize - dataOffset < size)
+				return nullptr;
+			auto pointer = reinterpret_cast<char *>(this) + dataOffset;
+			dataOffset += size;
+			return pointer;
+		}
+
+		void completePacket() override {
+			transmitted(this);
+		}
+
+		void complete() override {
+			destroy(this);
+		}
+
+		size_t count;
+		smarter::weak_ptr<Universe> weakUniverse;
+		smarter::shared_ptr<IpcQueue> ipcQueue;
+		Item *items;
+
+		// Null if the memory block was allocated from the kernel heap.
+		smarter::shared_ptr<ActionArena> arena;
+		size_t memorySize;
+		size_t dataOffset;
+	};
+
+	auto closure = Closure::create(thisThread->actionArena(), count);
+
+	// Frees the closure if we fail before the items are submitted.
+	struct ClosureGuard {
+		~ClosureGuard() {
+			if(closure)
+				Closure::destroy(closure);
+		}
+
+		Closure *closure;
+	} closureGuard{closure};
+
+	// Identifies the root chain on the stack below.
+	constexpr size_t noIndex = static_cast<size_t>(-1);
+
+	// Auxiliary stack to compute the list that each item will be linked into.
+	frg::small_vector<size_t, 4, KernelAlloc> linkStack{*kernelAlloc};
+	linkStack.push_back(noIndex);
+
+	// Read the message items from userspace.
+	size_t ipcSize = 0;
 	size_t numFlows = 0;
 	for(size_t i = 0; i < count; i++) {
-		HelAction *recipe = &items[i].recipe;
-		auto node = &items[i].transmit;
+		HelAction *recipe = &closure->items[i].recipe;
+		auto node = &closure->items[i].transmit;
 
 		readUserObject(actions + i, *recipe);
 
@@ -2192,16 +2798,28 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 				break;
 			case kHelActionSendFromBuffer:
 				if(recipe->length <= kPageSize) {
-					frg::unique_memory<KernelAlloc> buffer(*kernelAlloc, recipe->length);
-					if(!readUserMemory(reinterpret_cast<char *>(buffer.data()),
+					// Small buffers are copied into the closure instead of the kernel heap.
+					frg::unique_memory<KernelAlloc> buffer;
+					auto data = closure->carve(recipe->length);
+					if(!data) {
+						buffer = frg::unique_memory<KernelAlloc>(*kernelAlloc, recipe->length);
+						data = buffer.data();
+					}
+					if(!readUserMemory(reinterpret_cast<char *>(data),
 							reinterpret_cast<char *>(recipe->buffer), recipe->length))
 						return kHelErrFault;
 
 					node->_tag = kTagSendKernelBuffer;
-					node->_inBuffer = std::move(buffer);
+					if(buffer.size()) {
+						node->_inBuffer = std::move(buffer);
+					}else{
+						node->_inData = data;
+						node->_inSize = recipe->length;
+					}
 				}else{
 					node->_tag = kTagSendFlow;
 					node->_maxLength = recipe->length;
+					node->_lendPages = recipe->flags & kHelItemLendPages;
 					++numFlows;
 				}
 				ipcSize += ipcSourceSize(sizeof(HelSimpleResult));
@@ -2215,32 +2833,53 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 					length += item.length;
 				}
 
-				frg::unique_memory<KernelAlloc> buffer(*kernelAlloc, length);
+				frg::unique_memory<KernelAlloc> buffer;
+				auto data = closure->carve(length);
+				if(!data) {
+					buffer = frg::unique_memory<KernelAlloc>(*kernelAlloc, length);
+					data = buffer.data();
+				}
 				size_t offset = 0;
 				for(size_t j = 0; j < recipe->length; j++) {
 					HelSgItem item;
 					readUserObject(sglist + j, item);
-					if(!readUserMemory(reinterpret_cast<char *>(buffer.data()) + offset,
+					if(!readUserMemory(reinterpret_cast<char *>(data) + offset,
 							reinterpret_cast<char *>(item.buffer), item.length))
 						return kHelErrFault;
 					offset += item.length;
 				}
 
 				node->_tag = kTagSendKernelBuffer;
-				node->_inBuffer = std::move(buffer);
+				if(buffer.size()) {
+					node->_inBuffer = std::move(buffer);
+				}else{
+					node->_inData = data;
+					node->_inSize = length;
+				}
 				ipcSize += ipcSourceSize(sizeof(HelSimpleResult));
 				break;
 			}
-			case kHelActionRecvInline:
-				// TODO: For now, we hardcode a size of 128 bytes.
+			case kHelActionRecvInline: {
+				// The length field selects the receive size (zero selects the default).
+				// Since the data is emitted to the queue, it must fit into a chunk.
+				size_t maxLength = recipe->length ? recipe->length : defaultInlineLength;
+				if(!queue->validSize(maxLength))
+					return kHelErrQueueTooSmall;
+
 				node->_tag = kTagRecvKernelBuffer;
-				node->_maxLength = 128;
+				node->_maxLength = maxLength;
+				node->_recvStorage = closure->carve(maxLength);
 				ipcSize += ipcSourceSize(sizeof(HelLengthResult));
-				ipcSize += ipcSourceSize(128);
+				ipcSize += ipcSourceSize(maxLength);
 				break;
+			}
 			case kHelActionRecvToBuffer:
+				// Lent pages are mapped over the buffer, so it must be a valid address.
+				if((recipe->flags & kHelItemLendPages) && !recipe->buffer)
+					return kHelErrIllegalArgs;
 				node->_tag = kTagRecvFlow;
 				node->_maxLength = recipe->length;
+				node->_lendPages = recipe->flags & kHelItemLendPages;
 				++numFlows;
 				ipcSize += ipcSourceSize(sizeof(HelLengthResult));
 				break;
@@ -2248,9 +2887,9 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 				AnyDescriptor operand;
 				{
 					auto irq_lock = frg::guard(&irqMutex());
-					Universe::Guard universe_guard(thisUniverse->lock);
+					RcuReadGuard rcuGuard;
 
-					auto wrapper = thisUniverse->getDescriptor(universe_guard, recipe->handle);
+					auto wrapper = thisUniverse->getDescriptor(rcuGuard, recipe->handle);
 					if(!wrapper)
 						return kHelErrNoDescriptor;
 					operand = *wrapper;
@@ -2273,7 +2912,7 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 		if(linkStack.empty())
 			return kHelErrIllegalArgs;
 
-		items[i].link = linkStack.back();
+		closure->items[i].link = linkStack.back();
 
 		if(!(recipe->flags & kHelItemChain))
 			linkStack.pop_back();
@@ -2290,137 +2929,8 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 
 	// From this point on, the function must not fail, since we now link our items
 	// into intrusive linked lists.
+	closureGuard.closure = nullptr;
 
-	struct Closure final : StreamPacket, IpcNode {
-		static void transmitted(Closure *closure) {
-			QueueSource *tail = nullptr;
-			auto link = [&] (QueueSource *source) {
-				if(tail)
-					tail->link = source;
-				tail = source;
-			};
-
-			for(size_t i = 0; i < closure->count; i++) {
-				auto item = &closure->items[i];
-				HelAction *recipe = &item->recipe;
-				auto node = &item->transmit;
-
-				if(recipe->type == kHelActionDismiss) {
-					item->helSimpleResult = {translateError(node->error()), 0};
-					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
-					link(&item->mainSource);
-				}else if(recipe->type == kHelActionOffer) {
-					HelHandle handle = kHelNullHandle;
-
-					if(node->error() == Error::success
-							&& (recipe->flags & kHelItemWantLane)) {
-						auto universe = closure->weakUniverse.lock();
-						assert(universe);
-
-						auto irq_lock = frg::guard(&irqMutex());
-						Universe::Guard lock(universe->lock);
-
-						handle = universe->attachDescriptor(lock,
-								LaneDescriptor{node->lane()});
-					}
-
-					item->helHandleResult = {translateError(node->error()), 0, handle};
-					item->mainSource.setup(&item->helSimpleResult, sizeof(HelHandleResult));
-					link(&item->mainSource);
-				}else if(recipe->type == kHelActionAccept) {
-					// TODO: This condition should be replaced. Just test if lane is valid.
-					HelHandle handle = kHelNullHandle;
-					if(node->error() == Error::success) {
-						auto universe = closure->weakUniverse.lock();
-						assert(universe);
-
-						auto irq_lock = frg::guard(&irqMutex());
-						Universe::Guard lock(universe->lock);
-
-						handle = universe->attachDescriptor(lock,
-								LaneDescriptor{node->lane()});
-					}
-
-					item->helHandleResult = {translateError(node->error()), 0, handle};
-					item->mainSource.setup(&item->helHandleResult, sizeof(HelHandleResult));
-					link(&item->mainSource);
-				}else if(recipe->type == kHelActionImbueCredentials) {
-					item->helSimpleResult = {translateError(node->error()), 0};
-					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
-					link(&item->mainSource);
-				}else if(recipe->type == kHelActionExtractCredentials) {
-					item->helCredentialsResult = {.error = translateError(node->error())};
-					memcpy(item->helCredentialsResult.credentials,
-							node->credentials().data(), 16);
-					item->mainSource.setup(&item->helCredentialsResult,
-							sizeof(HelCredentialsResult));
-					link(&item->mainSource);
-				}else if(recipe->type == kHelActionSendFromBuffer
-						|| recipe->type == kHelActionSendFromBufferSg) {
-					item->helSimpleResult = {translateError(node->error()), 0};
-					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
-					link(&item->mainSource);
-				}else if(recipe->type == kHelActionRecvInline) {
-					item->helInlineResult = {translateError(node->error()),
-							0, node->_transmitBuffer.size()};
-					item->mainSource.setup(&item->helInlineResult, sizeof(HelInlineResultNoFlex));
-					item->dataSource.setup(node->_transmitBuffer.data(),
-							node->_transmitBuffer.size());
-					link(&item->mainSource);
-					link(&item->dataSource);
-				}else if(recipe->type == kHelActionRecvToBuffer) {
-					item->helLengthResult = {translateError(node->error()),
-							0, node->actualLength()};
-					item->mainSource.setup(&item->helLengthResult, sizeof(HelLengthResult));
-					link(&item->mainSource);
-				}else if(recipe->type == kHelActionPushDescriptor) {
-					item->helSimpleResult = {translateError(node->error()), 0};
-					item->mainSource.setup(&item->helSimpleResult, sizeof(HelSimpleResult));
-					link(&item->mainSource);
-				}else if(recipe->type == kHelActionPullDescriptor) {
-					// TODO: This condition should be replaced. Just test if lane is valid.
-					HelHandle handle = kHelNullHandle;
-					if(node->error() == Error::success) {
-						auto universe = closure->weakUniverse.lock();
-						assert(universe);
-
-						auto irq_lock = frg::guard(&irqMutex());
-						Universe::Guard lock(universe->lock);
-
-						handle = universe->attachDescriptor(lock, node->descriptor());
-					}
-
-					item->helHandleResult = {translateError(node->error()), 0, handle};
-					item->mainSource.setup(&item->helHandleResult, sizeof(HelHandleResult));
-					link(&item->mainSource);
-				}else{
-					// This cannot happen since we validate recipes at submit time.
-					__builtin_trap();
-				}
-			}
-
-			closure->setupSource(&closure->items[0].mainSource);
-			closure->ipcQueue->submit(closure);
-		}
-
-		Closure(frg::dyn_array<Item, KernelAlloc> items_)
-		: items{std::move(items_)} { }
-
-		void completePacket() override {
-			transmitted(this);
-		}
-
-		void complete() override {
-			frg::destruct(*kernelAlloc, this);
-		}
-
-		size_t count;
-		smarter::weak_ptr<Universe> weakUniverse;
-		smarter::shared_ptr<IpcQueue> ipcQueue;
-		frg::dyn_array<Item, KernelAlloc> items;
-	} *closure = frg::construct<Closure>(*kernelAlloc, std::move(items));
-
-	closure->count = count;
 	closure->weakUniverse = thisUniverse.lock();
 	closure->ipcQueue = std::move(queue);
 
@@ -2443,9 +2953,10 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 		}
 	}
 
+	// The coroutine frame is allocated from the thread's ActionArena.
 	auto handleFlow = [] (Closure *closure, size_t numFlows,
 			smarter::shared_ptr<Thread> thread,
-			enable_detached_coroutine = {}) -> void {
+			detached_in_arena) -> void {
 		// We exit once we processed numFlows-many items.
 		// This guarantees that we do not access the closure object after it is freed.
 		// Below, we need to ensure that we always complete our own nodes
@@ -2478,10 +2989,16 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 			if(recipe->type == kHelActionSendFromBuffer
 					&& node->tag() == kTagSendFlow
 					&& peer->tag() == kTagRecvKernelBuffer) {
-				frg::unique_memory<KernelAlloc> buffer(*kernelAlloc, recipe->length);
+				// Copy directly into the receiver's storage if it provides one.
+				frg::unique_memory<KernelAlloc> buffer;
+				void *data = peer->_recvStorage;
+				if(!data) {
+					buffer = frg::unique_memory<KernelAlloc>(*kernelAlloc, recipe->length);
+					data = buffer.data();
+				}
 
 				co_await thread->mainWorkQueue()->enter();
-				auto outcome = readUserMemory(buffer.data(), recipe->buffer, recipe->length);
+				auto outcome = readUserMemory(data, recipe->buffer, recipe->length);
 				if(!outcome) {
 					// We complete with fault; the remote with success.
 					// TODO: it probably makes sense to introduce a "remote fault" error.
@@ -2493,7 +3010,11 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 				}
 
 				// Both nodes complete successfully.
-				peer->_transmitBuffer = std::move(buffer);
+				if(peer->_recvStorage) {
+					peer->_actualLength = recipe->length;
+				}else{
+					peer->_transmitBuffer = std::move(buffer);
+				}
 				peer->complete();
 				node->complete();
 			}else if(recipe->type == kHelActionSendFromBuffer
@@ -2502,6 +3023,67 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 				// Empty packets are handled by the generic stream code.
 				assert(recipe->length);
 
+				// The receiver either asks us to lend our pages,
+				// pins its buffer or asks us to use bounce buffers.
+				auto setupPacket = co_await node->flowQueue.async_get();
+				assert(setupPacket);
+				if(setupPacket->lend) {
+					AddressSpace::MapFlags protection;
+					auto sliceOutcome = co_await thread->getAddressSpace()->lendRange(
+							reinterpret_cast<uintptr_t>(recipe->buffer), recipe->length,
+							protection);
+					if(sliceOutcome) {
+						// Send the packet (may deallocate the peer!).
+						peer->flowQueue.put({
+							.size = recipe->length,
+							.terminate = true,
+							.lentSlice = std::move(sliceOutcome.value()),
+							.lentProtection = protection
+						});
+						node->_error = Error::success;
+						node->complete();
+						continue;
+					}
+
+					// Decline; the receiver follows up with another setup packet.
+					peer->flowQueue.put({});
+					setupPacket = co_await node->flowQueue.async_get();
+					assert(setupPacket);
+					assert(!setupPacket->lend);
+				}
+				if(auto pin = setupPacket->pin; pin) {
+					assert(recipe->length <= pin->size);
+
+					// Copy directly from our buffer to the receiver's pages.
+					co_await thread->mainWorkQueue()->enter();
+					size_t progress = 0;
+					bool didFault = false;
+					while(progress < recipe->length) {
+						auto offsetInPin = (pin->address & (kPageSize - 1)) + progress;
+						auto misalign = offsetInPin & (kPageSize - 1);
+						auto chunk = frg::min(recipe->length - progress, kPageSize - misalign);
+
+						PageAccessor accessor{pin->pages[offsetInPin >> kPageShift]};
+						if(!readUserMemory(reinterpret_cast<std::byte *>(accessor.get()) + misalign,
+								reinterpret_cast<std::byte *>(recipe->buffer) + progress, chunk)) {
+							didFault = true;
+							break;
+						}
+						progress += chunk;
+					}
+
+					// Send the packet (may deallocate the peer!).
+					if(didFault) {
+						peer->flowQueue.put({ .terminate = true, .fault = true });
+						node->_error = Error::fault;
+					}else{
+						peer->flowQueue.put({ .size = progress, .terminate = true });
+						node->_error = Error::success;
+					}
+					node->complete();
+					continue;
+				}
+
 				size_t progress = 0;
 				size_t numSent = 0;
 				size_t numAcked = 0;
@@ -2593,7 +3175,7 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 					&& peer->tag() == kTagSendKernelBuffer) {
 				co_await thread->mainWorkQueue()->enter();
 				auto outcome = writeUserMemory(recipe->buffer,
-						peer->_inBuffer.data(), peer->_inBuffer.size());
+						peer->inBufferData(), peer->inBufferSize());
 				if(!outcome) {
 					// We complete with fault; the remote with success.
 					// TODO: it probably makes sense to introduce a "remote fault" error.
@@ -2605,13 +3187,83 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 				}
 
 				// Both nodes complete successfully.
-				node->_actualLength = peer->_inBuffer.size();
+				node->_actualLength = peer->inBufferSize();
 				peer->complete();
 				node->complete();
 			}else{
 				assert(recipe->type == kHelActionRecvToBuffer
 						&& peer->tag() == kTagSendFlow);
 
+				// If both sides agree, the sender lends its pages and we map them over our buffer.
+				// The lent pages never get more permissions than either side's mapping.
+				AddressSpace::MapFlags recvProtection = 0;
+				bool lend = node->_lendPages && peer->_lendPages
+						&& !(reinterpret_cast<uintptr_t>(recipe->buffer) & (kPageSize - 1))
+						&& !(peer->_maxLength & (kPageSize - 1));
+				if(lend) {
+					auto protectionOutcome = thread->getAddressSpace()->queryProtection(
+							reinterpret_cast<uintptr_t>(recipe->buffer), peer->_maxLength);
+					if(protectionOutcome)
+						recvProtection = protectionOutcome.value();
+					// Unwritable buffers fault on the regular path below.
+					lend = recvProtection & AddressSpace::kMapProtWrite;
+				}
+				if(lend) {
+					peer->flowQueue.put({ .lend = true });
+
+					auto lendPacket = co_await node->flowQueue.async_get();
+					assert(lendPacket);
+					if(lendPacket->lentSlice) {
+						// The sender terminated and may already be gone.
+						assert(lendPacket->terminate);
+						auto mapOutcome = co_await thread->getAddressSpace()->map(
+								std::move(lendPacket->lentSlice),
+								reinterpret_cast<uintptr_t>(recipe->buffer), 0, lendPacket->size,
+								AddressSpace::kMapFixed
+									| (lendPacket->lentProtection & recvProtection));
+						if(mapOutcome) {
+							node->_actualLength = lendPacket->size;
+						}else if(mapOutcome.error() == Error::illegalArgs) {
+							// The buffer is not part of the address space.
+							node->_error = Error::illegalArgs;
+						}else{
+							node->_error = Error::fault;
+						}
+						node->complete();
+						continue;
+					}
+				}
+
+				// Pin our buffer such that the sender can copy into it directly.
+				// If that faults, we fall back to bounce buffers (which also report the fault).
+				bool didTransferDirectly = false;
+				{
+					PinnedVirtualRange pin;
+					auto pinOutcome = co_await thread->getAddressSpace()->pinRange(
+							reinterpret_cast<uintptr_t>(recipe->buffer), peer->_maxLength,
+							pin, thread->mainWorkQueue()->take());
+					if(pinOutcome) {
+						// Send the pin (the sender always terminates after using it).
+						peer->flowQueue.put({ .pin = &pin });
+
+						auto xferPacket = co_await node->flowQueue.async_get();
+						assert(xferPacket);
+						assert(xferPacket->terminate);
+						if(xferPacket->fault) {
+							node->_error = Error::remoteFault;
+						}else{
+							node->_actualLength = xferPacket->size;
+						}
+						didTransferDirectly = true;
+					}else{
+						peer->flowQueue.put({});
+					}
+				}
+				if(didTransferDirectly) {
+					node->complete();
+					continue;
+				}
+
 				size_t progress = 0;
 				bool didFault = false;
 				// Each iteration of this loop sends one ack packet.
@@ -2671,7 +3323,8 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 	};
 
 	if(numFlows)
-		handleFlow(closure, numFlows, thisThread.lock());
+		handleFlow(closure, numFlows, thisThread.lock(),
+				detached_in_arena{thisThread->actionArena()});
 
 	Stream::transmit(lane, rootChain);
 
@@ -2685,9 +3338,9 @@ HelError helShutdownLane(HelHandle handle) {
 	LaneHandle lane;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(!wrapper->is<LaneDescriptor>())
@@ -2735,6 +3388,97 @@ HelError helFutexWait(int *pointer, int expected, int64_t deadline) {
 	return kHelErrNone;
 }
 
+HelError helFutexWaitv(const HelFutexWaitItem *items, size_t count, int64_t deadline,
+		size_t *index) {
+	// Limits the amount of kernel memory that a single call can pin.
+	constexpr size_t maxWaitItems = 128;
+	constexpr size_t noIndex = static_cast<size_t>(-1);
+
+	auto thisThread = getCurrentThread();
+	auto space = thisThread->getAddressSpace();
+
+	if(!count || count > maxWaitItems)
+		return kHelErrIllegalArgs;
+	if(deadline < 0 && deadline != -1)
+		return kHelErrIllegalArgs;
+
+	frg::dyn_array<HelFutexWaitItem, KernelAlloc> waitItems{count, *kernelAlloc};
+	if(!readUserArray(items, waitItems.data(), count))
+		return kHelErrFault;
+
+	frg::vector<GlobalFutex, KernelAlloc> futexes{*kernelAlloc};
+	for(size_t i = 0; i < count; i++) {
+		auto futexOrError = Thread::asyncBlockCurrent(
+				space->grabGlobalFutex(reinterpret_cast<uintptr_t>(waitItems[i].pointer),
+						thisThread->mainWorkQueue()->take()));
+		if(!futexOrError) {
+			for(auto &futex : futexes)
+				futex.retire();
+			return kHelErrFault;
+		}
+		futexes.push_back(std::move(futexOrError.value()));
+	}
+
+	// The first waiter that completes (or the timer) stores its index in firstIndex
+	// and cancels all other waiters. The last waiter to finish raises doneEvent.
+	struct WaitvState {
+		async::cancellation_event cancelWaits;
+		async::cancellation_event cancelTimer;
+		std::atomic<size_t> firstIndex{noIndex};
+		std::atomic<size_t> numPending{0};
+		async::oneshot_event doneEvent;
+
+		bool claim(size_t index) {
+			auto expected = noIndex;
+			return firstIndex.compare_exchange_strong(expected, index,
+					std::memory_order_acq_rel);
+		}
+
+		void finish() {
+			if(numPending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				doneEvent.raise();
+		}
+	} state;
+
+	// Index that signals that the deadline expired.
+	size_t timeoutIndex = count;
+
+	state.numPending.store(count + (deadline >= 0 ? 1 : 0), std::memory_order_relaxed);
+
+	if(deadline >= 0) {
+		[] (WaitvState *state, int64_t deadline, size_t timeoutIndex,
+				enable_detached_coroutine = {}) -> void {
+			co_await generalTimerEngine()->sleep(deadline, state->cancelTimer);
+			if(state->claim(timeoutIndex))
+				state->cancelWaits.cancel();
+			state->finish();
+		}(&state, deadline, timeoutIndex);
+	}
+
+	for(size_t i = 0; i < count; i++) {
+		[] (WaitvState *state, GlobalFutex futex, unsigned int expected, size_t index,
+				enable_detached_coroutine = {}) -> void {
+			co_await getGlobalFutexRealm()->wait(std::move(futex), expected,
+					state->cancelWaits);
+			if(state->claim(index)) {
+				state->cancelWaits.cancel();
+				state->cancelTimer.cancel();
+			}
+			state->finish();
+		}(&state, std::move(futexes[i]), waitItems[i].expected, i);
+	}
+
+	Thread::asyncBlockCurrent(state.doneEvent.wait());
+
+	auto first = state.firstIndex.load(std::memory_order_acquire);
+	if(first == timeoutIndex) {
+		*index = noIndex;
+	}else{
+		*index = first;
+	}
+	return kHelErrNone;
+}
+
 HelError helFutexWake(int *pointer) {
 	auto this_thread = getCurrentThread();
 	auto space = this_thread->getAddressSpace();
@@ -2747,6 +3491,147 @@ HelError helFutexWake(int *pointer) {
 	return kHelErrNone;
 }
 
+HelError helFutexWakeN(int *pointer, unsigned int count, unsigned int *numWoken) {
+	auto this_thread = getCurrentThread();
+	auto space = this_thread->getAddressSpace();
+
+	auto identityOrError = space->resolveGlobalFutex(reinterpret_cast<uintptr_t>(pointer));
+	if(!identityOrError)
+		return kHelErrFault;
+	*numWoken = getGlobalFutexRealm()->wake(identityOrError.value(), count);
+
+	return kHelErrNone;
+}
+
+HelError helFutexRequeue(int *pointer, int *target, int expected,
+		unsigned int wakeCount, unsigned int requeueCount, unsigned int *numWoken) {
+	auto thisThread = getCurrentThread();
+	auto space = thisThread->getAddressSpace();
+
+	auto targetOrError = space->resolveGlobalFutex(reinterpret_cast<uintptr_t>(target));
+	if(!targetOrError)
+		return kHelErrFault;
+
+	// We need to pin the futex to compare its value to the expected one.
+	auto futexOrError = Thread::asyncBlockCurrent(
+			space->grabGlobalFutex(reinterpret_cast<uintptr_t>(pointer),
+					thisThread->mainWorkQueue()->take()));
+	if(!futexOrError)
+		return kHelErrFault;
+	GlobalFutex futex = std::move(futexOrError.value());
+
+	auto outcome = getGlobalFutexRealm()->requeue(std::move(futex), targetOrError.value(),
+			expected, wakeCount, requeueCount);
+	if(!outcome) {
+		assert(outcome.error() == Error::futexRace);
+		return kHelErrFutexRace;
+	}
+	*numWoken = outcome.value();
+
+	return kHelErrNone;
+}
+
+HelError helFutexWakeOp(int *pointer, int *target, unsigned int count,
+		unsigned int targetCount, uint32_t op, unsigned int *numWoken) {
+	auto thisThread = getCurrentThread();
+	auto space = thisThread->getAddressSpace();
+
+	// The encoding follows HEL_FUTEX_OP(opcode, oparg, cmp, cmparg).
+	unsigned int opcode = (op >> 28) & 0xF;
+	unsigned int cmp = (op >> 24) & 0xF;
+	unsigned int oparg = (op >> 12) & 0xFFF;
+	unsigned int cmparg = op & 0xFFF;
+	if(opcode & kHelFutexOpArgShift) {
+		opcode &= ~kHelFutexOpArgShift;
+		if(oparg > 31)
+			return kHelErrIllegalArgs;
+		oparg = 1u << oparg;
+	}
+	if(opcode > kHelFutexOpXor || cmp > kHelFutexCmpGe)
+		return kHelErrIllegalArgs;
+
+	auto identityOrError = space->resolveGlobalFutex(reinterpret_cast<uintptr_t>(pointer));
+	if(!identityOrError)
+		return kHelErrFault;
+
+	// We need to pin the target futex to modify it atomically.
+	auto futexOrError = Thread::asyncBlockCurrent(
+			space->grabGlobalFutex(reinterpret_cast<uintptr_t>(target),
+					thisThread->mainWorkQueue()->take(), true));
+	if(!futexOrError)
+		return kHelErrFault;
+	GlobalFutex futex = std::move(futexOrError.value());
+
+	*numWoken = getGlobalFutexRealm()->wakeOp(identityOrError.value(), futex.getIdentity(),
+			count, targetCount, [&] () -> bool {
+		auto word = futex.update([&] (unsigned int word) -> unsigned int {
+			switch(opcode) {
+			case kHelFutexOpSet: return oparg;
+			case kHelFutexOpAdd: return word + oparg;
+			case kHelFutexOpOr: return word | oparg;
+			case kHelFutexOpAndNot: return word & ~oparg;
+			default:
+				assert(opcode == kHelFutexOpXor);
+				return word ^ oparg;
+			}
+		});
+
+		auto value = static_cast<int>(word);
+		auto arg = static_cast<int>(cmparg);
+		switch(cmp) {
+		case kHelFutexCmpEq: return value == arg;
+		case kHelFutexCmpNe: return value != arg;
+		case kHelFutexCmpLt: return value < arg;
+		case kHelFutexCmpLe: return value <= arg;
+		case kHelFutexCmpGt: return value > arg;
+		default:
+			assert(cmp == kHelFutexCmpGe);
+			return value >= arg;
+		}
+	});
+	futex.retire();
+
+	return kHelErrNone;
+}
+
+HelError helFutexLockPi(int *pointer) {
+	auto thisThread = getCurrentThread();
+	auto space = thisThread->getAddressSpace();
+
+	auto futexOrError = Thread::asyncBlockCurrent(
+			space->grabGlobalFutex(reinterpret_cast<uintptr_t>(pointer),
+					thisThread->mainWorkQueue()->take(), true));
+	if(!futexOrError)
+		return kHelErrFault;
+	GlobalFutex futex = std::move(futexOrError.value());
+
+	auto error = getPiFutexRealm()->lock(futex);
+	futex.retire();
+	if(error == Error::illegalState)
+		return kHelErrIllegalState;
+	assert(error == Error::success);
+	return kHelErrNone;
+}
+
+HelError helFutexUnlockPi(int *pointer) {
+	auto thisThread = getCurrentThread();
+	auto space = thisThread->getAddressSpace();
+
+	auto futexOrError = Thread::asyncBlockCurrent(
+			space->grabGlobalFutex(reinterpret_cast<uintptr_t>(pointer),
+					thisThread->mainWorkQueue()->take(), true));
+	if(!futexOrError)
+		return kHelErrFault;
+	GlobalFutex futex = std::move(futexOrError.value());
+
+	auto error = getPiFutexRealm()->unlock(futex);
+	futex.retire();
+	if(error == Error::illegalState)
+		return kHelErrIllegalState;
+	assert(error == Error::success);
+	return kHelErrNone;
+}
+
 HelError helCreateOneshotEvent(HelHandle *handle) {
 	auto this_thread = getCurrentThread();
 	auto this_universe = this_thread->getUniverse();
@@ -2788,9 +3673,9 @@ HelError helRaiseEvent(HelHandle handle) {
 	AnyDescriptor descriptor;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		descriptor = *wrapper;
@@ -2843,9 +3728,9 @@ HelError helAcknowledgeIrq(HelHandle handle, uint32_t flags, uint64_t sequence)
 	smarter::shared_ptr<IrqObject> irq;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto irq_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto irq_wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!irq_wrapper)
 			return kHelErrNoDescriptor;
 		if(!irq_wrapper->is<IrqDescriptor>())
@@ -2965,14 +3850,14 @@ HelError helSubmitAwaitEvent(HelHandle handle, uint64_t sequence,
 	smarter::shared_ptr<IpcQueue> queue;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		descriptor = *wrapper;
 
-		auto queue_wrapper = this_universe->getDescriptor(universe_guard, queue_handle);
+		auto queue_wrapper = this_universe->getDescriptor(rcuGuard, queue_handle);
 		if(!queue_wrapper)
 			return kHelErrNoDescriptor;
 		if(!queue_wrapper->is<QueueDescriptor>())
@@ -3012,16 +3897,16 @@ HelError helAutomateIrq(HelHandle handle, uint32_t flags, HelHandle kernlet_hand
 	smarter::shared_ptr<BoundKernlet> kernlet;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto irq_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto irq_wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!irq_wrapper)
 			return kHelErrNoDescriptor;
 		if(!irq_wrapper->is<IrqDescriptor>())
 			return kHelErrBadDescriptor;
 		irq = irq_wrapper->get<IrqDescriptor>().irq;
 
-		auto kernlet_wrapper = this_universe->getDescriptor(universe_guard, kernlet_handle);
+		auto kernlet_wrapper = this_universe->getDescriptor(rcuGuard, kernlet_handle);
 		if(!kernlet_wrapper)
 			return kHelErrNoDescriptor;
 		if(!kernlet_wrapper->is<BoundKernletDescriptor>())
@@ -3066,9 +3951,9 @@ HelError helEnableIo(HelHandle handle) {
 	smarter::shared_ptr<IoSpace> io_space;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!wrapper)
 			return kHelErrNoDescriptor;
 		if(!wrapper->is<IoDescriptor>())
@@ -3105,9 +3990,9 @@ HelError helBindKernlet(HelHandle handle, const HelKernletData *data, size_t num
 	smarter::shared_ptr<KernletObject> kernlet;
 	{
 		auto irq_lock = frg::guard(&irqMutex());
-		Universe::Guard universe_guard(this_universe->lock);
+		RcuReadGuard rcuGuard;
 
-		auto kernlet_wrapper = this_universe->getDescriptor(universe_guard, handle);
+		auto kernlet_wrapper = this_universe->getDescriptor(rcuGuard, handle);
 		if(!kernlet_wrapper)
 			return kHelErrNoDescriptor;
 		if(!kernlet_wrapper->is<KernletObjectDescriptor>())
@@ -3133,9 +4018,9 @@ HelError helBindKernlet(HelHandle handle, const HelKernletData *data, size_t num
 			smarter::shared_ptr<MemoryView> memory;
 			{
 				auto irq_lock = frg::guard(&irqMutex());
-				Universe::Guard universe_guard(this_universe->lock);
+				RcuReadGuard rcuGuard;
 
-				auto wrapper = this_universe->getDescriptor(universe_guard, d.handle);
+				auto wrapper = this_universe->getDescriptor(rcuGuard, d.handle);
 				if(!wrapper)
 					return kHelErrNoDescriptor;
 				if(!wrapper->is<MemoryViewDescriptor>())
@@ -3160,9 +4045,9 @@ HelError helBindKernlet(HelHandle handle, const HelKernletData *data, size_t num
 			smarter::shared_ptr<BitsetEvent> event;
 			{
 				auto irq_lock = frg::guard(&irqMutex());
-				Universe::Guard universe_guard(this_universe->lock);
+				RcuReadGuard rcuGuard;
 
-				auto wrapper = this_universe->getDescriptor(universe_guard, d.handle);
+				auto wrapper = this_universe->getDescriptor(rcuGuard, d.handle);
 				if(!wrapper)
 					return kHelErrNoDescriptor;
 				if(!wrapper->is<BitsetEventDescriptor>())
@@ -0,0 +1,174 @@
+#include <frg/manual_box.hpp>
+#include <thor-internal/fiber.hpp>
+#include <thor-internal/huge-pages.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/timer.hpp>
+
+namespace thor {
+
+namespace {
+	constexpr bool logCollapse = false;
+}
+
+void HugePageCollapser::registerSpace(VirtualSpace *space) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	_spaces.push_back(space);
+}
+
+void HugePageCollapser::unregisterSpace(VirtualSpace *space) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	bool found = false;
+	for(auto other : _spaces) {
+		if(other == space) {
+			found = true;
+			break;
+		}
+	}
+	if(!found)
+		return;
+
+	// Continue the scan with the next space.
+	if(_current == space) {
+		auto it = _spaces.iterator_to(space);
+		++it;
+		_current = (it != _spaces.end()) ? *it : nullptr;
+		_cursor = 0;
+	}
+	_spaces.erase(_spaces.iterator_to(space));
+}
+
+void HugePageCollapser::setScanRate(size_t rangesPerScan, uint64_t scanInterval) {
+	assert(rangesPerScan);
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	_rangesPerScan = rangesPerScan;
+	_scanInterval = scanInterval;
+}
+
+HugePageCollapser::Stats HugePageCollapser::getStats() {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	return Stats{
+		.scannedRanges = _scannedRanges,
+		.promotions = _promotions,
+		.failures = _failures,
+		.skippedRanges = _skippedRanges
+	};
+}
+
+void HugePageCollapser::run() {
+	KernelFiber::run([this] {
+		while(true) {
+			uint64_t scanInterval;
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto lock = frg::guard(&_mutex);
+
+				scanInterval = _scanInterval;
+			}
+			KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleepFor(scanInterval));
+
+			_scan();
+
+			if(logCollapse) {
+				auto stats = getStats();
+				infoLogger() << "thor: Scanned " << stats.scannedRanges << " huge page ranges, "
+						<< stats.promotions << " promotions, "
+						<< stats.failures << " failures, "
+						<< stats.skippedRanges << " skipped" << frg::endlog;
+			}
+		}
+	});
+}
+
+void HugePageCollapser::_scan() {
+	size_t budget;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		budget = _rangesPerScan;
+	}
+
+	// Each iteration either examines one range or moves on to the next space.
+	for(; budget; --budget) {
+		smarter::shared_ptr<VirtualSpace> space;
+		VirtualAddr cursor;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			if(_spaces.empty())
+				return;
+			if(!_current) {
+				_current = _spaces.front();
+				_cursor = 0;
+			}
+			space = _current->selfPtr.lock();
+			cursor = _cursor;
+		}
+
+		frg::optional<VirtualAddr> candidate;
+		if(space)
+			candidate = space->findHugePageCandidate(cursor);
+
+		if(candidate) {
+			auto outcome = KernelFiber::asyncBlockCurrent(space->collapseHugePage(*candidate));
+
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			_scannedRanges++;
+			if(outcome) {
+				_promotions++;
+			}else if(outcome.error() == Error::illegalObject) {
+				_skippedRanges++;
+			}else if(outcome.error() != Error::fault
+					&& outcome.error() != Error::spuriousOperation) {
+				// Ranges that are not fully populated or that are already huge pages
+				// are not counted as failures.
+				_failures++;
+			}
+		}
+
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		// The space might have been unregistered while we were scanning it.
+		if(_current != space.get())
+			continue;
+		if(candidate) {
+			_cursor = *candidate + kHugePageSize;
+		}else{
+			auto it = _spaces.iterator_to(_current);
+			++it;
+			_current = (it != _spaces.end()) ? *it : nullptr;
+			_cursor = 0;
+		}
+	}
+}
+
+namespace {
+	// Spaces can be registered before the fiber runs.
+	frg::eternal<HugePageCollapser> globalHugePageCollapser;
+}
+
+HugePageCollapser *getHugePageCollapser() {
+	return &globalHugePageCollapser.get();
+}
+
+static initgraph::Task initHugePages{&globalInitEngine, "generic.init-huge-pages",
+	initgraph::Requires{getFibersAvailableStage()},
+	[] {
+		globalHugePageCollapser.get().run();
+	}
+};
+
+} // namespace thor
@@ -4,6 +4,7 @@
 #include <frg/container_of.hpp>
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/ipc-queue.hpp>
+#include <thor-internal/timer.hpp>
 
 namespace thor {
 
@@ -11,8 +12,10 @@ namespace thor {
 // IpcQueue
 // ----------------------------------------------------------------------------
 
-IpcQueue::IpcQueue(unsigned int ringShift, unsigned int numChunks, size_t chunkSize)
-: _ringShift{ringShift}, _chunkSize{chunkSize}, _chunkOffsets{*kernelAlloc},
+IpcQueue::IpcQueue(unsigned int ringShift, unsigned int numChunks, size_t chunkSize,
+		bool adaptiveSpin)
+: _ringShift{ringShift}, _chunkSize{chunkSize}, _adaptiveSpin{adaptiveSpin},
+		_chunkOffsets{*kernelAlloc},
 		_currentIndex{0}, _currentProgress{0}, _anyNodes{false} {
 	auto chunksOffset = (sizeof(QueueStruct) + (sizeof(int) << ringShift) + 63) & ~size_t(63);
 	auto reservedPerChunk = (sizeof(ChunkStruct) + chunkSize + 63) & ~size_t(63);
@@ -29,7 +32,8 @@ IpcQueue::IpcQueue(unsigned int ringShift, unsigned int numChunks, size_t chunkS
 }
 
 bool IpcQueue::validSize(size_t size) {
-	return sizeof(ElementStruct) + size <= _chunkSize;
+	// Avoid overflows for sizes that are passed from userspace.
+	return size <= _chunkSize && sizeof(ElementStruct) <= _chunkSize - size;
 }
 
 void IpcQueue::submit(IpcNode *node) {
@@ -102,29 +106,43 @@ coroutine<void> IpcQueue::_runQueue() {
 			if(!_anyNodes.load(std::memory_order_relaxed))
 				continue;
 
-			// Check if there is enough space in the current chunk.
-			IpcNode *node;
-			uintptr_t progress;
+			// Dequeue all nodes that fit into the current chunk.
+			NodeList batch;
+			size_t batchProgress;
+			size_t endProgress;
+			bool retireChunk = false;
 			{
 				auto irqLock = frg::guard(&irqMutex());
 				auto lock = frg::guard(&_mutex);
 
 				assert(!_nodeQueue.empty());
-				node = _nodeQueue.front();
-				progress = _currentProgress;
+				batchProgress = _currentProgress;
+				while(!_nodeQueue.empty()) {
+					auto node = _nodeQueue.front();
+					auto length = _elementLength(node);
+					assert(length <= _chunkSize);
+
+					if(_currentProgress + sizeof(ElementStruct) + length > _chunkSize) {
+						retireChunk = true;
+						break;
+					}
+
+					_nodeQueue.pop_front();
+					batch.push_back(node);
+					_currentProgress += sizeof(ElementStruct) + length;
+				}
+				endProgress = _currentProgress;
+
+				if(_nodeQueue.empty())
+					_anyNodes.store(false, std::memory_order_relaxed);
 			}
 
-			// Compute the overall length of the element.
-			size_t length = 0;
-			for(auto sgSource = _nodeQueue.front()->_source; sgSource; sgSource = sgSource->link)
-				length += (sgSource->size + 7) & ~size_t(7);
-			assert(length <= _chunkSize);
-
-			// Check if we need to retire the current chunk.
-			bool emitElement = true;
-			if(progress + length <= _chunkSize) {
-				// Emit the next element to the current chunk.
-				auto elementOffset = offsetof(ChunkStruct, buffer) + _currentProgress;
+			// Emit all elements of the batch. The nodes are ours now,
+			// hence we do not need to hold the lock.
+			size_t progress = batchProgress;
+			for(auto node : batch) {
+				auto length = _elementLength(node);
+				auto elementOffset = offsetof(ChunkStruct, buffer) + progress;
 				assert(!(elementOffset & 0x7));
 
 				ElementStruct element;
@@ -140,53 +158,103 @@ coroutine<void> IpcQueue::_runQueue() {
 							sgSource->pointer, sgSource->size);
 					sgOffset += (sgSource->size + 7) & ~size_t(7);
 				}
-			}else{
-				emitElement = false;
-			}
 
-			// Update the progress futex.
-			unsigned int newProgressWord;
-			if(emitElement) {
-				newProgressWord = progress + sizeof(ElementStruct) + length;
-			}else{
-				newProgressWord = progress | kProgressDone;
+				progress += sizeof(ElementStruct) + length;
 			}
+			assert(progress == endProgress);
+
+			// Publish the progress of the entire batch at once.
+			unsigned int newProgressWord = endProgress;
+			if(retireChunk)
+				newProgressWord |= kProgressDone;
 
 			auto progressFutexWord = __atomic_exchange_n(&chunkHead->progressFutex,
 					newProgressWord, __ATOMIC_RELEASE);
 			// If user-space modifies any non-flags field, that's a contract violation.
 			// TODO: Shut down the queue in this case.
+			// Consumers that are still polling do not set the waiters bit;
+			// hence, we avoid the wake (and the IPI that it might cause) for them.
 			if(progressFutexWord & kProgressWaiters) {
 				auto pfOffset = chunkOffset + offsetof(ChunkStruct, progressFutex);
-				getGlobalFutexRealm()->wake(_memory->resolveImmediateFutex(pfOffset));
+				{
+					// Consumers that block on the queue usually wait for the reply to
+					// a request of the current thread; let one of them take over the CPU.
+					auto irqLock = frg::guard(&irqMutex());
+					localScheduler()->beginHandoff();
+					getGlobalFutexRealm()->wake(_memory->resolveImmediateFutex(pfOffset));
+					localScheduler()->endHandoff();
+				}
+				_numWakes.fetch_add(1, std::memory_order_relaxed);
 			}
 
+			if(_adaptiveSpin)
+				_updateSpinHint(head);
+
+			size_t numElements = 0;
+			while(!batch.empty()) {
+				auto node = batch.pop_front();
+				node->complete();
+				++numElements;
+			}
+
+			_numElements.fetch_add(numElements, std::memory_order_relaxed);
+			_numBatches.fetch_add(1, std::memory_order_relaxed);
+
 			// Update our internal state and retire the chunk.
-			if(!emitElement) {
+			if(retireChunk) {
 				auto irqLock = frg::guard(&irqMutex());
 				auto lock = frg::guard(&_mutex);
 
 				_currentIndex = ((_currentIndex + 1) & kHeadMask);
 				_currentProgress = 0;
+				_numChunks.fetch_add(1, std::memory_order_relaxed);
 				break;
 			}
+		}
+	}
+}
 
-			// Update our internal state and retire the node.
-			{
-				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&_mutex);
-
-				_currentProgress += sizeof(ElementStruct) + length;
-				_nodeQueue.pop_front();
-
-				assert(_anyNodes.load(std::memory_order_relaxed));
-				if(_nodeQueue.empty())
-					_anyNodes.store(false, std::memory_order_relaxed);
-			}
+size_t IpcQueue::_elementLength(IpcNode *node) {
+	size_t length = 0;
+	for(auto sgSource = node->_source; sgSource; sgSource = sgSource->link)
+		length += (sgSource->size + 7) & ~size_t(7);
+	return length;
+}
 
-			node->complete();
+void IpcQueue::_updateSpinHint(QueueStruct *head) {
+	auto now = systemClockSource()->currentNanos();
+	if(_lastBatchNanos) {
+		auto gap = now - _lastBatchNanos;
+		// Exponentially weighted moving average of the gap between batches.
+		if(!_avgGapNanos) {
+			_avgGapNanos = gap;
+		}else{
+			_avgGapNanos = _avgGapNanos - (_avgGapNanos >> 3) + (gap >> 3);
 		}
 	}
+	_lastBatchNanos = now;
+
+	// Polling only pays off if the next batch is likely to arrive while the consumer polls.
+	// Consumers poll twice the average gap; if that exceeds the bound, they block immediately.
+	unsigned int hint = 0;
+	if(_avgGapNanos && 2 * _avgGapNanos <= maxSpinNanos)
+		hint = 2 * _avgGapNanos;
+	__atomic_store_n(&head->spinHint, hint, __ATOMIC_RELAXED);
+
+	_spinHint.store(hint, std::memory_order_relaxed);
+	if(hint)
+		_numSpinHints.fetch_add(1, std::memory_order_relaxed);
+}
+
+IpcQueue::Stats IpcQueue::getStats() {
+	return Stats{
+		.numElements = _numElements.load(std::memory_order_relaxed),
+		.numBatches = _numBatches.load(std::memory_order_relaxed),
+		.numChunks = _numChunks.load(std::memory_order_relaxed),
+		.numWakes = _numWakes.load(std::memory_order_relaxed),
+		.numSpinHints = _numSpinHints.load(std::memory_order_relaxed),
+		.spinHint = _spinHint.load(std::memory_order_relaxed)
+	};
 }
 
 } // namespace thor
@@ -153,8 +153,13 @@ extern "C" void thorMain() {
 		mfsRoot = frg::construct<MfsDirectory>(*kernelAlloc);
 		{
 			assert(modules[0].physicalBase % kPageSize == 0);
-			assert(modules[0].length <= 0x2000000);
-			auto base = static_cast<const char *>(KernelVirtualMemory::global().allocate(0x2000000));
+			auto image = smarter::allocate_shared<InitrdImage>(*kernelAlloc,
+					modules[0].physicalBase, modules[0].length);
+
+			// The mapping is only used to parse the CPIO headers;
+			// files are accessed through the physical pages of the image.
+			auto mappedSize = (modules[0].length + (kPageSize - 1)) & ~size_t{kPageSize - 1};
+			auto base = static_cast<const char *>(KernelVirtualMemory::global().allocate(mappedSize));
 			for(size_t pg = 0; pg < modules[0].length; pg += kPageSize)
 				KernelPageSpace::global().mapSingle4k(reinterpret_cast<VirtualAddr>(base) + pg,
 						modules[0].physicalBase + pg, 0, CachingMode::null);
@@ -247,13 +252,8 @@ extern "C" void thorMain() {
 	//				if(logInitialization)
 						infoLogger() << "thor: initrd file " << path << frg::endlog;
 
-					auto memory = smarter::allocate_shared<AllocatedMemory>(*kernelAlloc,
-							(file_size + (kPageSize - 1)) & ~size_t{kPageSize - 1});
-					memory->selfPtr = memory;
-					auto copyOutcome = KernelFiber::asyncBlockCurrent(memory->copyTo(0,
-							data, file_size,
-							thisFiber()->associatedWorkQueue()->take()));
-					assert(copyOutcome);
+					auto memory = smarter::allocate_shared<InitrdMemory>(*kernelAlloc,
+							image, data - base, file_size);
 
 					auto name = frg::string<KernelAlloc>{*kernelAlloc,
 							path.sub_string(it - path.data(), end - it)};
@@ -263,6 +263,22 @@ extern "C" void thorMain() {
 
 				p = data + ((file_size + 3) & ~uint32_t{3});
 			}
+
+			// Drop the mapping again, it is not needed after parsing.
+			for(size_t pg = 0; pg < modules[0].length; pg += kPageSize)
+				KernelPageSpace::global().unmapSingle4k(reinterpret_cast<VirtualAddr>(base) + pg);
+
+			struct Closure final : ShootNode {
+				void complete() override {
+					KernelVirtualMemory::global().deallocate(reinterpret_cast<void *>(address), size);
+					frg::destruct(*kernelAlloc, this);
+				}
+			};
+			auto closure = frg::construct<Closure>(*kernelAlloc);
+			closure->address = reinterpret_cast<VirtualAddr>(base);
+			closure->size = mappedSize;
+			if(KernelPageSpace::global().submitShootdown(closure))
+				closure->complete();
 		}
 
 		if(logInitialization)
@@ -333,6 +349,12 @@ void handlePageFault(FaultImageAccessor image, uintptr_t address, Word errorCode
 	smarter::borrowed_ptr<Thread> this_thread = getCurrentThread();
 	auto address_space = this_thread->getAddressSpace();
 
+	// Local wake-ups are processed by checkReschedule() below.
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		localScheduler()->beginDeferredPings();
+	}
+
 	const Word kPfAccess = 1;
 	const Word kPfWrite = 2;
 	const Word kPfUser = 4;
@@ -390,8 +412,10 @@ void handlePageFault(FaultImageAccessor image, uintptr_t address, Word errorCode
 
 	auto wq = this_thread->pagingWorkQueue();
 	if(Thread::asyncBlockCurrent(
-			address_space->handleFault(address, flags, wq->take()), wq))
+			address_space->handleFault(address, flags, wq->take()), wq)) {
+		Thread::checkReschedule(image);
 		return;
+	}
 
 	// If we get here, the page fault could not be handled.
 
@@ -493,6 +517,12 @@ void handleSyscall(SyscallImageAccessor image) {
 		infoLogger() << this_thread.get() << " on CPU " << cpuData->cpuIndex
 				<< " syscall #" << *image.number() << frg::endlog;
 
+	// Local wake-ups are processed by raiseSignals() when the syscall returns.
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		localScheduler()->beginDeferredPings();
+	}
+
 	// Run worklets before we run the syscall.
 	// This avoids useless FutexWait calls on IPC queues.
 	this_thread->mainWorkQueue()->run();
@@ -525,6 +555,12 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallSubmitAsyncNop: {
 		*image.error() = helSubmitAsyncNop((HelHandle)arg0, (uintptr_t)arg1);
 	} break;
+	case kHelCallEnterSubmission: {
+		unsigned int numConsumed = 0;
+		*image.error() = helEnterSubmission((HelSubmissionRing *)arg0,
+				(unsigned int)arg1, &numConsumed);
+		*image.out0() = numConsumed;
+	} break;
 
 	case kHelCallCreateUniverse: {
 		HelHandle handle;
@@ -555,6 +591,9 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallCancelAsync: {
 		*image.error() = helCancelAsync((HelHandle)arg0, (uint64_t)arg1);
 	} break;
+	case kHelCallQueryQueueStats: {
+		*image.error() = helQueryQueueStats((HelHandle)arg0, (HelQueueStats *)arg1);
+	} break;
 
 	case kHelCallAllocateMemory: {
 		HelHandle handle;
@@ -624,6 +663,12 @@ void handleSyscall(SyscallImageAccessor image) {
 		*image.error() = helSubmitSynchronizeSpace((HelHandle)arg0, (void *)arg1, (size_t)arg2,
 				(HelHandle)arg3, (uintptr_t)arg4);
 	} break;
+	case kHelCallSetHugePageScanRate: {
+		*image.error() = helSetHugePageScanRate((HelHandle)arg0, (size_t)arg1, (uint64_t)arg2);
+	} break;
+	case kHelCallQueryHugePageStats: {
+		*image.error() = helQueryHugePageStats((HelHugePageStats *)arg0);
+	} break;
 	case kHelCallPointerPhysical: {
 		uintptr_t physical;
 		*image.error() = helPointerPhysical((void *)arg0, &physical);
@@ -691,9 +736,38 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallQueryThreadStats: {
 		*image.error() = helQueryThreadStats((HelHandle)arg0, (HelThreadStats *)arg1);
 	} break;
+	case kHelCallQueryCpuStats: {
+		*image.error() = helQueryCpuStats((int)arg0, (HelCpuStats *)arg1);
+	} break;
 	case kHelCallSetPriority: {
 		*image.error() = helSetPriority((HelHandle)arg0, (int)arg1);
 	} break;
+	case kHelCallSetSchedulingPolicy: {
+		*image.error() = helSetSchedulingPolicy((HelHandle)arg0, (HelHandle)arg1,
+				(int)arg2, (int)arg3);
+	} break;
+	case kHelCallSetDeadline: {
+		*image.error() = helSetDeadline((HelHandle)arg0, (HelHandle)arg1, (uint64_t)arg2,
+				(uint64_t)arg3, (uint64_t)arg4);
+	} break;
+	case kHelCallSetRealTimeConfig: {
+		*image.error() = helSetRealTimeConfig((HelHandle)arg0, (uint64_t)arg1,
+				(uint64_t)arg2, (uint64_t)arg3);
+	} break;
+	case kHelCallCreateScheduleGroup: {
+		HelHandle handle;
+		*image.error() = helCreateScheduleGroup((HelHandle)arg0, (uint64_t)arg1,
+				(uint64_t)arg2, (uint64_t)arg3, &handle);
+		*image.out0() = handle;
+	} break;
+	case kHelCallSetScheduleGroup: {
+		*image.error() = helSetScheduleGroup((HelHandle)arg0, (HelHandle)arg1,
+				(HelHandle)arg2);
+	} break;
+	case kHelCallQueryScheduleGroupStats: {
+		*image.error() = helQueryScheduleGroupStats((HelHandle)arg0,
+				(HelScheduleGroupStats *)arg1);
+	} break;
 	case kHelCallYield: {
 		*image.error() = helYield();
 	} break;
@@ -749,9 +823,38 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallFutexWait: {
 		*image.error() = helFutexWait((int *)arg0, (int)arg1, (int64_t)arg2);
 	} break;
+	case kHelCallFutexWaitv: {
+		size_t index = 0;
+		*image.error() = helFutexWaitv((const HelFutexWaitItem *)arg0, (size_t)arg1,
+				(int64_t)arg2, &index);
+		*image.out0() = index;
+	} break;
 	case kHelCallFutexWake: {
 		*image.error() = helFutexWake((int *)arg0);
 	} break;
+	case kHelCallFutexWakeN: {
+		unsigned int numWoken = 0;
+		*image.error() = helFutexWakeN((int *)arg0, (unsigned int)arg1, &numWoken);
+		*image.out0() = numWoken;
+	} break;
+	case kHelCallFutexRequeue: {
+		unsigned int numWoken = 0;
+		*image.error() = helFutexRequeue((int *)arg0, (int *)arg1, (int)arg2,
+				(unsigned int)arg3, (unsigned int)arg4, &numWoken);
+		*image.out0() = numWoken;
+	} break;
+	case kHelCallFutexWakeOp: {
+		unsigned int numWoken = 0;
+		*image.error() = helFutexWakeOp((int *)arg0, (int *)arg1, (unsigned int)arg2,
+				(unsigned int)arg3, (uint32_t)arg4, &numWoken);
+		*image.out0() = numWoken;
+	} break;
+	case kHelCallFutexLockPi: {
+		*image.error() = helFutexLockPi((int *)arg0);
+	} break;
+	case kHelCallFutexUnlockPi: {
+		*image.error() = helFutexUnlockPi((int *)arg0);
+	} break;
 
 	case kHelCallCreateOneshotEvent: {
 		HelHandle handle;
@@ -14,6 +14,10 @@ namespace {
 	// The following flags are debugging options to debug the correctness of various components.
 	constexpr bool tortureUncaching = false;
 	constexpr bool disableUncaching = false;
+
+	// Maximal CowChain depth up to which CopyOnWriteMemory::forkRange() moves pages
+	// to a new chain instead of copying them.
+	constexpr unsigned int maxForkRangeDepth = 16;
 }
 
 // --------------------------------------------------------
@@ -150,6 +154,12 @@ struct MemoryReclaimer {
 					auto lock = frg::guard(&_mutex);
 					infoLogger() << "thor: " << (_cachedSize / 1024)
 							<< " KiB of cached pages" << frg::endlog;
+
+					auto stats = getCompressedPool()->getStats();
+					infoLogger() << "thor: " << stats.storedPages << " anonymous pages are"
+							" compressed into " << (stats.storedBytes / 1024) << " KiB ("
+							<< stats.poolPages << " pool pages, "
+							<< stats.rejectedPages << " incompressible)" << frg::endlog;
 				}
 
 				while(checkReclaim())
@@ -202,6 +212,11 @@ void MemoryView::fork(async::any_receiver<frg::tuple<Error, smarter::shared_ptr<
 	receiver.set_value({Error::illegalObject, nullptr});
 }
 
+coroutine<frg::expected<Error, smarter::shared_ptr<MemoryView>>>
+MemoryView::forkRange(uintptr_t, size_t) {
+	co_return Error::illegalObject;
+}
+
 // In addition to what copyFrom() does, we also have to mark the memory as dirty.
 coroutine<frg::expected<Error>> MemoryView::copyTo(uintptr_t offset,
 		const void *pointer, size_t size,
@@ -345,6 +360,10 @@ Error MemoryView::updateRange(ManageRequest, size_t, size_t) {
 	return Error::illegalObject;
 }
 
+coroutine<frg::expected<Error, PhysicalAddr>> MemoryView::collapseRange(uintptr_t) {
+	co_return Error::illegalObject;
+}
+
 void MemoryView::submitManage(ManageNode *) {
 	panicLogger() << "MemoryView does not support management!" << frg::endlog;
 }
@@ -590,14 +609,199 @@ size_t HardwareMemory::getLength() {
 	return _length;
 }
 
+// --------------------------------------------------------
+// InitrdImage
+// --------------------------------------------------------
+
+InitrdImage::InitrdImage(PhysicalAddr base, size_t length)
+: _base{base}, _length{length} {
+	assert(!(base % kPageSize));
+}
+
+void InitrdImage::read(uintptr_t offset, void *pointer, size_t size) {
+	assert(offset + size <= _length);
+
+	size_t progress = 0;
+	while(progress < size) {
+		auto misalign = (offset + progress) & (kPageSize - 1);
+		auto chunk = frg::min(size - progress, kPageSize - misalign);
+
+		PageAccessor accessor{_base + ((offset + progress) & ~(kPageSize - 1))};
+		memcpy(reinterpret_cast<std::byte *>(pointer) + progress,
+				reinterpret_cast<std::byte *>(accessor.get()) + misalign, chunk);
+		progress += chunk;
+	}
+}
+
+// --------------------------------------------------------
+// InitrdMemory
+// --------------------------------------------------------
+
+InitrdMemory::InitrdMemory(smarter::shared_ptr<InitrdImage> image, uintptr_t imageOffset,
+		size_t fileSize)
+: _image{std::move(image)}, _imageOffset{imageOffset}, _fileSize{fileSize},
+		_copies{*kernelAlloc} {
+	assert(imageOffset + fileSize <= _image->length());
+	auto numPages = (fileSize + kPageSize - 1) >> kPageShift;
+	_copies.resize(numPages, PhysicalAddr(-1));
+	_numPending = numPages - _numDirectPages();
+
+	if(!_fileSize)
+		_image = nullptr;
+}
+
+InitrdMemory::~InitrdMemory() {
+	for(size_t i = 0; i < _copies.size(); ++i) {
+		if(_copies[i] != PhysicalAddr(-1))
+			physicalAllocator->free(_copies[i], kPageSize);
+	}
+}
+
+size_t InitrdMemory::getLength() {
+	return _copies.size() << kPageShift;
+}
+
+frg::expected<Error, frg::tuple<smarter::shared_ptr<GlobalFutexSpace>, uintptr_t>>
+InitrdMemory::resolveGlobalFutex(uintptr_t) {
+	return Error::illegalObject;
+}
+
+coroutine<frg::expected<Error>> InitrdMemory::copyFrom(uintptr_t offset,
+		void *pointer, size_t size, smarter::shared_ptr<WorkQueue>) {
+	if(offset + size > getLength())
+		co_return Error::bufferTooSmall;
+
+	// Reading does not need to populate pages; pages that have not been copied yet
+	// are read from the image directly.
+	size_t progress = 0;
+	while(progress < size) {
+		auto index = (offset + progress) >> kPageShift;
+		auto misalign = (offset + progress) & (kPageSize - 1);
+		auto chunk = frg::min(size - progress, kPageSize - misalign);
+		auto dest = reinterpret_cast<std::byte *>(pointer) + progress;
+
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		if(_copies[index] != PhysicalAddr(-1)) {
+			PageAccessor accessor{_copies[index]};
+			memcpy(dest, reinterpret_cast<std::byte *>(accessor.get()) + misalign, chunk);
+		}else{
+			// Note that the file is zero-padded to the next page boundary.
+			auto fileOffset = offset + progress;
+			size_t inFile = 0;
+			if(fileOffset < _fileSize)
+				inFile = frg::min(chunk, _fileSize - fileOffset);
+			assert(_image || !inFile);
+			if(inFile)
+				_image->read(_imageOffset + fileOffset, dest, inFile);
+			memset(dest + inFile, 0, chunk - inFile);
+		}
+		progress += chunk;
+	}
+	co_return {};
+}
+
+Error InitrdMemory::lockRange(uintptr_t, size_t) {
+	// We never evict pages.
+	return Error::success;
+}
+
+void InitrdMemory::unlockRange(uintptr_t, size_t) {
+	// We never evict pages.
+}
+
+frg::tuple<PhysicalAddr, CachingMode> InitrdMemory::peekRange(uintptr_t offset) {
+	assert(offset % kPageSize == 0);
+	auto index = offset >> kPageShift;
+	assert(index < _copies.size());
+
+	if(index < _numDirectPages())
+		return frg::tuple<PhysicalAddr, CachingMode>{
+				_image->physicalBase() + _imageOffset + offset, CachingMode::null};
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	return frg::tuple<PhysicalAddr, CachingMode>{_copies[index], CachingMode::null};
+}
+
+coroutine<frg::expected<Error, PhysicalRange>>
+InitrdMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<WorkQueue>) {
+	assert(offset % kPageSize == 0);
+	auto index = offset >> kPageShift;
+	if(index >= _copies.size())
+		co_return Error::fault;
+
+	auto numDirect = _numDirectPages();
+	if(index < numDirect)
+		co_return PhysicalRange{_image->physicalBase() + _imageOffset + offset,
+				(numDirect - index) << kPageShift, CachingMode::null};
+
+	// Concurrent fetches of the same page can both copy it; the loser of the race below
+	// may still be reading while the winner releases _image. Hence, keep our own reference.
+	smarter::shared_ptr<InitrdImage> image;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		if(_copies[index] != PhysicalAddr(-1))
+			co_return PhysicalRange{_copies[index], kPageSize, CachingMode::null};
+		assert(_image);
+		image = _image;
+	}
+
+	// Copy the page out of the image.
+	auto physical = physicalAllocator->allocate(kPageSize);
+	if(physical == PhysicalAddr(-1))
+		co_return Error::noMemory;
+	{
+		PageAccessor accessor{physical};
+		auto inFile = frg::min(kPageSize, _fileSize - offset);
+		image->read(_imageOffset + offset, accessor.get(), inFile);
+		memset(reinterpret_cast<std::byte *>(accessor.get()) + inFile, 0, kPageSize - inFile);
+	}
+
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		if(_copies[index] != PhysicalAddr(-1)) {
+			// Another fetch won the race.
+			physicalAllocator->free(physical, kPageSize);
+			co_return PhysicalRange{_copies[index], kPageSize, CachingMode::null};
+		}
+		_copies[index] = physical;
+
+		// Directly mapped pages keep the image alive.
+		assert(_numPending);
+		if(!(--_numPending) && !_numDirectPages())
+			_image = nullptr;
+	}
+
+	co_return PhysicalRange{physical, kPageSize, CachingMode::null};
+}
+
+void InitrdMemory::markDirty(uintptr_t, size_t) {
+	// We never evict pages, there is no need to track dirty pages.
+}
+
 // --------------------------------------------------------
 // AllocatedMemory
 // --------------------------------------------------------
 
 AllocatedMemory::AllocatedMemory(size_t desiredLngth,
-		int addressBits, size_t desiredChunkSize, size_t chunkAlign)
-: _physicalChunks{*kernelAlloc},
-		_addressBits{addressBits}, _chunkAlign{chunkAlign} {
+		int addressBits, size_t desiredChunkSize, size_t chunkAlign, bool swappable)
+: AllocatedMemory{desiredLngth, addressBits, desiredChunkSize, chunkAlign,
+		swappable ? smarter::allocate_shared<AnonymousSwapBundle>(*kernelAlloc)
+				: smarter::shared_ptr<AnonymousSwapBundle>{}} { }
+
+AllocatedMemory::AllocatedMemory(size_t desiredLngth,
+		int addressBits, size_t desiredChunkSize, size_t chunkAlign,
+		smarter::shared_ptr<AnonymousSwapBundle> swap)
+: MemoryView{swap ? &swap->evictQueue : nullptr}, _physicalChunks{*kernelAlloc},
+		_addressBits{addressBits}, _chunkAlign{chunkAlign},
+		_swap{std::move(swap)}, _swapPages{*kernelAlloc} {
 	static_assert(sizeof(unsigned long) == sizeof(uint64_t), "Fix use of __builtin_clzl");
 	_chunkSize = size_t(1) << (64 - __builtin_clzl(desiredChunkSize - 1));
 	if(_chunkSize != desiredChunkSize)
@@ -614,6 +818,107 @@ AllocatedMemory::AllocatedMemory(size_t desiredLngth,
 	assert(_chunkAlign % kPageSize == 0);
 	assert(_chunkSize % _chunkAlign == 0);
 	_physicalChunks.resize(length / _chunkSize, PhysicalAddr(-1));
+
+	if(!_swap)
+		return;
+	assert(_chunkSize == kPageSize);
+	_swap->owner = this;
+
+	// Swap-out coroutine. Since it only holds a reference to the AnonymousSwapBundle,
+	// it has to check whether the AllocatedMemory is still alive after each suspension.
+	[] (smarter::shared_ptr<AnonymousSwapBundle> swap, enable_detached_coroutine = {}) -> void {
+		while(true) {
+			co_await globalReclaimer->awaitReclaim(swap.get(), swap->cancelReclaim);
+
+			size_t index;
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto swapLock = frg::guard(&swap->mutex);
+
+				auto self = swap->owner;
+				if(!self)
+					co_return;
+				auto lock = frg::guard(&self->_mutex);
+
+				auto page = globalReclaimer->reclaimPage(swap.get());
+				if(!page)
+					continue;
+
+				index = page->identity;
+				auto sit = self->_swapPages.find(index);
+				assert(sit);
+				assert(sit->state == SwapState::present);
+				assert(!sit->lockCount);
+				sit->state = SwapState::evicting;
+				globalReclaimer->removePage(&sit->cachePage);
+			}
+
+			co_await swap->evictQueue.evictRange(index << kPageShift, kPageSize);
+
+			// After eviction, no mapping can access the page anymore.
+			// Take ownership of the page while it is compressed.
+			PhysicalAddr physical;
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto swapLock = frg::guard(&swap->mutex);
+
+				auto self = swap->owner;
+				if(!self)
+					co_return;
+				auto lock = frg::guard(&self->_mutex);
+
+				auto sit = self->_swapPages.find(index);
+				assert(sit);
+				if(sit->state != SwapState::evicting)
+					continue;
+				assert(!sit->lockCount);
+				sit->state = SwapState::compressing;
+				physical = self->_physicalChunks[index];
+				assert(physical != PhysicalAddr(-1));
+			}
+
+			auto compressed = getCompressedPool()->store(physical);
+
+			bool keepCompressed = false;
+			bool freePhysical = false;
+			{
+				auto irqLock = frg::guard(&irqMutex());
+				auto swapLock = frg::guard(&swap->mutex);
+
+				// If the AllocatedMemory is gone, its destructor left the page to us.
+				if(auto self = swap->owner; self) {
+					auto lock = frg::guard(&self->_mutex);
+
+					auto sit = self->_swapPages.find(index);
+					assert(sit);
+					if(sit->state == SwapState::compressing) {
+						assert(!sit->lockCount);
+						if(compressed) {
+							sit->state = SwapState::swapped;
+							sit->compressed = *compressed;
+							self->_physicalChunks[index] = PhysicalAddr(-1);
+							keepCompressed = true;
+							freePhysical = true;
+						}else{
+							// The page is incompressible (or we are out of memory).
+							sit->state = SwapState::present;
+							globalReclaimer->addPage(&sit->cachePage);
+						}
+					}
+				}else{
+					freePhysical = true;
+				}
+			}
+
+			if(compressed && !keepCompressed)
+				getCompressedPool()->discard(*compressed);
+			if(freePhysical) {
+				if(logUncaching)
+					infoLogger() << "\e[33mSwapping out anonymous page\e[39m" << frg::endlog;
+				physicalAllocator->free(physical, kPageSize);
+			}
+		}
+	}(_swap);
 }
 
 AllocatedMemory::~AllocatedMemory() {
@@ -622,6 +927,28 @@ AllocatedMemory::~AllocatedMemory() {
 	if(logUsage)
 		infoLogger() << "thor: Releasing AllocatedMemory ("
 				<< (physicalAllocator->numUsedPages() * 4) << " KiB in use)" << frg::endlog;
+	if(_swap) {
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto swapLock = frg::guard(&_swap->mutex);
+			auto lock = frg::guard(&_mutex);
+
+			for(auto it = _swapPages.begin(); it != _swapPages.end(); ++it) {
+				if(it->state == SwapState::present) {
+					if(!it->lockCount)
+						globalReclaimer->removePage(&it->cachePage);
+				}else if(it->state == SwapState::compressing) {
+					// The swap-out coroutine frees this page.
+					_physicalChunks[it->cachePage.identity] = PhysicalAddr(-1);
+				}else if(it->state == SwapState::swapped) {
+					getCompressedPool()->discard(it->compressed);
+				}
+			}
+
+			_swap->owner = nullptr;
+		}
+		_swap->cancelReclaim.cancel();
+	}
 	for(size_t i = 0; i < _physicalChunks.size(); ++i) {
 		if(_physicalChunks[i] != PhysicalAddr(-1))
 			physicalAllocator->free(_physicalChunks[i], _chunkSize);
@@ -650,13 +977,59 @@ AllocatedMemory::resolveGlobalFutex(uintptr_t offset) {
 	return frg::make_tuple(std::move(futexSpace), offset);
 }
 
-Error AllocatedMemory::lockRange(uintptr_t, size_t) {
-	// For now, we do not evict "anonymous" memory. TODO: Implement eviction here.
+// Note: Neither offset nor size are necessarily multiples of the page size.
+Error AllocatedMemory::lockRange(uintptr_t offset, size_t size) {
+	// Non-swappable memory is never evicted.
+	if(!_swap)
+		return Error::success;
+
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	auto endIndex = (offset + size + kPageSize - 1) >> kPageShift;
+	if(endIndex > _physicalChunks.size())
+		return Error::bufferTooSmall;
+
+	for(size_t index = offset >> kPageShift; index < endIndex; ++index) {
+		auto [sit, wasInserted] = _swapPages.find_or_insert(index, _swap.get(), index);
+		assert(sit);
+		if(sit->lockCount++)
+			continue;
+		if(sit->state == SwapState::present) {
+			globalReclaimer->removePage(&sit->cachePage);
+		}else if(sit->state == SwapState::evicting
+				|| sit->state == SwapState::compressing
+				|| sit->state == SwapState::migrating) {
+			// Stop the swap-out (or migration) to keep the page present.
+			sit->state = SwapState::present;
+		}
+	}
 	return Error::success;
 }
 
-void AllocatedMemory::unlockRange(uintptr_t, size_t) {
-	// For now, we do not evict "anonymous" memory. TODO: Implement eviction here.
+// Note: Neither offset nor size are necessarily multiples of the page size.
+void AllocatedMemory::unlockRange(uintptr_t offset, size_t size) {
+	if(!_swap)
+		return;
+
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	auto endIndex = (offset + size + kPageSize - 1) >> kPageShift;
+	assert(endIndex <= _physicalChunks.size());
+
+	for(size_t index = offset >> kPageShift; index < endIndex; ++index) {
+		auto sit = _swapPages.find(index);
+		assert(sit);
+		assert(sit->lockCount > 0);
+		if(--sit->lockCount)
+			continue;
+		if(sit->state == SwapState::present)
+			globalReclaimer->addPage(&sit->cachePage);
+		assert(sit->state != SwapState::evicting);
+		assert(sit->state != SwapState::compressing);
+		assert(sit->state != SwapState::migrating);
+	}
 }
 
 frg::tuple<PhysicalAddr, CachingMode> AllocatedMemory::peekRange(uintptr_t offset) {
@@ -669,6 +1042,18 @@ frg::tuple<PhysicalAddr, CachingMode> AllocatedMemory::peekRange(uintptr_t offse
 	auto disp = offset & (_chunkSize - 1);
 	assert(index < _physicalChunks.size());
 
+	if(_swap) {
+		auto sit = _swapPages.find(index);
+		if(sit && (sit->state == SwapState::evicting
+				|| sit->state == SwapState::compressing
+				|| sit->state == SwapState::migrating)) {
+			// Cancel the swap-out (or migration) -- the page is still needed.
+			assert(!sit->lockCount);
+			sit->state = SwapState::present;
+			globalReclaimer->addPage(&sit->cachePage);
+		}
+	}
+
 	if(_physicalChunks[index] == PhysicalAddr(-1))
 		return frg::tuple<PhysicalAddr, CachingMode>{PhysicalAddr(-1), CachingMode::null};
 	return frg::tuple<PhysicalAddr, CachingMode>{_physicalChunks[index] + disp,
@@ -677,13 +1062,34 @@ frg::tuple<PhysicalAddr, CachingMode> AllocatedMemory::peekRange(uintptr_t offse
 
 coroutine<frg::expected<Error, PhysicalRange>>
 AllocatedMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<WorkQueue>) {
+	auto index = offset / _chunkSize;
+	auto disp = offset & (_chunkSize - 1);
+
+	if(_swap) {
+		while(true) {
+			co_await _loadCompressed(index);
+
+			auto irq_lock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			assert(index < _physicalChunks.size());
+			auto [sit, wasInserted] = _swapPages.find_or_insert(index, _swap.get(), index);
+			assert(sit);
+			// The page might have been swapped out again in the meantime.
+			if(sit->state == SwapState::swapped || sit->state == SwapState::loading)
+				continue;
+			_swapIn(index, sit);
+
+			assert(_physicalChunks[index] != PhysicalAddr(-1));
+			co_return PhysicalRange{_physicalChunks[index] + disp, _chunkSize - disp,
+					CachingMode::null};
+		}
+	}
+
 	auto irq_lock = frg::guard(&irqMutex());
 	auto lock = frg::guard(&_mutex);
 
-	auto index = offset / _chunkSize;
-	auto disp = offset & (_chunkSize - 1);
 	assert(index < _physicalChunks.size());
-
 	if(_physicalChunks[index] == PhysicalAddr(-1)) {
 		auto physical = physicalAllocator->allocate(_chunkSize, _addressBits);
 		assert(physical != PhysicalAddr(-1) && "OOM");
@@ -700,10 +1106,256 @@ AllocatedMemory::fetchRange(uintptr_t offset, FetchFlags, smarter::shared_ptr<Wo
 	co_return PhysicalRange{_physicalChunks[index] + disp, _chunkSize - disp, CachingMode::null};
 }
 
+coroutine<void> AllocatedMemory::_loadCompressed(size_t index) {
+	while(true) {
+		CompressedPool::Handle compressed;
+		bool mustWait = false;
+		{
+			auto irq_lock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			auto sit = _swapPages.find(index);
+			if(!sit)
+				co_return;
+			if(sit->state == SwapState::loading) {
+				mustWait = true;
+			}else if(sit->state == SwapState::swapped) {
+				sit->state = SwapState::loading;
+				compressed = sit->compressed;
+			}else{
+				co_return;
+			}
+		}
+
+		// Another fetch is already decompressing the page.
+		if(mustWait) {
+			co_await _loadEvent.async_wait_if([&] () -> bool {
+				auto irq_lock = frg::guard(&irqMutex());
+				auto lock = frg::guard(&_mutex);
+
+				auto sit = _swapPages.find(index);
+				assert(sit);
+				return sit->state == SwapState::loading;
+			});
+			continue;
+		}
+
+		// Since the page is in the loading state, nobody else touches the object.
+		auto physical = physicalAllocator->allocate(kPageSize, _addressBits);
+		assert(physical != PhysicalAddr(-1) && "OOM");
+		getCompressedPool()->load(compressed, physical);
+
+		{
+			auto irq_lock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			auto sit = _swapPages.find(index);
+			assert(sit);
+			assert(sit->state == SwapState::loading);
+			sit->compressed = {};
+
+			assert(_physicalChunks[index] == PhysicalAddr(-1));
+			_physicalChunks[index] = physical;
+			sit->state = SwapState::present;
+			if(!sit->lockCount)
+				globalReclaimer->addPage(&sit->cachePage);
+		}
+
+		getCompressedPool()->discard(compressed);
+		_loadEvent.raise();
+		co_return;
+	}
+}
+
+void AllocatedMemory::_swapIn(size_t index, SwapPage *sit) {
+	switch(sit->state) {
+	case SwapState::present:
+		if(!sit->lockCount)
+			globalReclaimer->bumpPage(&sit->cachePage);
+		return;
+	case SwapState::evicting:
+	case SwapState::compressing:
+	case SwapState::migrating:
+		// Cancel the swap-out (or migration) -- the page is still needed.
+		assert(!sit->lockCount);
+		sit->state = SwapState::present;
+		globalReclaimer->addPage(&sit->cachePage);
+		return;
+	case SwapState::missing:
+		break;
+	case SwapState::loading:
+	case SwapState::swapped:
+		// Handled by _loadCompressed().
+		assert(!"Compressed page in _swapIn()");
+		return;
+	}
+
+	auto physical = physicalAllocator->allocate(kPageSize, _addressBits);
+	assert(physical != PhysicalAddr(-1) && "OOM");
+
+	PageAccessor accessor{physical};
+	memset(accessor.get(), 0, kPageSize);
+
+	assert(_physicalChunks[index] == PhysicalAddr(-1));
+	_physicalChunks[index] = physical;
+	sit->state = SwapState::present;
+	if(!sit->lockCount)
+		globalReclaimer->addPage(&sit->cachePage);
+}
+
 void AllocatedMemory::markDirty(uintptr_t, size_t) {
 	// Do nothing for now.
 }
 
+coroutine<frg::expected<Error, PhysicalAddr>> AllocatedMemory::collapseRange(uintptr_t offset) {
+	assert(!(offset & (kHugePageSize - 1)));
+	constexpr size_t numPages = kHugePageSize / kPageSize;
+
+	// Memory that is allocated in large chunks is already contiguous.
+	if(_chunkSize >= kHugePageSize) {
+		auto irq_lock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		auto index = offset / _chunkSize;
+		if(index >= _physicalChunks.size())
+			co_return Error::outOfBounds;
+		if(_physicalChunks[index] == PhysicalAddr(-1))
+			co_return Error::fault;
+		auto physical = _physicalChunks[index] + (offset & (_chunkSize - 1));
+		if(physical & (kHugePageSize - 1))
+			co_return Error::illegalObject;
+		co_return physical;
+	}
+
+	// We can only migrate pages if we can evict them from all mappings.
+	// Also, only swappable memory tracks locked pages (which must not move, e.g., due to DMA).
+	if(!_swap)
+		co_return Error::illegalObject;
+	assert(_chunkSize == kPageSize);
+
+	auto baseIndex = offset >> kPageShift;
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		if(baseIndex + numPages > _physicalChunks.size())
+			co_return Error::outOfBounds;
+
+		bool contiguous = !(_physicalChunks[baseIndex] & (kHugePageSize - 1));
+		for(size_t i = 0; i < numPages; ++i) {
+			auto sit = _swapPages.find(baseIndex + i);
+			if(!sit || sit->state != SwapState::present)
+				co_return Error::fault;
+			// Locked pages can be accessed through their physical address (e.g., by DMA).
+			if(sit->lockCount)
+				co_return Error::illegalState;
+			if(_physicalChunks[baseIndex + i] != _physicalChunks[baseIndex] + i * kPageSize)
+				contiguous = false;
+		}
+		if(contiguous)
+			co_return _physicalChunks[baseIndex];
+	}
+
+	// Do not allocate huge pages if that would immediately trigger reclaim.
+	if(physicalAllocator->numFreePages() < physicalAllocator->numTotalPages() / 4)
+		co_return Error::noMemory;
+	auto block = physicalAllocator->allocate(kHugePageSize, _addressBits);
+	if(block == PhysicalAddr(-1))
+		co_return Error::noMemory;
+	assert(!(block & (kHugePageSize - 1)));
+	// The pages of the block are freed (e.g., by the swap-out coroutine) individually.
+	physicalAllocator->split(block, kHugePageSize);
+
+	auto freeBlock = [&] {
+		for(size_t i = 0; i < numPages; ++i)
+			physicalAllocator->free(block + i * kPageSize, kPageSize);
+	};
+
+	// Take the pages away from the reclaimer. Similar to the swap-out coroutine,
+	// we then evict the pages from all mappings; any access cancels the migration.
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		for(size_t i = 0; i < numPages; ++i) {
+			auto sit = _swapPages.find(baseIndex + i);
+			assert(sit);
+			if(sit->state != SwapState::present || sit->lockCount) {
+				// Undo the migration of all previous pages.
+				for(size_t j = 0; j < i; ++j) {
+					auto other = _swapPages.find(baseIndex + j);
+					other->state = SwapState::present;
+					globalReclaimer->addPage(&other->cachePage);
+				}
+				freeBlock();
+				co_return Error::cancelled;
+			}
+			sit->state = SwapState::migrating;
+			globalReclaimer->removePage(&sit->cachePage);
+		}
+	}
+
+	co_await _swap->evictQueue.evictRange(offset, kHugePageSize);
+
+	bool cancelled = false;
+	for(size_t i = 0; i < numPages; ++i) {
+		PhysicalAddr source;
+		{
+			auto irq_lock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			auto sit = _swapPages.find(baseIndex + i);
+			assert(sit);
+			if(sit->state != SwapState::migrating) {
+				cancelled = true;
+				break;
+			}
+			source = _physicalChunks[baseIndex + i];
+		}
+
+		PageAccessor sourceAccessor{source};
+		PageAccessor destAccessor{block + i * kPageSize};
+		memcpy(destAccessor.get(), sourceAccessor.get(), kPageSize);
+	}
+
+	{
+		auto irq_lock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		// Accesses during the copy cancel the migration; we only commit if there were none.
+		if(!cancelled) {
+			for(size_t i = 0; i < numPages; ++i) {
+				auto sit = _swapPages.find(baseIndex + i);
+				assert(sit);
+				if(sit->state != SwapState::migrating) {
+					cancelled = true;
+					break;
+				}
+			}
+		}
+
+		for(size_t i = 0; i < numPages; ++i) {
+			auto sit = _swapPages.find(baseIndex + i);
+			assert(sit);
+			if(sit->state != SwapState::migrating)
+				continue;
+			assert(!sit->lockCount);
+			if(!cancelled) {
+				physicalAllocator->free(_physicalChunks[baseIndex + i], kPageSize);
+				_physicalChunks[baseIndex + i] = block + i * kPageSize;
+			}
+			sit->state = SwapState::present;
+			globalReclaimer->addPage(&sit->cachePage);
+		}
+	}
+
+	if(cancelled) {
+		freeBlock();
+		co_return Error::cancelled;
+	}
+	co_return block;
+}
+
 size_t AllocatedMemory::getLength() {
 	auto irq_lock = frg::guard(&irqMutex());
 	auto lock = frg::guard(&_mutex);
@@ -713,13 +1365,27 @@ size_t AllocatedMemory::getLength() {
 
 coroutine<frg::expected<Error, PhysicalAddr>> AllocatedMemory::takeGlobalFutex(uintptr_t offset,
 		smarter::shared_ptr<WorkQueue> wq) {
+	// Swappable pages must not be evicted while the futex is in use.
+	if(_swap) {
+		auto lockError = lockRange(offset & ~(kPageSize - 1), kPageSize);
+		if(lockError != Error::success)
+			co_return Error::fault;
+	}
 	// TODO: This could be optimized further (by avoiding the coroutine call).
-	auto range = FRG_CO_TRY(co_await fetchRange(offset & ~(kPageSize - 1), 0, wq));
+	auto rangeOrError = co_await fetchRange(offset & ~(kPageSize - 1), 0, wq);
+	if(!rangeOrError) {
+		if(_swap)
+			unlockRange(offset & ~(kPageSize - 1), kPageSize);
+		co_return rangeOrError.error();
+	}
+	auto range = rangeOrError.value();
 	assert(range.get<0>() != PhysicalAddr(-1));
 	co_return range.get<0>();
 }
 
-void AllocatedMemory::retireGlobalFutex(uintptr_t) {
+void AllocatedMemory::retireGlobalFutex(uintptr_t offset) {
+	if(_swap)
+		unlockRange(offset & ~(kPageSize - 1), kPageSize);
 }
 
 // --------------------------------------------------------
@@ -1539,6 +2205,84 @@ void CopyOnWriteMemory::fork(async::any_receiver<frg::tuple<Error, smarter::shar
 	}(this, std::move(forked), receiver));
 }
 
+coroutine<frg::expected<Error, smarter::shared_ptr<MemoryView>>>
+CopyOnWriteMemory::forkRange(uintptr_t offset, size_t size) {
+	assert(!(offset & (kPageSize - 1)));
+	assert(!(size & (kPageSize - 1)));
+	if(!size || offset + size > _length)
+		co_return Error::illegalArgs;
+
+	// Unlike fork(), this only touches pages in the range. Pages that we do not own
+	// (or that are still being copied) are looked up through the shared chain.
+	// Owned pages are moved to a new chain that is shared with the forked view.
+	// As each call adds a chain to this view, we copy eagerly instead of
+	// moving once the chain gets too deep (so that lookups stay bounded).
+	smarter::shared_ptr<CopyOnWriteMemory> forked;
+	bool movedPages = false;
+	Error error = Error::success;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		bool copyPages = _copyChain && _copyChain->_depth >= maxForkRangeDepth;
+
+		// Only add a new chain if we actually move pages to it.
+		if(!copyPages) {
+			for(size_t pg = 0; pg < size; pg += kPageSize) {
+				auto osIt = _ownedPages.find((offset + pg) >> kPageShift);
+				if(osIt && osIt->state == CowState::hasCopy && !osIt->lockCount) {
+					_copyChain = smarter::allocate_shared<CowChain>(*kernelAlloc, _copyChain);
+					movedPages = true;
+					break;
+				}
+			}
+		}
+
+		forked = smarter::allocate_shared<CopyOnWriteMemory>(*kernelAlloc,
+				_view, _viewOffset + offset, size, _copyChain);
+		forked->selfPtr = forked;
+
+		for(size_t pg = 0; pg < size; pg += kPageSize) {
+			auto osIt = _ownedPages.find((offset + pg) >> kPageShift);
+			if(!osIt || osIt->state != CowState::hasCopy)
+				continue;
+
+			if(osIt->lockCount || copyPages) {
+				auto copyPhysical = physicalAllocator->allocate(kPageSize);
+				if(copyPhysical == PhysicalAddr(-1)) {
+					error = Error::noMemory;
+					break;
+				}
+
+				// We own the page and hold _mutex, so we can just copy it synchronously.
+				PageAccessor ownedAccessor{osIt->physical};
+				PageAccessor copyAccessor{copyPhysical};
+				memcpy(copyAccessor.get(), ownedAccessor.get(), kPageSize);
+
+				auto fsIt = forked->_ownedPages.insert(pg >> kPageShift);
+				fsIt->state = CowState::hasCopy;
+				fsIt->physical = copyPhysical;
+			}else{
+				assert(movedPages);
+				auto physical = osIt->physical;
+				assert(physical != PhysicalAddr(-1));
+
+				auto pageOffset = _viewOffset + offset + pg;
+				auto newIt = _copyChain->_pages.insert(pageOffset >> kPageShift,
+						PhysicalAddr(-1));
+				_ownedPages.erase((offset + pg) >> kPageShift);
+				newIt->store(physical, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	if(movedPages)
+		co_await _evictQueue.evictRange(offset, size);
+	if(error != Error::success)
+		co_return error;
+	co_return std::move(forked);
+}
+
 Error CopyOnWriteMemory::lockRange(uintptr_t, size_t) {
 	panicLogger() << "CopyOnWriteMemory does not support synchronous lockRange()"
 			<< frg::endlog;
@@ -114,4 +114,25 @@ void PhysicalChunkAllocator::free(PhysicalAddr address, size_t size) {
 	assert(!"Physical page is not part of any region");
 }
 
+void PhysicalChunkAllocator::split(PhysicalAddr address, size_t size) {
+	auto irq_lock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	int target = 0;
+	while(size > (size_t(kPageSize) << target))
+		target++;
+
+	for(int i = 0; i < _numRegions; i++) {
+		if(address < _allRegions[i].physicalBase)
+			continue;
+		if(address + size - _allRegions[i].physicalBase > _allRegions[i].regionSize)
+			continue;
+
+		_allRegions[i].buddyAccessor.split(address, target);
+		return;
+	}
+
+	assert(!"Physical page is not part of any region");
+}
+
 } // namespace thor
@@ -0,0 +1,251 @@
+#include <string.h>
+
+#include <thor-internal/pi-futex.hpp>
+#include <thor-internal/thread.hpp>
+
+namespace thor {
+
+namespace {
+	constexpr bool logPiFutex = false;
+}
+
+uint32_t PiFutexRealm::tidOf(Thread *thread) {
+	// The TID is the lower part of the thread ID that is stored in the credentials.
+	// User space obtains it from helGetCredentials().
+	uint64_t id;
+	memcpy(&id, thread->credentials() + 8, sizeof(uint64_t));
+	return id & ownerMask;
+}
+
+PiFutexRealm::PiFutexRealm()
+: _owners{frg::hash<uint32_t>{}, *kernelAlloc} { }
+
+void PiFutexRealm::registerThread(Thread *thread) {
+	auto owner = frg::construct<Owner>(*kernelAlloc);
+	owner->thread = thread;
+	owner->tid = tidOf(thread);
+	owner->inheritedPriority = ScheduleEntity::noInheritedPriority;
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	// TIDs only wrap around after 2^30 threads. If the TID is still in use,
+	// the new thread cannot use PI futexes (lock() fails with illegalState).
+	if(_owners.get(owner->tid)) {
+		infoLogger() << "thor: PI futex TID " << owner->tid << " is already in use"
+				<< frg::endlog;
+		frg::destruct(*kernelAlloc, owner);
+		return;
+	}
+	_owners.insert(owner->tid, owner);
+}
+
+void PiFutexRealm::releaseThread(Thread *thread) {
+	WaiterList granted;
+	Owner *owner;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		owner = _findOwner(thread);
+		if(!owner)
+			return;
+		// Threads only terminate when they are not blocked inside the kernel.
+		assert(!owner->blockedOn);
+		_owners.remove(owner->tid);
+
+		// Pass all locks that the thread holds on to blocked threads.
+		while(!owner->waiters.empty()) {
+			auto id = owner->waiters.front()->id;
+			if(logPiFutex)
+				infoLogger() << "thor: Owner of PI futex " << (void *)id.localAddress
+						<< " died" << frg::endlog;
+			auto waiter = _handOver(owner, id, ownerDiedBit);
+			assert(waiter);
+			granted.push_back(waiter);
+		}
+	}
+
+	while(!granted.empty()) {
+		auto waiter = granted.pop_front();
+		waiter->granted.raise();
+	}
+	frg::destruct(*kernelAlloc, owner);
+}
+
+Error PiFutexRealm::lock(GlobalFutex &futex) {
+	auto thisThread = getCurrentThread();
+
+	Waiter waiter;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		auto self = _findOwner(thisThread.get());
+		if(!self)
+			return Error::illegalState;
+
+		while(true) {
+			// Either take the lock or tell the owner to unlock through the kernel.
+			uint32_t ownerTid;
+			futex.update([&] (unsigned int word) -> unsigned int {
+				ownerTid = word & ownerMask;
+				if(!ownerTid)
+					return self->tid | (word & ownerDiedBit);
+				if(ownerTid == self->tid)
+					return word;
+				return word | waitersBit;
+			});
+			if(!ownerTid)
+				return Error::success;
+			if(ownerTid == self->tid)
+				return Error::illegalState;
+
+			auto owner = _owners.get(ownerTid);
+			if(!owner) {
+				// The owner terminated before it entered the kernel. Take over the lock.
+				bool tookOver = false;
+				futex.update([&] (unsigned int word) -> unsigned int {
+					tookOver = (word & ownerMask) == ownerTid;
+					if(!tookOver)
+						return word;
+					return self->tid | ownerDiedBit;
+				});
+				if(tookOver)
+					return Error::success;
+				continue;
+			}
+
+			waiter.id = futex.getIdentity();
+			waiter.futex = &futex;
+			waiter.self = self;
+			waiter.owner = *owner;
+			waiter.priority = effectivePriority_(self);
+			(*owner)->waiters.push_back(&waiter);
+			self->blockedOn = &waiter;
+
+			_propagate(*owner);
+			break;
+		}
+	}
+
+	// Once the waiter is granted the lock, the futex word already contains our TID.
+	Thread::asyncBlockCurrent(waiter.granted.wait());
+	return Error::success;
+}
+
+Error PiFutexRealm::unlock(GlobalFutex &futex) {
+	auto thisThread = getCurrentThread();
+
+	Waiter *next;
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		auto self = _findOwner(thisThread.get());
+		if(!self)
+			return Error::illegalState;
+		if((futex.read() & ownerMask) != self->tid)
+			return Error::illegalState;
+
+		next = _handOver(self, futex.getIdentity(), 0);
+		if(!next)
+			futex.update([] (unsigned int) -> unsigned int { return 0; });
+
+		// Drop the priority that we inherited from the waiters of this futex.
+		_propagate(self);
+	}
+
+	if(next)
+		next->granted.raise();
+	return Error::success;
+}
+
+PiFutexRealm::Owner *PiFutexRealm::_findOwner(Thread *thread) {
+	auto owner = _owners.get(tidOf(thread));
+	if(!owner || (*owner)->thread != thread)
+		return nullptr;
+	return *owner;
+}
+
+int PiFutexRealm::effectivePriority_(Owner *owner) {
+	auto priority = owner->thread->basePriority();
+	if(priority < owner->inheritedPriority)
+		return owner->inheritedPriority;
+	return priority;
+}
+
+PiFutexRealm::Waiter *PiFutexRealm::_handOver(Owner *owner, FutexIdentity id,
+		unsigned int extraBits) {
+	// Among waiters of equal priority, prefer the one that blocked first.
+	Waiter *best = nullptr;
+	for(auto waiter : owner->waiters) {
+		if(waiter->id != id)
+			continue;
+		if(!best || waiter->priority > best->priority)
+			best = waiter;
+	}
+	if(!best)
+		return nullptr;
+
+	owner->waiters.erase(owner->waiters.iterator_to(best));
+	auto next = best->self;
+	assert(next->blockedOn == best);
+	next->blockedOn = nullptr;
+
+	// The remaining waiters now boost the new owner.
+	bool haveWaiters = false;
+	auto it = owner->waiters.begin();
+	while(it != owner->waiters.end()) {
+		auto waiter = *it;
+		++it;
+		if(waiter->id != id)
+			continue;
+		owner->waiters.erase(owner->waiters.iterator_to(waiter));
+		waiter->owner = next;
+		next->waiters.push_back(waiter);
+		haveWaiters = true;
+	}
+
+	best->futex->update([&] (unsigned int) -> unsigned int {
+		return next->tid | extraBits | (haveWaiters ? waitersBit : 0);
+	});
+
+	_propagate(next);
+	return best;
+}
+
+void PiFutexRealm::_propagate(Owner *owner) {
+	for(int depth = 0; depth < maxChainDepth; depth++) {
+		int priority = ScheduleEntity::noInheritedPriority;
+		for(auto waiter : owner->waiters) {
+			if(waiter->priority > priority)
+				priority = waiter->priority;
+		}
+		if(priority == owner->inheritedPriority)
+			return;
+
+		if(logPiFutex)
+			infoLogger() << "thor: PI futex owner " << owner->tid
+					<< " inherits priority " << priority << frg::endlog;
+		owner->inheritedPriority = priority;
+		Scheduler::setInheritedPriority(owner->thread, priority);
+
+		// If the owner is blocked itself, pass the change on to the next owner.
+		auto waiter = owner->blockedOn;
+		if(!waiter)
+			return;
+		waiter->priority = effectivePriority_(owner);
+		owner = waiter->owner;
+	}
+}
+
+namespace {
+	frg::eternal<PiFutexRealm> globalPiFutexRealm;
+}
+
+PiFutexRealm *getPiFutexRealm() {
+	return &globalPiFutexRealm.get();
+}
+
+} // namespace thor
@@ -0,0 +1,125 @@
+#include <async/recurring-event.hpp>
+#include <frg/manual_box.hpp>
+#include <thor-internal/fiber.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/rcu.hpp>
+#include <thor-internal/timer.hpp>
+
+namespace thor {
+
+namespace {
+	constexpr bool logRcu = false;
+
+	// Readers are short (they run with IRQs disabled); poll at a high frequency.
+	constexpr uint64_t gracePollInterval = 100'000;
+}
+
+// Start at 1; an rcuEpoch of zero in CpuData means that the CPU is not reading.
+std::atomic<uint64_t> globalRcuEpoch{1};
+
+namespace {
+
+struct RcuReclaimer {
+	void retire(RcuCallback *callback) {
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			// Readers that observe the incremented epoch started after the object was unlinked.
+			callback->epoch = globalRcuEpoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+			_pending.push_back(callback);
+		}
+		_event.raise();
+	}
+
+	void runFiber() {
+		KernelFiber::run([this] {
+			while(true) {
+				KernelFiber::asyncBlockCurrent(_event.async_wait_if([this] () -> bool {
+					auto irqLock = frg::guard(&irqMutex());
+					auto lock = frg::guard(&_mutex);
+
+					return _pending.empty();
+				}));
+
+				while(true) {
+					auto minEpoch = _oldestReader();
+
+					CallbackList done;
+					{
+						auto irqLock = frg::guard(&irqMutex());
+						auto lock = frg::guard(&_mutex);
+
+						// Callbacks are queued in epoch order.
+						while(!_pending.empty() && _pending.front()->epoch <= minEpoch)
+							done.push_back(_pending.pop_front());
+					}
+
+					size_t n = 0;
+					while(!done.empty()) {
+						done.pop_front()->reclaim();
+						++n;
+					}
+					if(logRcu && n)
+						infoLogger() << "thor: RCU reclaimed " << n << " objects" << frg::endlog;
+
+					{
+						auto irqLock = frg::guard(&irqMutex());
+						auto lock = frg::guard(&_mutex);
+
+						if(_pending.empty())
+							break;
+					}
+					KernelFiber::asyncBlockCurrent(
+							generalTimerEngine()->sleepFor(gracePollInterval));
+				}
+			}
+		});
+	}
+
+private:
+	using CallbackList = frg::intrusive_list<
+		RcuCallback,
+		frg::locate_member<
+			RcuCallback,
+			frg::default_list_hook<RcuCallback>,
+			&RcuCallback::hook
+		>
+	>;
+
+	// Returns the oldest epoch that is still observed by some reader.
+	uint64_t _oldestReader() {
+		// Pairs with the fence in RcuReadGuard: either we see the reader's epoch or
+		// the reader sees the data structure after the object was unlinked.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		auto minEpoch = globalRcuEpoch.load(std::memory_order_seq_cst);
+		for(int i = 0; i < getCpuCount(); ++i) {
+			auto epoch = getCpuData(i)->rcuEpoch.load(std::memory_order_seq_cst);
+			if(epoch && epoch < minEpoch)
+				minEpoch = epoch;
+		}
+		return minEpoch;
+	}
+
+	frg::ticket_spinlock _mutex;
+	CallbackList _pending;
+	async::recurring_event _event;
+};
+
+// Objects can be retired before the fiber runs; they are reclaimed once it starts.
+frg::eternal<RcuReclaimer> globalRcuReclaimer;
+
+initgraph::Task initRcu{&globalInitEngine, "generic.init-rcu",
+	initgraph::Requires{getFibersAvailableStage()},
+	[] {
+		globalRcuReclaimer.get().runFiber();
+	}
+};
+
+} // anonymous namespace
+
+void rcuRetire(RcuCallback *callback) {
+	globalRcuReclaimer.get().retire(callback);
+}
+
+} // namespace thor
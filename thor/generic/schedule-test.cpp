@@ -0,0 +1,137 @@
+#include <async/oneshot-event.hpp>
+#include <frg/string.hpp>
+#include <thor-internal/arch/cpu.hpp>
+#include <thor-internal/debug.hpp>
+#include <thor-internal/fiber.hpp>
+#include <thor-internal/main.hpp>
+#include <thor-internal/schedule.hpp>
+#include <thor-internal/timer.hpp>
+
+namespace thor {
+
+extern frg::manual_box<frg::string<KernelAlloc>> kernelCommandLine;
+
+namespace {
+	// Debugging option: run synthetic periodic deadline fibers during boot and
+	// check the deadline miss and budget overrun counters.
+	// Can also be enabled by passing thor.test-deadlines on the kernel command line.
+	constexpr bool testDeadlines = false;
+
+	bool wantDeadlineTest() {
+		if(testDeadlines)
+			return true;
+
+		frg::string_view cmdline{kernelCommandLine->data(), kernelCommandLine->size()};
+		size_t i = 0;
+		while(i < cmdline.size()) {
+			size_t n = 0;
+			while(i + n < cmdline.size() && cmdline[i + n] != ' ')
+				n++;
+			if(cmdline.sub_string(i, n) == "thor.test-deadlines")
+				return true;
+			i += n + 1;
+		}
+		return false;
+	}
+
+	// Number of periods that each test fiber runs for.
+	constexpr int numTestPeriods = 50;
+
+	struct DeadlineTestCase {
+		const char *name;
+		DeadlineParameters params;
+		// Time (in ns) that the fiber busy-waits in each period.
+		uint64_t work;
+		// Whether the fiber is expected to overrun its budget.
+		bool overruns;
+
+		uint64_t misses = 0;
+		uint64_t numOverruns = 0;
+		async::oneshot_event done;
+	};
+
+	void busyWait(uint64_t nanos) {
+		auto start = systemClockSource()->currentNanos();
+		while(systemClockSource()->currentNanos() - start < nanos)
+			pause();
+	}
+
+	void runDeadlineTest() {
+		// The total bandwidth (45%) fits onto a single CPU.
+		DeadlineTestCase cases[] = {
+			{
+				.name = "short",
+				.params = {.runtime = 2'000'000, .deadline = 10'000'000, .period = 10'000'000},
+				.work = 1'000'000,
+				.overruns = false
+			},
+			{
+				.name = "constrained",
+				.params = {.runtime = 3'000'000, .deadline = 10'000'000, .period = 20'000'000},
+				.work = 1'000'000,
+				.overruns = false
+			},
+			{
+				.name = "overrunning",
+				.params = {.runtime = 1'000'000, .deadline = 10'000'000, .period = 10'000'000},
+				.work = 3'000'000,
+				.overruns = true
+			}
+		};
+
+		for(auto &testCase : cases) {
+			auto fiber = KernelFiber::post([tc = &testCase] {
+				auto periodStart = systemClockSource()->currentNanos();
+				for(int i = 0; i < numTestPeriods; ++i) {
+					busyWait(tc->work);
+					periodStart += tc->params.period;
+					KernelFiber::asyncBlockCurrent(generalTimerEngine()->sleep(periodStart));
+				}
+
+				tc->misses = thisFiber()->numDeadlineMisses();
+				tc->numOverruns = thisFiber()->numBudgetOverruns();
+
+				// Exiting fibers are never destructed; release the reservation explicitly.
+				Scheduler::setPolicy(thisFiber(), SchedulePolicy::fair, 0);
+				tc->done.raise();
+			});
+			if(!Scheduler::setDeadline(fiber, testCase.params))
+				panicLogger() << "thor: Deadline self-test could not reserve bandwidth for "
+						<< testCase.name << frg::endlog;
+			Scheduler::resume(fiber);
+		}
+
+		bool failed = false;
+		for(auto &testCase : cases) {
+			KernelFiber::asyncBlockCurrent(testCase.done.wait());
+
+			infoLogger() << "thor: Deadline self-test " << testCase.name << ": "
+					<< testCase.misses << " deadline misses, "
+					<< testCase.numOverruns << " budget overruns" << frg::endlog;
+			// Overruns are demoted before they can miss their deadlines,
+			// hence no test case should miss a deadline.
+			if(testCase.misses)
+				failed = true;
+			if(testCase.overruns != (testCase.numOverruns > 0))
+				failed = true;
+		}
+
+		if(failed)
+			panicLogger() << "thor: Deadline self-test failed" << frg::endlog;
+		infoLogger() << "thor: Deadline self-test passed" << frg::endlog;
+	}
+}
+
+static initgraph::Task testDeadlineScheduling{&globalInitEngine, "generic.test-deadline-scheduling",
+	initgraph::Requires{getFibersAvailableStage()},
+	[] {
+		if(!wantDeadlineTest())
+			return;
+		// The test blocks, hence it needs its own fiber.
+		KernelFiber::run([] {
+			runDeadlineTest();
+		});
+	}
+};
+
+} // namespace thor
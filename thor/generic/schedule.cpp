@@ -13,12 +13,42 @@ namespace {
 	constexpr bool logNextBest = false;
 	constexpr bool logUpdates = false;
 	constexpr bool logIdle = false;
+	constexpr bool logBalancing = false;
+	constexpr bool logPings = false;
+	constexpr bool logRealTime = false;
+	constexpr bool logGroups = false;
 
 	constexpr bool disablePreemption = false;
 
 	// Minimum length of a preemption time slice in ns.
 	constexpr int64_t sliceGranularity = 10'000'000;
 
+	// Interval of the periodic load balancer in ns.
+	constexpr uint64_t balanceInterval = 100'000'000;
+
+	// Number of waiting entities that the balancer inspects to find a migratable one.
+	constexpr int maxMigrationCandidates = 4;
+
+	// Time in ns that an idle CPU polls for work before it halts.
+	// Polling happens with IRQs disabled, hence this needs to be short.
+	constexpr uint64_t idlePollTime = 20'000;
+
+	// Parameters of the real-time class; see Scheduler::RealTimeConfig.
+	// The defaults match Linux (100 ms RR quantum, 950 ms per 1 s RT bandwidth).
+	std::atomic<uint64_t> rrQuantum{100'000'000};
+	std::atomic<uint64_t> rtRuntime{950'000'000};
+	std::atomic<uint64_t> rtPeriod{1'000'000'000};
+
+	// Bandwidth is stored as a fixed point fraction of the CPU.
+	constexpr int bandwidthShift = 20;
+
+	// Deadline entities may reserve at most 95% of each CPU.
+	constexpr uint64_t dlBandwidthLimit = (uint64_t{95} << bandwidthShift) / 100;
+
+	// Upper bound for periods of deadline entities (about 4 s).
+	// This ensures that the products in the CBS wake-up rule do not overflow.
+	constexpr uint64_t maxDeadlinePeriod = uint64_t{1} << 32;
+
 	struct IdleTask final : ScheduleEntity {
 		IdleTask()
 		: ScheduleEntity{ScheduleType::idle} { }
@@ -27,14 +57,14 @@ namespace {
 			runOnStack([] (Continuation) {
 				if(logIdle)
 					infoLogger() << "System is idle" << frg::endlog;
-				suspendSelf();
-				__builtin_trap();
+				localScheduler()->runIdle();
 			}, getCpuData()->idleStack.base());
 			__builtin_trap();
 		}
 
 		void handlePreemption(IrqImageAccessor image) override {
 			localScheduler()->update();
+			localScheduler()->balance();
 			if(localScheduler()->maybeReschedule()) {
 				runOnStack([] (Continuation cont, IrqImageAccessor image) {
 					scrubStack(image, cont);
@@ -52,7 +82,7 @@ namespace {
 int ScheduleEntity::orderPriority(const ScheduleEntity *a, const ScheduleEntity *b) {
 	assert(a->type() == ScheduleType::regular);
 	assert(b->type() == ScheduleType::regular);
-	return b->priority - a->priority; // Prefer larger priority.
+	return b->effectivePriority_() - a->effectivePriority_(); // Prefer larger priority.
 }
 
 bool ScheduleEntity::scheduleBefore(const ScheduleEntity *a, const ScheduleEntity *b) {
@@ -63,20 +93,119 @@ bool ScheduleEntity::scheduleBefore(const ScheduleEntity *a, const ScheduleEntit
 }
 
 ScheduleEntity::ScheduleEntity(ScheduleType type)
-: type_{type}, state{ScheduleState::null}, priority{0}, _refClock{0}, _runTime{0},
-		refProgress{0}, baseUnfairness{0} { }
+: type_{type}, state{ScheduleState::null}, priority{0},
+		inheritedPriority{noInheritedPriority}, requestedInheritance{noInheritedPriority},
+		inheritanceQueued{false}, policy_{SchedulePolicy::fair}, rtPriority_{0},
+		requestedPolicy{SchedulePolicy::fair}, requestedRtPriority{0}, requestedDlParams{},
+		policyQueued{false}, rrTimeLeft{0}, dlParams_{}, dlAbsDeadline{0}, dlBudget{0},
+		dlDemoted{false}, dlReplenishAt{0}, dlReserved{0}, groupQueued{false},
+		groupThrottled{false}, queuedWeight{0},
+		_refClock{0}, _runTime{0}, _numMigrations{0}, _numDeadlineMisses{0},
+		_numBudgetOverruns{0}, refProgress{0}, baseUnfairness{0} { }
 
 ScheduleEntity::~ScheduleEntity() {
 	assert(state == ScheduleState::null);
 }
 
+ScheduleGroup::ScheduleGroup(uint64_t weight, uint64_t quota, uint64_t period)
+: _weight{weight}, _quota{quota}, _period{period} {
+	assert(weight && weight <= maxWeight);
+	assert(!quota || period);
+}
+
+ScheduleGroup::Stats ScheduleGroup::getStats() {
+	return Stats{
+		.usage = _usage.load(std::memory_order_relaxed),
+		.throttles = _numThrottles.load(std::memory_order_relaxed)
+	};
+}
+
+void ScheduleGroup::_charge(uint64_t now, uint64_t runtime) {
+	_usage.fetch_add(runtime, std::memory_order_relaxed);
+	if(!_quota)
+		return;
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	_refresh(now);
+	bool wasThrottled = _consumed >= _quota;
+	_consumed += runtime;
+	if(!wasThrottled && _consumed >= _quota)
+		_numThrottles.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool ScheduleGroup::_isThrottled(uint64_t now) {
+	if(!_quota)
+		return false;
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	_refresh(now);
+	return _consumed >= _quota;
+}
+
+uint64_t ScheduleGroup::_quotaLeft(uint64_t now) {
+	assert(_quota);
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	_refresh(now);
+	if(_consumed >= _quota)
+		return 0;
+	return _quota - _consumed;
+}
+
+void ScheduleGroup::_refresh(uint64_t now) {
+	auto index = now / _period;
+	if(index == _periodIndex)
+		return;
+	_periodIndex = index;
+	_consumed = 0;
+}
+
+ScheduleEntity *RtRunQueue::top() {
+	assert(_bitmap);
+	int prio = 63 - __builtin_clzll(_bitmap);
+	return _lists[prio].front();
+}
+
+void RtRunQueue::pushBack(ScheduleEntity *entity) {
+	auto prio = entity->rtPriority_;
+	_lists[prio].push_back(entity);
+	_bitmap |= uint64_t{1} << prio;
+}
+
+void RtRunQueue::pushFront(ScheduleEntity *entity) {
+	auto prio = entity->rtPriority_;
+	_lists[prio].push_front(entity);
+	_bitmap |= uint64_t{1} << prio;
+}
+
+void RtRunQueue::remove(ScheduleEntity *entity) {
+	auto prio = entity->rtPriority_;
+	_lists[prio].erase(_lists[prio].iterator_to(entity));
+	if(_lists[prio].empty())
+		_bitmap &= ~(uint64_t{1} << prio);
+}
+
 void Scheduler::associate(ScheduleEntity *entity, Scheduler *scheduler) {
 	assert(entity->type() == ScheduleType::regular);
 
 //	infoLogger() << "associate " << entity << frg::endlog;
+	auto irqLock = frg::guard(&irqMutex());
+	auto associationLock = frg::guard(&entity->_associationMutex);
+
 	assert(entity->state == ScheduleState::null);
 	entity->_scheduler = scheduler;
 	entity->state = ScheduleState::attached;
+
+	// Reservations move along with the entity. Since admission control is only done
+	// by setDeadline(), explicit migrations can overcommit the new CPU.
+	if(entity->dlReserved)
+		scheduler->_dlBandwidth.fetch_add(entity->dlReserved, std::memory_order_relaxed);
 }
 
 void Scheduler::unassociate(ScheduleEntity *entity) {
@@ -84,16 +213,53 @@ void Scheduler::unassociate(ScheduleEntity *entity) {
 
 	// TODO: This is only really need to assert against _current.
 	auto irqLock = frg::guard(&irqMutex());
+	auto associationLock = frg::guard(&entity->_associationMutex);
 
 	auto self = entity->_scheduler;
 	assert(self);
 
 	assert(entity->state == ScheduleState::attached);
 	assert(entity != self->_current);
+
+	// The entity is not in the wait queue, hence we can apply pending changes directly.
+	{
+		auto lock = frg::guard(&self->_mutex);
+
+		if(entity->inheritanceQueued) {
+			self->_inheritanceList.erase(self->_inheritanceList.iterator_to(entity));
+			entity->inheritedPriority = entity->requestedInheritance;
+			entity->inheritanceQueued = false;
+		}
+
+		if(entity->groupQueued) {
+			self->_groupList.erase(self->_groupList.iterator_to(entity));
+			entity->_group = std::move(entity->requestedGroup);
+			entity->groupQueued = false;
+		}
+
+		if(entity->policyQueued) {
+			self->_policyList.erase(self->_policyList.iterator_to(entity));
+			self->_applyPolicy(entity, entity->requestedPolicy, entity->requestedRtPriority,
+					entity->requestedDlParams);
+			entity->policyQueued = false;
+		}
+	}
+
+	if(entity->dlReserved)
+		self->_dlBandwidth.fetch_sub(entity->dlReserved, std::memory_order_relaxed);
 	entity->_scheduler = nullptr;
 	entity->state = ScheduleState::null;
 }
 
+void Scheduler::migrate(ScheduleEntity *entity, Scheduler *scheduler) {
+	if(entity->_scheduler == scheduler)
+		return;
+
+	unassociate(entity);
+	associate(entity, scheduler);
+	entity->_numMigrations++;
+}
+
 void Scheduler::setPriority(ScheduleEntity *entity, int priority) {
 	assert(entity->type() == ScheduleType::regular);
 
@@ -108,6 +274,186 @@ void Scheduler::setPriority(ScheduleEntity *entity, int priority) {
 	entity->priority = priority;
 }
 
+void Scheduler::setInheritedPriority(ScheduleEntity *entity, int priority) {
+	assert(entity->type() == ScheduleType::regular);
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto associationLock = frg::guard(&entity->_associationMutex);
+
+	// Entities without a scheduler are not part of any wait queue.
+	auto self = entity->_scheduler;
+	if(!self) {
+		entity->inheritedPriority = priority;
+		return;
+	}
+
+	bool wasEmpty;
+	{
+		auto lock = frg::guard(&self->_mutex);
+
+		entity->requestedInheritance = priority;
+		if(entity->inheritanceQueued)
+			return;
+		entity->inheritanceQueued = true;
+
+		wasEmpty = self->_inheritanceList.empty();
+		self->_inheritanceList.push_back(entity);
+	}
+
+	if(wasEmpty)
+		self->_notify();
+}
+
+void Scheduler::setPolicy(ScheduleEntity *entity, SchedulePolicy policy, int rtPriority) {
+	assert(entity->type() == ScheduleType::regular);
+	assert(rtPriority >= 0 && rtPriority < ScheduleEntity::numRtPriorities);
+	assert(policy != SchedulePolicy::deadline);
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto associationLock = frg::guard(&entity->_associationMutex);
+
+	// Give up the reservation of deadline entities.
+	if(entity->dlReserved) {
+		if(entity->_scheduler)
+			entity->_scheduler->_dlBandwidth.fetch_sub(entity->dlReserved,
+					std::memory_order_relaxed);
+		entity->dlReserved = 0;
+	}
+
+	_requestPolicy(entity, policy, rtPriority, {});
+}
+
+void Scheduler::setGroup(ScheduleEntity *entity, smarter::shared_ptr<ScheduleGroup> group) {
+	assert(entity->type() == ScheduleType::regular);
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto associationLock = frg::guard(&entity->_associationMutex);
+
+	// Entities without a scheduler are not part of any wait queue.
+	auto self = entity->_scheduler;
+	if(!self) {
+		entity->_group = std::move(group);
+		return;
+	}
+
+	bool wasEmpty;
+	{
+		auto lock = frg::guard(&self->_mutex);
+
+		entity->requestedGroup = std::move(group);
+		if(entity->groupQueued)
+			return;
+		entity->groupQueued = true;
+
+		wasEmpty = self->_groupList.empty();
+		self->_groupList.push_back(entity);
+	}
+
+	if(wasEmpty)
+		self->_notify();
+}
+
+smarter::shared_ptr<ScheduleGroup> Scheduler::getGroup(ScheduleEntity *entity) {
+	assert(entity->type() == ScheduleType::regular);
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto associationLock = frg::guard(&entity->_associationMutex);
+
+	auto self = entity->_scheduler;
+	if(!self)
+		return entity->_group;
+
+	auto lock = frg::guard(&self->_mutex);
+	if(entity->groupQueued)
+		return entity->requestedGroup;
+	return entity->_group;
+}
+
+bool Scheduler::setDeadline(ScheduleEntity *entity, DeadlineParameters params) {
+	assert(entity->type() == ScheduleType::regular);
+
+	if(!params.runtime || params.runtime > params.deadline || params.deadline > params.period
+			|| params.period > maxDeadlinePeriod)
+		return false;
+	uint64_t bandwidth = (params.runtime << bandwidthShift) / params.period;
+	if(!bandwidth)
+		bandwidth = 1;
+
+	auto irqLock = frg::guard(&irqMutex());
+	auto associationLock = frg::guard(&entity->_associationMutex);
+
+	// Admission control: replace the entity's old reservation by the new one.
+	if(auto self = entity->_scheduler; self) {
+		auto total = self->_dlBandwidth.load(std::memory_order_relaxed);
+		do {
+			if(total - entity->dlReserved + bandwidth > dlBandwidthLimit) {
+				if(logRealTime)
+					infoLogger() << "thor: Rejecting deadline reservation on CPU "
+							<< self->_cpuContext->cpuIndex << frg::endlog;
+				return false;
+			}
+		} while(!self->_dlBandwidth.compare_exchange_weak(total,
+				total - entity->dlReserved + bandwidth, std::memory_order_relaxed));
+	}
+	entity->dlReserved = bandwidth;
+
+	_requestPolicy(entity, SchedulePolicy::deadline, 0, params);
+	return true;
+}
+
+void Scheduler::_requestPolicy(ScheduleEntity *entity, SchedulePolicy policy, int rtPriority,
+		DeadlineParameters dlParams) {
+	// Entities without a scheduler are not part of any run queue.
+	// Deadline entities get their first deadline once they are resumed.
+	auto self = entity->_scheduler;
+	if(!self) {
+		entity->policy_ = policy;
+		entity->rtPriority_ = rtPriority;
+		entity->dlParams_ = dlParams;
+		entity->rrTimeLeft = rrQuantum.load(std::memory_order_relaxed);
+		entity->dlAbsDeadline = 0;
+		entity->dlBudget = 0;
+		entity->dlDemoted = false;
+		return;
+	}
+
+	bool wasEmpty;
+	{
+		auto lock = frg::guard(&self->_mutex);
+
+		entity->requestedPolicy = policy;
+		entity->requestedRtPriority = rtPriority;
+		entity->requestedDlParams = dlParams;
+		if(entity->policyQueued)
+			return;
+		entity->policyQueued = true;
+
+		wasEmpty = self->_policyList.empty();
+		self->_policyList.push_back(entity);
+	}
+
+	if(wasEmpty)
+		self->_notify();
+}
+
+Scheduler::RealTimeConfig Scheduler::getRealTimeConfig() {
+	return RealTimeConfig{
+		.rrQuantum = rrQuantum.load(std::memory_order_relaxed),
+		.rtRuntime = rtRuntime.load(std::memory_order_relaxed),
+		.rtPeriod = rtPeriod.load(std::memory_order_relaxed)
+	};
+}
+
+void Scheduler::setRealTimeConfig(RealTimeConfig config) {
+	assert(config.rrQuantum);
+	assert(config.rtRuntime && config.rtRuntime < config.rtPeriod);
+
+	// Schedulers pick up the new values in update().
+	rrQuantum.store(config.rrQuantum, std::memory_order_relaxed);
+	rtRuntime.store(config.rtRuntime, std::memory_order_relaxed);
+	rtPeriod.store(config.rtPeriod, std::memory_order_relaxed);
+}
+
 void Scheduler::resume(ScheduleEntity *entity) {
 	assert(entity->type() == ScheduleType::regular);
 
@@ -117,9 +463,12 @@ void Scheduler::resume(ScheduleEntity *entity) {
 	auto self = entity->_scheduler;
 	assert(self);
 	assert(entity != self->_current);
+
+	// Keep IRQs disabled such that _notify() can check for the local scheduler.
+	auto irqLock = frg::guard(&irqMutex());
+
 	bool wasEmpty;
 	{
-		auto irqLock = frg::guard(&irqMutex());
 		auto lock = frg::guard(&self->_mutex);
 
 		entity->state = ScheduleState::pending;
@@ -128,13 +477,62 @@ void Scheduler::resume(ScheduleEntity *entity) {
 		self->_pendingList.push_back(entity);
 	}
 
-	if(wasEmpty) {
-		if(self == &getCpuData()->scheduler) {
-			sendPingIpi(self->_cpuContext->cpuIndex);
-		}else{
-			sendPingIpi(self->_cpuContext->cpuIndex);
+	if(wasEmpty)
+		self->_notify();
+}
+
+void Scheduler::resumeWithHandoff(ScheduleEntity *entity) {
+	assert(entity->type() == ScheduleType::regular);
+	assert(!intsAreEnabled());
+
+	// Only hand off if the entity runs as soon as the current entity blocks.
+	// Otherwise, moving it to this CPU would only increase its latency.
+	// The counters of waiting entities are only updated by update(), hence we also
+	// check for entities that were resumed since then (including earlier handoffs).
+	auto self = localScheduler();
+	// Deadline entities stay on the CPU where their bandwidth is reserved.
+	bool mayHandoff = self->_handoffWindow && !self->_handoff
+			&& self->_current && self->_current->type() == ScheduleType::regular
+			&& !self->_numWaiting && !self->_numRtWaiting && !self->_numDlWaiting
+			&& entity->policy() != SchedulePolicy::deadline;
+	if(mayHandoff) {
+		auto lock = frg::guard(&self->_mutex);
+		mayHandoff = self->_pendingList.empty();
+	}
+	if(!mayHandoff) {
+		resumeNear(entity);
+		return;
+	}
+
+	migrate(entity, self);
+
+	if(logScheduling)
+		infoLogger() << "thor: Handing off from " << self->_current
+				<< " to " << entity << frg::endlog;
+
+	self->_handoff = entity;
+	self->_handoffDonor = self->_current;
+	resume(entity);
+}
+
+void Scheduler::resumeNear(ScheduleEntity *entity) {
+	assert(entity->type() == ScheduleType::regular);
+	assert(!intsAreEnabled());
+
+	// Deadline entities stay on the CPU where their bandwidth is reserved.
+	if(entity->policy() != SchedulePolicy::deadline) {
+		auto self = localScheduler();
+		auto target = self->_selectWakeTarget(entity);
+		if(target != entity->_scheduler) {
+			if(logBalancing)
+				infoLogger() << "thor: Waking " << entity << " on CPU "
+						<< target->_cpuContext->cpuIndex << frg::endlog;
+			migrate(entity, target);
+			self->_numAffineWakeups.fetch_add(1, std::memory_order_relaxed);
 		}
 	}
+
+	resume(entity);
 }
 
 void Scheduler::suspendCurrent() {
@@ -149,6 +547,12 @@ void Scheduler::suspendCurrent() {
 	// Update the unfairness on suspend.
 	self->_updateEntityStats(entity);
 	entity->state = ScheduleState::attached;
+	if(entity->_group)
+		entity->_group->_numActive.fetch_sub(1, std::memory_order_relaxed);
+
+	// Demoted entities that are not active are replenished by _activateDeadline().
+	if(entity->policy_ == SchedulePolicy::deadline && entity->dlDemoted)
+		self->_dlReplenishQueue.remove(entity);
 
 	self->_current = nullptr;
 }
@@ -162,7 +566,9 @@ Progress Scheduler::_liveUnfairness(const ScheduleEntity *entity) {
 
 	auto delta_progress = _systemProgress - entity->refProgress;
 	if(entity == _current) {
-		return entity->baseUnfairness - _numWaiting * delta_progress;
+		return entity->baseUnfairness
+				- static_cast<Progress>(_waitingWeight) * delta_progress
+					/ static_cast<Progress>(entity->weight());
 	}else{
 		return entity->baseUnfairness + delta_progress;
 	}
@@ -180,27 +586,40 @@ int64_t Scheduler::_liveRuntime(const ScheduleEntity *entity) {
 }
 
 void Scheduler::update() {
-	// Returns the reciprocal in 0.8 fixed point format.
-	auto fixedInverse = [] (uint32_t x) -> uint32_t {
-		assert(x < (1 << 6));
-		return static_cast<uint32_t>(1 << 8) / x;
-	};
-
 	assert(_current);
 
-	// Number of waiting/running threads.
-	auto n = _numWaiting;
-	if(_current->type() == ScheduleType::regular)
-		n++;
+	// Total weight of waiting/running threads of the fair class.
+	auto totalWeight = _waitingWeight;
+	if(_current->type() == ScheduleType::regular && _current->isFair())
+		totalWeight += _current->weight();
 
+	// Progress is in 55.8 fixed point format and relative to the default weight.
 	assert(haveTimer());
 	auto now = systemClockSource()->currentNanos();
 	auto deltaTime = now - _refClock;
 	_refClock = now;
-	if(n)
-		_systemProgress += deltaTime * fixedInverse(n);
+	if(totalWeight)
+		_systemProgress += (deltaTime << 8) * ScheduleGroup::defaultWeight / totalWeight;
 
 	_updateCurrentEntity();
+	_updateEntityStats(_current);
+
+	if(_current->type() == ScheduleType::regular && _current->isRealTime()) {
+		_rtRuntime += deltaTime;
+		if(_current->policy_ == SchedulePolicy::roundRobin)
+			_current->rrTimeLeft -= deltaTime;
+	}
+	_updateRtBandwidth();
+
+	if(_current->type() == ScheduleType::regular && _current->isDeadline()) {
+		_current->dlBudget -= deltaTime;
+		_checkDeadline(_current);
+	}
+	_replenishDeadlines();
+
+	// We process all pending work below. Clear the flag before taking _mutex
+	// such that concurrent resume() calls set it again.
+	_needsReschedule.store(false, std::memory_order_relaxed);
 
 	// Finally, process all pending entities.
 	frg::intrusive_list<
@@ -225,10 +644,123 @@ void Scheduler::update() {
 		entity->refProgress = _systemProgress;
 		entity->_refClock = _refClock;
 		entity->state = ScheduleState::active;
+		if(entity->_group)
+			entity->_group->_numActive.fetch_add(1, std::memory_order_relaxed);
+
+		if(entity->policy_ == SchedulePolicy::deadline)
+			_activateDeadline(entity);
+
+		// Donate the unfairness of the entity that handed off to this one.
+		// Once the donor blocks, the entity thus runs next (unless other entities were
+		// resumed in the meantime). As the entity never gets more unfairness than the
+		// donor had, it cannot overtake entities that the donor would not have overtaken.
+		if(entity == _handoff) {
+			if(_current == _handoffDonor && _current->state == ScheduleState::active
+					&& _current->isFair() && entity->isFair()) {
+				auto donated = _liveUnfairness(_current);
+				if(entity->baseUnfairness < donated)
+					entity->baseUnfairness = donated;
+			}
+			_handoff = nullptr;
+			_handoffDonor = nullptr;
+		}
 
-		_waitQueue.push(entity);
-		_numWaiting++;
+		_enqueue(entity, false);
 	}
+
+	// Apply changes to inherited priorities.
+	// Since the wait queue is ordered by priority, queued entities need to be re-inserted.
+	{
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		while(!_inheritanceList.empty()) {
+			auto entity = _inheritanceList.pop_front();
+			entity->inheritanceQueued = false;
+
+			// Only the order of _waitQueue depends on the inherited priority.
+			bool inQueue = entity->state == ScheduleState::active
+					&& entity != _current && entity != _scheduled
+					&& entity->isFair() && !entity->groupThrottled;
+			if(inQueue)
+				_waitQueue.remove(entity);
+			entity->inheritedPriority = entity->requestedInheritance;
+			if(inQueue)
+				_waitQueue.push(entity);
+		}
+
+		while(!_policyList.empty()) {
+			auto entity = _policyList.pop_front();
+			entity->policyQueued = false;
+
+			bool inQueue = entity->state == ScheduleState::active
+					&& entity != _current && entity != _scheduled;
+			if(inQueue)
+				_dequeue(entity);
+			_applyPolicy(entity, entity->requestedPolicy, entity->requestedRtPriority,
+					entity->requestedDlParams);
+			if(inQueue)
+				_enqueue(entity, false);
+		}
+
+		// Since _waitingWeight includes the weight of waiting entities,
+		// they need to be re-inserted when their group changes.
+		while(!_groupList.empty()) {
+			auto entity = _groupList.pop_front();
+			entity->groupQueued = false;
+
+			bool inQueue = entity->state == ScheduleState::active
+					&& entity != _current && entity != _scheduled;
+			if(inQueue) {
+				_dequeue(entity);
+				if(entity->isFair())
+					_updateWaitingEntity(entity);
+			}
+			if(entity->state == ScheduleState::active) {
+				if(entity->_group)
+					entity->_group->_numActive.fetch_sub(1, std::memory_order_relaxed);
+				if(entity->requestedGroup)
+					entity->requestedGroup->_numActive.fetch_add(1, std::memory_order_relaxed);
+			}
+			entity->_group = std::move(entity->requestedGroup);
+			if(inQueue)
+				_enqueue(entity, false);
+		}
+	}
+
+	_unthrottleGroups();
+
+	_publishLoad();
+}
+
+void Scheduler::balance() {
+	assert(!intsAreEnabled());
+
+	// Serve idle CPUs first. The request is stale if the CPU found work in the meantime.
+	if(auto requester = _stealRequest.exchange(nullptr, std::memory_order_acq_rel); requester) {
+		if(!requester->_load.load(std::memory_order_relaxed))
+			_pushTo(requester);
+	}
+
+	if(_refClock < _balanceDeadline)
+		return;
+	_balanceDeadline = _refClock + balanceInterval;
+
+	auto load = _load.load(std::memory_order_relaxed);
+	Scheduler *idlest = nullptr;
+	size_t idlestLoad = load;
+	for(int i = 0; i < getCpuCount(); i++) {
+		auto other = &getCpuData(i)->scheduler;
+		auto otherLoad = other->_load.load(std::memory_order_relaxed);
+		if(otherLoad < idlestLoad) {
+			idlest = other;
+			idlestLoad = otherLoad;
+		}
+	}
+
+	// Moving a single entity only improves the balance if the difference is at least two.
+	if(idlest && load - idlestLoad >= 2)
+		_pushTo(idlest);
 }
 
 bool Scheduler::maybeReschedule() {
@@ -238,7 +770,11 @@ bool Scheduler::maybeReschedule() {
 	auto wantToSchedule = [this] () -> bool {
 		// If there are no waiters, we keep the current entity.
 		// Otherwise, if the current entity is not active anymore, we always switch.
-		if(_waitQueue.empty())
+		// Entities of throttled groups stop running even if nothing else is runnable.
+		if(_current->type() == ScheduleType::regular && _isThrottled(_current))
+			return true;
+
+		if(_waitQueue.empty() && _rtQueue.empty() && _dlQueue.empty())
 			return false;
 
 		if(_current->type() == ScheduleType::idle)
@@ -246,6 +782,36 @@ bool Scheduler::maybeReschedule() {
 		assert(_current->type() == ScheduleType::regular);
 		assert(_current->state == ScheduleState::active);
 
+		// Deadline entities are scheduled earliest-deadline-first and preempt all others.
+		if(_current->isDeadline()) {
+			if(_dlQueue.empty())
+				return false;
+			return _dlQueue.top()->dlAbsDeadline < _current->dlAbsDeadline;
+		}
+		if(!_dlQueue.empty())
+			return true;
+
+		if(_current->isRealTime()) {
+			// If the real-time class is throttled, fair entities run first.
+			if(_rtThrottled && !_waitQueue.empty())
+				return true;
+			if(_rtQueue.empty())
+				return false;
+
+			// Switch based on real-time priority, then round-robin among equal priorities.
+			auto next = _rtQueue.top();
+			if(next->rtPriority_ != _current->rtPriority_)
+				return next->rtPriority_ > _current->rtPriority_;
+			return _current->policy_ == SchedulePolicy::roundRobin
+					&& _current->rrTimeLeft <= 0;
+		}
+
+		// Real-time entities always preempt fair entities (unless they are throttled).
+		if(!_rtQueue.empty() && !_rtThrottled)
+			return true;
+		if(_waitQueue.empty())
+			return false;
+
 		// Switch based on entity priority.
 		if(auto po = ScheduleEntity::orderPriority(_current, _waitQueue.top()); po > 0) {
 			return true;
@@ -262,7 +828,7 @@ bool Scheduler::maybeReschedule() {
 	if(!wantToSchedule())
 		return false;
 
-	_unschedule();
+	_unschedule(true);
 	_schedule();
 	return true;
 }
@@ -270,8 +836,9 @@ bool Scheduler::maybeReschedule() {
 void Scheduler::forceReschedule() {
 	assert(!intsAreEnabled());
 
+	// If the current entity is still active, it yields.
 	if(_current)
-		_unschedule();
+		_unschedule(false);
 	_schedule();
 }
 
@@ -282,6 +849,18 @@ void Scheduler::forceReschedule() {
 	_current = _scheduled;
 	_scheduled = nullptr;
 	_sliceClock = _refClock;
+	_publishLoad();
+
+	// Entities may have been resumed locally after update() (e.g., while switching).
+	// Since the new entity does not necessarily check the flag, fall back to an IPI.
+	// The same applies to wake-ups that raced with the end of monitored idling.
+	_deferLocalPings = false;
+	if(_idlePolling.load(std::memory_order_relaxed))
+		_idlePolling.store(false, std::memory_order_seq_cst);
+	if(_needsReschedule.load(std::memory_order_seq_cst)) {
+		_numSentPings.fetch_add(1, std::memory_order_relaxed);
+		sendPingIpi(_cpuContext->cpuIndex);
+	}
 
 	if(!preemptionIsArmed())
 		_updatePreemption();
@@ -299,17 +878,15 @@ ScheduleEntity *Scheduler::currentRunnable() {
 	return _current;
 }
 
-void Scheduler::_unschedule() {
+void Scheduler::_unschedule(bool preempted) {
 	assert(_current);
 
 	// Decrease the unfairness at the end of the time slice.
 	_updateEntityStats(_current);
 
 	if(_current->type() == ScheduleType::regular
-			|| _current->state == ScheduleState::active) {
-		_waitQueue.push(_current);
-		_numWaiting++;
-	}
+			|| _current->state == ScheduleState::active)
+		_enqueue(_current, preempted);
 
 	_current = nullptr;
 }
@@ -318,20 +895,46 @@ void Scheduler::_schedule() {
 	assert(!_current);
 	assert(!_scheduled);
 
-	if(_waitQueue.empty()) {
-		if(logScheduling)
-			infoLogger() << "No entities to schedule" << frg::endlog;
-		_scheduled = &globalIdleTask.get();
-		return;
-	}
-
-	auto entity = _waitQueue.top();
-	_waitQueue.pop();
-	_numWaiting--;
+	ScheduleEntity *entity = nullptr;
+	while(!entity) {
+		if(_waitQueue.empty() && _rtQueue.empty() && _dlQueue.empty()) {
+			if(logScheduling)
+				infoLogger() << "No entities to schedule" << frg::endlog;
+			_scheduled = &globalIdleTask.get();
+			_requestWork();
+			return;
+		}
 
-	// Increase the unfairness at the start of the time slice.
-	assert(entity->state == ScheduleState::active);
-	_updateWaitingEntity(entity);
+		if(!_dlQueue.empty()) {
+			entity = _dlQueue.top();
+			_dlQueue.pop();
+			_numDlWaiting--;
+			assert(entity->state == ScheduleState::active);
+			_checkDeadline(entity);
+		}else if(!_rtQueue.empty() && (!_rtThrottled || _waitQueue.empty())) {
+			entity = _rtQueue.top();
+			_rtQueue.remove(entity);
+			_numRtWaiting--;
+			assert(entity->state == ScheduleState::active);
+		}else{
+			auto candidate = _waitQueue.top();
+			_waitQueue.pop();
+			_numWaiting--;
+			_waitingWeight -= candidate->queuedWeight;
+
+			// Increase the unfairness at the start of the time slice.
+			assert(candidate->state == ScheduleState::active);
+			_updateWaitingEntity(candidate);
+
+			// The group may have been throttled by other CPUs while the entity was waiting.
+			if(_isThrottled(candidate)) {
+				candidate->groupThrottled = true;
+				_throttledList.push_back(candidate);
+				continue;
+			}
+			entity = candidate;
+		}
+	}
 	_updateEntityStats(entity);
 
 	if(logScheduling) {
@@ -351,29 +954,453 @@ void Scheduler::_schedule() {
 	_scheduled = entity;
 }
 
+void Scheduler::_enqueue(ScheduleEntity *entity, bool preempted) {
+	assert(entity->state == ScheduleState::active);
+
+	if(entity->isDeadline()) {
+		_dlQueue.push(entity);
+		_numDlWaiting++;
+		return;
+	}
+
+	if(entity->isFair()) {
+		if(_isThrottled(entity)) {
+			entity->groupThrottled = true;
+			_throttledList.push_back(entity);
+			return;
+		}
+		_waitQueue.push(entity);
+		_numWaiting++;
+		entity->queuedWeight = entity->weight();
+		_waitingWeight += entity->queuedWeight;
+		return;
+	}
+
+	// Entities that used up their quantum go to the end of their priority's list.
+	if(entity->policy_ == SchedulePolicy::roundRobin && entity->rrTimeLeft <= 0) {
+		entity->rrTimeLeft = rrQuantum.load(std::memory_order_relaxed);
+		_rtQueue.pushBack(entity);
+	}else if(preempted) {
+		_rtQueue.pushFront(entity);
+	}else{
+		_rtQueue.pushBack(entity);
+	}
+	_numRtWaiting++;
+}
+
+void Scheduler::_dequeue(ScheduleEntity *entity) {
+	if(entity->isDeadline()) {
+		_dlQueue.remove(entity);
+		_numDlWaiting--;
+	}else if(entity->isRealTime()) {
+		_rtQueue.remove(entity);
+		_numRtWaiting--;
+	}else if(entity->groupThrottled) {
+		// Throttled entities do not accumulate unfairness; see _unthrottleGroups().
+		_throttledList.erase(_throttledList.iterator_to(entity));
+		entity->groupThrottled = false;
+		entity->refProgress = _systemProgress;
+	}else{
+		_waitQueue.remove(entity);
+		_numWaiting--;
+		_waitingWeight -= entity->queuedWeight;
+	}
+}
+
+void Scheduler::_applyPolicy(ScheduleEntity *entity, SchedulePolicy policy, int rtPriority,
+		DeadlineParameters dlParams) {
+	if(logRealTime)
+		infoLogger() << "thor: Entity " << entity << " changes policy to "
+				<< static_cast<int>(policy) << " (real-time priority " << rtPriority << ")"
+				<< frg::endlog;
+
+	// Unfairness is not tracked while entities are real-time. When they return
+	// to the fair class, start over such that they neither get a bonus nor a penalty.
+	if(!entity->isFair() && policy == SchedulePolicy::fair) {
+		entity->refProgress = _systemProgress;
+		entity->baseUnfairness = 0;
+	}
+
+	if(entity->policy_ == SchedulePolicy::deadline && entity->dlDemoted) {
+		if(entity->state == ScheduleState::active)
+			_dlReplenishQueue.remove(entity);
+		entity->dlDemoted = false;
+	}
+
+	entity->policy_ = policy;
+	entity->rtPriority_ = rtPriority;
+	entity->rrTimeLeft = rrQuantum.load(std::memory_order_relaxed);
+
+	// Start the first period immediately.
+	entity->dlParams_ = dlParams;
+	entity->dlAbsDeadline = _refClock + dlParams.deadline;
+	entity->dlBudget = dlParams.runtime;
+}
+
+void Scheduler::_activateDeadline(ScheduleEntity *entity) {
+	assert(entity->policy_ == SchedulePolicy::deadline);
+	auto &params = entity->dlParams_;
+
+	if(entity->dlDemoted) {
+		if(_refClock < entity->dlReplenishAt) {
+			_dlReplenishQueue.push(entity);
+			return;
+		}
+		entity->dlDemoted = false;
+		entity->dlAbsDeadline = entity->dlReplenishAt + params.deadline;
+		entity->dlBudget = params.runtime;
+	}
+
+	// CBS wake-up rule: if the entity cannot consume its remaining budget until its
+	// deadline without exceeding its bandwidth, it gets a new deadline and a full budget.
+	// This prevents entities that block from accumulating bandwidth.
+	if(_refClock >= entity->dlAbsDeadline
+			|| static_cast<uint64_t>(entity->dlBudget) * params.period
+				> (entity->dlAbsDeadline - _refClock) * params.runtime) {
+		entity->dlAbsDeadline = _refClock + params.deadline;
+		entity->dlBudget = params.runtime;
+	}
+}
+
+void Scheduler::_checkDeadline(ScheduleEntity *entity) {
+	assert(entity->isDeadline());
+	auto &params = entity->dlParams_;
+
+	// The entity overran its budget. Run it in the fair class until the next period.
+	if(entity->dlBudget <= 0) {
+		if(logRealTime)
+			infoLogger() << "thor: Deadline entity " << entity
+					<< " overran its budget" << frg::endlog;
+		entity->_numBudgetOverruns++;
+		entity->dlDemoted = true;
+		entity->dlReplenishAt = entity->dlAbsDeadline - params.deadline + params.period;
+		entity->refProgress = _systemProgress;
+		entity->baseUnfairness = 0;
+		_dlReplenishQueue.push(entity);
+		return;
+	}
+
+	// The entity did not finish its work before the deadline. Start a new period.
+	if(_refClock >= entity->dlAbsDeadline) {
+		if(logRealTime)
+			infoLogger() << "thor: Deadline entity " << entity
+					<< " missed its deadline by "
+					<< (_refClock - entity->dlAbsDeadline) / 1000 << " us" << frg::endlog;
+		entity->_numDeadlineMisses++;
+		entity->dlAbsDeadline = _refClock + params.deadline;
+		entity->dlBudget = params.runtime;
+	}
+}
+
+void Scheduler::_replenishDeadlines() {
+	while(!_dlReplenishQueue.empty()) {
+		auto entity = _dlReplenishQueue.top();
+		if(entity->dlReplenishAt > _refClock)
+			break;
+		_dlReplenishQueue.pop();
+
+		assert(entity->state == ScheduleState::active);
+		bool inQueue = entity != _current && entity != _scheduled;
+		if(inQueue)
+			_dequeue(entity);
+
+		entity->dlDemoted = false;
+		entity->dlAbsDeadline = entity->dlReplenishAt + entity->dlParams_.deadline;
+		entity->dlBudget = entity->dlParams_.runtime;
+		if(entity->dlAbsDeadline <= _refClock)
+			entity->dlAbsDeadline = _refClock + entity->dlParams_.deadline;
+
+		if(inQueue)
+			_enqueue(entity, false);
+	}
+}
+
+void Scheduler::_updateRtBandwidth() {
+	auto period = rtPeriod.load(std::memory_order_relaxed);
+	auto runtime = rtRuntime.load(std::memory_order_relaxed);
+
+	if(_refClock - _rtPeriodStart >= period) {
+		if(logRealTime && _rtThrottled)
+			infoLogger() << "thor: Real-time class on CPU " << _cpuContext->cpuIndex
+					<< " is unthrottled" << frg::endlog;
+		_rtPeriodStart = _refClock;
+		_rtRuntime = 0;
+		_rtThrottled = false;
+	}
+
+	if(!_rtThrottled && _rtRuntime >= runtime) {
+		if(logRealTime)
+			infoLogger() << "thor: Real-time class on CPU " << _cpuContext->cpuIndex
+					<< " exhausted its bandwidth" << frg::endlog;
+		_rtThrottled = true;
+		_numRtThrottles.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+bool Scheduler::pollIdle() {
+	assert(!intsAreEnabled());
+	assert(_current->type() == ScheduleType::idle);
+
+	// Pairs with the seq_cst operations in _notify(): either the waker observes
+	// _idlePolling or we observe _needsReschedule (or both).
+	_idlePolling.store(true, std::memory_order_seq_cst);
+
+	auto deadline = systemClockSource()->currentNanos() + idlePollTime;
+	while(!_needsReschedule.load(std::memory_order_seq_cst)) {
+		if(systemClockSource()->currentNanos() >= deadline)
+			break;
+		pause();
+	}
+
+	// Wakers that observed _idlePolling did not send an IPI. Thus, check the flag again.
+	_idlePolling.store(false, std::memory_order_seq_cst);
+	return _needsReschedule.load(std::memory_order_seq_cst);
+}
+
+[[noreturn]] void Scheduler::runIdle() {
+	assert(!intsAreEnabled());
+	assert(_current->type() == ScheduleType::idle);
+
+	if(haveIdleMonitor()) {
+		// Wakers only need to store to _needsReschedule to wake us up.
+		// _idlePolling is cleared by commitReschedule() when we switch away.
+		_idlePolling.store(true, std::memory_order_seq_cst);
+		suspendSelfMonitored(&_needsReschedule);
+	}
+
+	// Fall back to halting the CPU; wakers send a ping IPI.
+	if(pollIdle()) {
+		update();
+		if(maybeReschedule())
+			commitReschedule();
+	}
+	suspendSelf();
+	__builtin_trap();
+}
+
+Scheduler::Stats Scheduler::getStats() {
+	Stats stats{
+		.sentPings = _numSentPings.load(std::memory_order_relaxed),
+		.avoidedPings = _numAvoidedPings.load(std::memory_order_relaxed),
+		.rtThrottles = _numRtThrottles.load(std::memory_order_relaxed),
+		.dlBandwidth = _dlBandwidth.load(std::memory_order_relaxed),
+		.affineWakeups = _numAffineWakeups.load(std::memory_order_relaxed)
+	};
+
+	if(logPings)
+		infoLogger() << "thor: CPU " << _cpuContext->cpuIndex << " received "
+				<< stats.sentPings << " ping IPIs, avoided " << stats.avoidedPings
+				<< frg::endlog;
+
+	return stats;
+}
+
+void Scheduler::_notify() {
+	assert(!intsAreEnabled());
+
+	_needsReschedule.store(true, std::memory_order_seq_cst);
+
+	// If pings are deferred, the local CPU calls update() before it returns to user space.
+	// Polling idle CPUs observe the flag on their own.
+	if((this == localScheduler() && _deferLocalPings)
+			|| _idlePolling.load(std::memory_order_seq_cst)) {
+		_numAvoidedPings.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	_numSentPings.fetch_add(1, std::memory_order_relaxed);
+	sendPingIpi(_cpuContext->cpuIndex);
+}
+
+void Scheduler::_publishLoad() {
+	auto load = _numWaiting + _numRtWaiting + _numDlWaiting;
+	if(_current && _current->type() == ScheduleType::regular)
+		load++;
+	_load.store(load, std::memory_order_relaxed);
+}
+
+bool Scheduler::_isIdle() {
+	return !_load.load(std::memory_order_relaxed)
+			&& !_needsReschedule.load(std::memory_order_relaxed);
+}
+
+Scheduler *Scheduler::_selectWakeTarget(ScheduleEntity *entity) {
+	auto prev = entity->_scheduler;
+	auto llcId = _cpuContext->llcId;
+
+	// The previous CPU likely still caches the entity's working set.
+	if(prev->_cpuContext->llcId == llcId && prev->_isIdle())
+		return prev;
+
+	// SMT siblings compete for the resources of their core.
+	auto isIdleCore = [] (CpuData *cpu) -> bool {
+		auto sibling = cpu;
+		do {
+			if(!sibling->scheduler._isIdle())
+				return false;
+			sibling = sibling->nextSmtSibling.load(std::memory_order_acquire);
+		} while(sibling != cpu);
+		return true;
+	};
+
+	// Only consider CPUs that share our LLC. Start the search after the previous CPU
+	// (if it shares our LLC) to spread wake-ups from a single CPU.
+	auto start = _cpuContext;
+	if(prev->_cpuContext->llcId == llcId)
+		start = prev->_cpuContext;
+	Scheduler *idleSibling = nullptr;
+	auto cpu = start;
+	do {
+		cpu = cpu->nextLlcPeer.load(std::memory_order_acquire);
+		if(!cpu->scheduler._isIdle())
+			continue;
+		if(!entity->mayWakeOn(cpu->cpuIndex))
+			continue;
+		if(isIdleCore(cpu))
+			return &cpu->scheduler;
+		if(!idleSibling)
+			idleSibling = &cpu->scheduler;
+	} while(cpu != start);
+	if(idleSibling)
+		return idleSibling;
+	return prev;
+}
+
+// Asks the busiest scheduler to push an entity to this (idle) scheduler.
+void Scheduler::_requestWork() {
+	// Schedulers with a single runnable entity have nothing to give away.
+	Scheduler *busiest = nullptr;
+	size_t busiestLoad = 1;
+	for(int i = 0; i < getCpuCount(); i++) {
+		auto other = &getCpuData(i)->scheduler;
+		if(other == this)
+			continue;
+		auto otherLoad = other->_load.load(std::memory_order_relaxed);
+		if(otherLoad > busiestLoad) {
+			busiest = other;
+			busiestLoad = otherLoad;
+		}
+	}
+	if(!busiest)
+		return;
+
+	// If another CPU already asked, it will get the entity instead.
+	Scheduler *expected = nullptr;
+	if(!busiest->_stealRequest.compare_exchange_strong(expected, this,
+			std::memory_order_acq_rel))
+		return;
+	sendPingIpi(busiest->_cpuContext->cpuIndex);
+}
+
+void Scheduler::_pushTo(Scheduler *target) {
+	auto cpu = target->_cpuContext->cpuIndex;
+
+	// Prefer the entity that would run next, it benefits the most from an idle CPU.
+	// Only entities of the fair class are moved; real-time entities stay where they are.
+	// Deadline entities (even if they are demoted) stay on the CPU of their reservation.
+	ScheduleEntity *skipped[maxMigrationCandidates];
+	int numSkipped = 0;
+	ScheduleEntity *entity = nullptr;
+	while(!_waitQueue.empty() && numSkipped < maxMigrationCandidates) {
+		auto candidate = _waitQueue.top();
+		_waitQueue.pop();
+		if(candidate->policy_ != SchedulePolicy::deadline && candidate->mayMigrateTo(cpu)) {
+			entity = candidate;
+			break;
+		}
+		skipped[numSkipped++] = candidate;
+	}
+	for(int i = 0; i < numSkipped; i++)
+		_waitQueue.push(skipped[i]);
+	if(!entity)
+		return;
+
+	if(logBalancing)
+		infoLogger() << "thor: Migrating " << entity << " from CPU "
+				<< _cpuContext->cpuIndex << " to CPU " << cpu << frg::endlog;
+
+	// Unfairness is relative to the local progress; make it absolute before moving.
+	_updateWaitingEntity(entity);
+	_numWaiting--;
+	_waitingWeight -= entity->queuedWeight;
+	entity->state = ScheduleState::attached;
+	if(entity->_group)
+		entity->_group->_numActive.fetch_sub(1, std::memory_order_relaxed);
+	_publishLoad();
+
+	migrate(entity, target);
+	resume(entity);
+}
+
 // Returns true if preemption should be done immediately.
 void Scheduler::_updatePreemption() {
 	if(disablePreemption)
 		return;
 
-	// Disable preemption if there are no other threads.
-	if(_waitQueue.empty())
-		return;
+	// Preemption stays disabled unless one of the conditions below applies
+	// (e.g., there are no other threads and no budget to enforce).
+	uint64_t timeout = UINT64_MAX;
+	auto takeMin = [&] (int64_t nanos) {
+		if(nanos < 0)
+			nanos = 0;
+		if(static_cast<uint64_t>(nanos) < timeout)
+			timeout = nanos;
+	};
+
+	// Unthrottle groups at the end of their period. This also applies to idle CPUs.
+	for(auto entity : _throttledList)
+		takeMin(static_cast<int64_t>(entity->_group->_periodEnd(_refClock) - _refClock));
 
-	// If there was no current entity, we would have rescheduled.
 	assert(_current);
+	if(_current->type() == ScheduleType::idle) {
+		if(timeout != UINT64_MAX)
+			armPreemption(timeout);
+		return;
+	}
 	assert(_current->type() == ScheduleType::regular);
 	assert(_current->state == ScheduleState::active);
 
-	if(auto po = ScheduleEntity::orderPriority(_current, _waitQueue.top()); po < 0) {
-		// Disable preemption if we have higher priority.
-		return;
+	// Demoted deadline entities return to the deadline class at the start of their period.
+	if(!_dlReplenishQueue.empty())
+		takeMin(static_cast<int64_t>(_dlReplenishQueue.top()->dlReplenishAt - _refClock));
+
+	if(_current->isDeadline()) {
+		// Enforce the budget and detect deadline misses.
+		takeMin(_current->dlBudget);
+		takeMin(static_cast<int64_t>(_current->dlAbsDeadline - _refClock));
+	}else if(_current->isRealTime()) {
+		// Round-robin among entities of equal priority.
+		if(_current->policy_ == SchedulePolicy::roundRobin && !_rtQueue.empty()
+				&& _rtQueue.top()->rtPriority_ == _current->rtPriority_)
+			takeMin(_current->rrTimeLeft);
+
+		// Throttle once the bandwidth is exhausted (if fair entities are waiting).
+		if(!_waitQueue.empty() && !_rtThrottled)
+			takeMin(static_cast<int64_t>(rtRuntime.load(std::memory_order_relaxed)
+					- _rtRuntime));
 	}else{
-		// If there was an entity with higher priority, we would have rescheduled.
-		assert(!po);
+		// Throttle the current entity once its group exhausts the quota.
+		if(_current->policy_ == SchedulePolicy::fair
+				&& _current->_group && _current->_group->_quota)
+			takeMin(static_cast<int64_t>(_current->_group->_quotaLeft(_refClock)));
+
+		// Unthrottle waiting real-time entities at the end of the period.
+		if(!_rtQueue.empty() && _rtThrottled)
+			takeMin(_rtPeriodStart + rtPeriod.load(std::memory_order_relaxed) - _refClock);
+
+		if(!_waitQueue.empty()) {
+			if(auto po = ScheduleEntity::orderPriority(_current, _waitQueue.top()); !po) {
+				takeMin(sliceGranularity);
+			}else{
+				// If there was an entity with higher priority, we would have rescheduled.
+				// Otherwise, disable time slicing since we have higher priority.
+				assert(po < 0);
+			}
+		}
 	}
 
-	armPreemption(sliceGranularity);
+	if(timeout != UINT64_MAX)
+		armPreemption(timeout);
 }
 
 void Scheduler::_updateCurrentEntity() {
@@ -381,13 +1408,19 @@ void Scheduler::_updateCurrentEntity() {
 	if(_current->type() == ScheduleType::idle)
 		return;
 	assert(_current->type() == ScheduleType::regular);
+	if(!_current->isFair())
+		return;
 
+	// Unfairness is relative to the entity's weight. The running entity loses the share
+	// of all waiting entities (while each waiting entity gains the progress).
 	auto delta_progress = _systemProgress - _current->refProgress;
+	auto delta_unfairness = static_cast<Progress>(_waitingWeight) * delta_progress
+			/ static_cast<Progress>(_current->weight());
 	if(logUpdates)
 		infoLogger() << "Running thread unfairness decreases by: "
-				<< ((_numWaiting * delta_progress) / 256) / 1000
+				<< (delta_unfairness / 256) / 1000
 				<< " us (" << _numWaiting << " waiting threads)" << frg::endlog;
-	_current->baseUnfairness -= _numWaiting * delta_progress;
+	_current->baseUnfairness -= delta_unfairness;
 	_current->refProgress = _systemProgress;
 }
 
@@ -411,15 +1444,49 @@ void Scheduler::_updateEntityStats(ScheduleEntity *entity) {
 	assert(entity->state == ScheduleState::active
 			|| entity == _current);
 
-	if(entity == _current)
-		entity->_runTime += _refClock - entity->_refClock;
+	if(entity == _current) {
+		auto runtime = _refClock - entity->_refClock;
+		entity->_runTime += runtime;
+		if(entity->_group)
+			entity->_group->_charge(_refClock, runtime);
+	}
 	entity->_refClock = _refClock;
 }
 
+bool Scheduler::_isThrottled(ScheduleEntity *entity) {
+	if(entity->policy_ != SchedulePolicy::fair || !entity->_group)
+		return false;
+	return entity->_group->_isThrottled(_refClock);
+}
+
+void Scheduler::_unthrottleGroups() {
+	auto it = _throttledList.begin();
+	while(it != _throttledList.end()) {
+		auto entity = *it;
+		++it;
+		if(entity->_group->_isThrottled(_refClock))
+			continue;
+
+		if(logGroups)
+			infoLogger() << "thor: Unthrottling " << entity << " on CPU "
+					<< _cpuContext->cpuIndex << frg::endlog;
+		_dequeue(entity);
+		_enqueue(entity, false);
+	}
+}
+
 Scheduler *localScheduler() {
 	return &getCpuData()->scheduler;
 }
 
+void handleIdleWake() {
+	assert(!intsAreEnabled());
+	auto self = localScheduler();
+	self->update();
+	if(self->maybeReschedule())
+		self->commitReschedule();
+}
+
 smarter::borrowed_ptr<Thread> getCurrentThread() {
 	return activeExecutor();
 }
@@ -299,6 +299,12 @@ coroutine<void> executeModule(frg::string_view name, MfsRegular *module,
 				LaneDescriptor(xpipe_lane));
 	}
 
+	Handle control_handle;
+	{
+		auto lock = frg::guard(&universe->lock);
+		control_handle = universe->attachDescriptor(lock, KernelControlDescriptor{});
+	}
+
 	enum {
 		AT_NULL = 0,
 		AT_PHDR = 3,
@@ -307,6 +313,7 @@ coroutine<void> executeModule(frg::string_view name, MfsRegular *module,
 		AT_ENTRY = 9,
 
 		AT_XPIPE = 0x1000,
+		AT_KERNEL_CONTROL = 0x1001,
 	};
 
 	frg::string<KernelAlloc> tail_area(*kernelAlloc);
@@ -329,6 +336,8 @@ coroutine<void> executeModule(frg::string_view name, MfsRegular *module,
 		copyToStack<uintptr_t>(tail_area, AT_XPIPE);
 		copyToStack<uintptr_t>(tail_area, xpipe_handle);
 	}
+	copyToStack<uintptr_t>(tail_area, AT_KERNEL_CONTROL);
+	copyToStack<uintptr_t>(tail_area, control_handle);
 	copyToStack<uintptr_t>(tail_area, AT_NULL);
 	copyToStack<uintptr_t>(tail_area, 0);
 
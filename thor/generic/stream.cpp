@@ -1,3 +1,4 @@
+#include <string.h>
 
 #include <thor-internal/stream.hpp>
 
@@ -44,14 +45,25 @@ static void transfer(ImbueExtract, StreamNode *from, StreamNode *to) {
 }
 
 static void transfer(SendRecvInline, StreamNode *from, StreamNode *to) {
-	auto buffer = std::move(from->_inBuffer);
+	auto size = from->inBufferSize();
+
+	if(size <= to->_maxLength) {
+		// Note that we need to copy before completing the sender.
+		if(to->_recvStorage) {
+			memcpy(to->_recvStorage, from->inBufferData(), size);
+			to->_actualLength = size;
+		}else if(from->_inData) {
+			frg::unique_memory<KernelAlloc> buffer(*kernelAlloc, size);
+			memcpy(buffer.data(), from->_inData, size);
+			to->_transmitBuffer = std::move(buffer);
+		}else{
+			to->_transmitBuffer = std::move(from->_inBuffer);
+		}
 
-	if(buffer.size() <= to->_maxLength) {
 		from->_error = Error::success;
 		from->complete();
 
 		to->_error = Error::success;
-		to->_transmitBuffer = std::move(buffer);
 		to->complete();
 	}else{
 		from->_error = Error::bufferTooSmall;
@@ -169,7 +181,7 @@ void Stream::Submitter::run() {
 		}else if(u->tag() == kTagSendKernelBuffer && v->tag() == kTagRecvKernelBuffer) {
 			transfer(SendRecvInline{}, u, v);
 		}else if(u->tag() == kTagSendFlow && v->tag() == kTagRecvKernelBuffer) {
-			if(u->_inBuffer.size() > v->_maxLength) {
+			if(u->_maxLength > v->_maxLength) {
 				// Both nodes complete with bufferTooSmall.
 				u->_error = Error::bufferTooSmall;
 				v->_error = Error::bufferTooSmall;
@@ -186,7 +198,7 @@ void Stream::Submitter::run() {
 			u->peerNode = v;
 			u->issueFlow.raise();
 		}else if(u->tag() == kTagSendKernelBuffer && v->tag() == kTagRecvFlow) {
-			if(u->_inBuffer.size() > v->_maxLength) {
+			if(u->inBufferSize() > v->_maxLength) {
 				// Both nodes complete with bufferTooSmall.
 				u->_error = Error::bufferTooSmall;
 				v->_error = Error::bufferTooSmall;
@@ -194,7 +206,7 @@ void Stream::Submitter::run() {
 				u->complete();
 				v->issueFlow.raise();
 				continue;
-			}else if(!u->_inBuffer.size()) {
+			}else if(!u->inBufferSize()) {
 				u->complete();
 				v->issueFlow.raise();
 				continue;
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <frg/spinlock.hpp>
+#include <smarter.hpp>
+#include <thor-internal/arch/paging.hpp>
+
+namespace thor {
+
+// Per-thread cache of fixed-size blocks that back the state of asynchronous Hel actions
+// (e.g., the items of helSubmitAsync() and the coroutines that perform flow transfers).
+// Since actions can complete after their thread exited, arenas are reference counted.
+// Blocks may be freed on any CPU.
+struct ActionArena {
+	static constexpr size_t blockSize = kPageSize;
+	static constexpr size_t maxCachedBlocks = 8;
+
+	struct Stats {
+		size_t numHits;
+		size_t numMisses;
+	};
+
+	ActionArena() = default;
+
+	ActionArena(const ActionArena &) = delete;
+
+	~ActionArena();
+
+	ActionArena &operator= (const ActionArena &) = delete;
+
+	// Returns a block of blockSize bytes.
+	void *allocate();
+
+	void free(void *block);
+
+	Stats getStats();
+
+private:
+	struct FreeBlock {
+		FreeBlock *next;
+	};
+
+	frg::ticket_spinlock _mutex;
+
+	FreeBlock *_cached = nullptr;
+	size_t _numCached = 0;
+
+	size_t _numHits = 0;
+	size_t _numMisses = 0;
+};
+
+// Allocation functions for coroutine frames that are backed by an ActionArena.
+// Frames that do not fit into a block are allocated from the kernel heap.
+void *allocateArenaFrame(smarter::shared_ptr<ActionArena> arena, size_t size);
+void freeArenaFrame(void *frame, size_t size);
+
+} // namespace thor
@@ -3,10 +3,13 @@
 #include <async/basic.hpp>
 #include <async/mutex.hpp>
 #include <async/oneshot-event.hpp>
+#include <async/recurring-event.hpp>
 #include <frg/container_of.hpp>
 #include <frg/expected.hpp>
+#include <frg/optional.hpp>
 #include <thor-internal/coroutine.hpp>
 #include <thor-internal/memory-view.hpp>
+#include <thor-internal/rcu.hpp>
 
 namespace thor {
 
@@ -45,6 +48,16 @@ struct VirtualOperations {
 
 	virtual size_t getRss();
 
+	// Huge page support. mapHugePage() replaces the page table that maps a 2 MiB range
+	// by a single huge page. It returns the old page table (or PhysicalAddr(-1));
+	// the caller frees it after shootdown. Unmapping parts of a huge page splits it again.
+	virtual bool supportsHugePages();
+
+	virtual bool isHugePage(VirtualAddr va);
+
+	virtual PhysicalAddr mapHugePage(VirtualAddr va, PhysicalAddr physical,
+			PageFlags flags, CachingMode cachingMode);
+
 	// ----------------------------------------------------------------------------------
 	// Sender boilerplate for retire()
 	// ----------------------------------------------------------------------------------
@@ -287,6 +300,13 @@ public:
 
 	frg::rbtree_hook treeNode;
 
+	// Drops the reference held by the MappingTree once concurrent lookups are done.
+	struct TreeRelease final : RcuCallback {
+		void reclaim() override;
+	};
+
+	TreeRelease treeRelease;
+
 	uint32_t compilePageFlags();
 
 	coroutine<void> runEvictionLoop();
@@ -348,6 +368,96 @@ using MappingTree = frg::rbtree<
 	MappingLess
 >;
 
+// Range of a VirtualSpace whose pages stay resident until this object is destructed.
+// Used to copy into the memory of another VirtualSpace through the physical window.
+struct PinnedVirtualRange {
+	struct Lock {
+		smarter::shared_ptr<Mapping> mapping;
+		uintptr_t offset;
+		size_t size;
+	};
+
+	PinnedVirtualRange()
+	: pages{*kernelAlloc}, _locks{*kernelAlloc} { }
+
+	PinnedVirtualRange(const PinnedVirtualRange &) = delete;
+
+	~PinnedVirtualRange();
+
+	PinnedVirtualRange &operator= (const PinnedVirtualRange &) = delete;
+
+	VirtualAddr address = 0;
+	size_t size = 0;
+
+	// Physical address of each page that overlaps [address, address + size).
+	frg::vector<PhysicalAddr, KernelAlloc> pages;
+
+private:
+	friend struct VirtualSpace;
+
+	frg::vector<Lock, KernelAlloc> _locks;
+};
+
+// Serializes asynchronous operations on overlapping ranges of a VirtualSpace.
+// Operations on disjoint ranges proceed concurrently.
+struct VirtualRangeLock {
+	struct Node {
+		VirtualAddr address = 0;
+		size_t length = 0;
+		frg::default_list_hook<Node> listHook;
+	};
+
+	coroutine<void> lock(Node *node) {
+		while(co_await _event.async_wait_if([&] () -> bool {
+			return !_tryLock(node);
+		}))
+			;
+	}
+
+	// Only succeeds if the range is not locked at the moment. Unlike lock(), this can be
+	// called while holding other locks (e.g., to lock a range that was just reserved).
+	bool tryLock(Node *node) {
+		return _tryLock(node);
+	}
+
+	void unlock(Node *node) {
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_mutex);
+
+			_activeList.erase(_activeList.iterator_to(node));
+		}
+		_event.raise();
+	}
+
+private:
+	bool _tryLock(Node *node) {
+		auto irqLock = frg::guard(&irqMutex());
+		auto lock = frg::guard(&_mutex);
+
+		for(auto other : _activeList) {
+			if(node->address < other->address + other->length
+					&& other->address < node->address + node->length)
+				return false;
+		}
+		_activeList.push_back(node);
+		return true;
+	}
+
+	frg::ticket_spinlock _mutex;
+
+	frg::intrusive_list<
+		Node,
+		frg::locate_member<
+			Node,
+			frg::default_list_hook<Node>,
+			&Node::listHook
+		>
+	> _activeList;
+
+	async::recurring_event _event;
+};
+
 struct VirtualSpace {
 	friend struct Mapping;
 
@@ -396,6 +506,13 @@ public:
 	coroutine<frg::expected<Error, PhysicalAddr>>
 	retrievePhysical(VirtualAddr address, smarter::shared_ptr<WorkQueue> wq);
 
+	// Returns the first 2 MiB-aligned range at or above address that is completely
+	// covered by a single mapping (such that it can potentially be mapped as a huge page).
+	frg::optional<VirtualAddr> findHugePageCandidate(VirtualAddr address);
+
+	// Makes the 2 MiB range at address physically contiguous and maps it as a huge page.
+	coroutine<frg::expected<Error>> collapseHugePage(VirtualAddr address);
+
 	size_t rss() {
 		return _ops->getRss();
 	}
@@ -411,6 +528,21 @@ public:
 	coroutine<size_t> writePartialSpace(uintptr_t address, const void *buffer, size_t size,
 			smarter::shared_ptr<WorkQueue> wq);
 
+	// Pins a writable range of memory. On error, all pages that were
+	// pinned so far are unpinned when the PinnedVirtualRange is destructed.
+	coroutine<frg::expected<Error>> pinRange(uintptr_t address, size_t size,
+			PinnedVirtualRange &pin, smarter::shared_ptr<WorkQueue> wq);
+
+	// Creates a copy-on-write snapshot of a page-aligned range that lies within
+	// a single mapping. Fails with illegalObject if the mapping's view cannot be forked;
+	// callers are expected to fall back to copying in that case.
+	// On success, protection is set to the protection (kMapProt* flags) of the mapping.
+	coroutine<frg::expected<Error, smarter::shared_ptr<MemorySlice>>>
+	lendRange(uintptr_t address, size_t size, MapFlags &protection);
+
+	// Returns the protection (kMapProt* flags) of a range that lies within a single mapping.
+	frg::expected<Error, MapFlags> queryProtection(uintptr_t address, size_t size);
+
 	auto readSpace(uintptr_t address, void *buffer, size_t size,
 			smarter::shared_ptr<WorkQueue> wq) {
 		return async::transform(
@@ -440,37 +572,30 @@ public:
 	// ----------------------------------------------------------------------------------
 
 	frg::expected<Error, FutexIdentity> resolveGlobalFutex(uintptr_t address) {
-		// We do not take _consistencyMutex here since we are only interested in a snapshot.
-
-		smarter::shared_ptr<Mapping> mapping;
-		{
-			auto irqLock = frg::guard(&irqMutex());
-			auto spaceGuard = frg::guard(&_snapshotMutex);
+		// We do not take _rangeLock here since we are only interested in a snapshot.
 
-			mapping = _findMapping(address);
-		}
+		auto mapping = _findMapping(address);
 		if(!mapping)
 			return Error::fault;
 
 		auto offset = address - mapping->address;
 		auto [futexSpace, futexOffset] = FRG_TRY(mapping->view->resolveGlobalFutex(
 				mapping->viewOffset + offset));
-		return FutexIdentity{reinterpret_cast<uintptr_t>(futexSpace.get()), offset};
+		// This needs to match GlobalFutex::getIdentity().
+		return FutexIdentity{reinterpret_cast<uintptr_t>(futexSpace.get()), futexOffset};
 	}
 
+	// If write is true, the futex must be in a writable mapping
+	// (i.e., the caller intends to modify the futex word through GlobalFutex::update()).
 	coroutine<frg::expected<Error, GlobalFutex>> grabGlobalFutex(uintptr_t address,
-			smarter::shared_ptr<WorkQueue> wq) {
-		// We do not take _consistencyMutex here since we are only interested in a snapshot.
-
-		smarter::shared_ptr<Mapping> mapping;
-		{
-			auto irqLock = frg::guard(&irqMutex());
-			auto spaceGuard = frg::guard(&_snapshotMutex);
+			smarter::shared_ptr<WorkQueue> wq, bool write = false) {
+		// We do not take _rangeLock here since we are only interested in a snapshot.
 
-			mapping = _findMapping(address);
-		}
+		auto mapping = _findMapping(address);
 		if(!mapping)
 			co_return Error::fault;
+		if(write && !(mapping->flags & MappingFlags::protWrite))
+			co_return Error::fault;
 
 		auto offset = address - mapping->address;
 		auto [futexSpace, futexOffset] = FRG_CO_TRY(mapping->view->resolveGlobalFutex(
@@ -484,33 +609,71 @@ public:
 
 	smarter::borrowed_ptr<VirtualSpace> selfPtr;
 
+	// Protected by the mutex of the HugePageCollapser.
+	frg::default_list_hook<VirtualSpace> collapseHook;
+
 private:
 	// Allocates a new mapping of the given length somewhere in the address space.
 	VirtualAddr _allocate(size_t length, MapFlags flags);
 
 	VirtualAddr _allocateAt(VirtualAddr address, size_t length);
 
+	// Looks up the mapping that contains address. This does not take any locks.
 	smarter::shared_ptr<Mapping> _findMapping(VirtualAddr address);
 
+	// Must be called with _snapshotMutex held around modifications of _mappings.
+	void _beginMappingUpdate() {
+		_mappingSeq.store(_mappingSeq.load(std::memory_order_relaxed) + 1,
+				std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void _endMappingUpdate() {
+		_mappingSeq.store(_mappingSeq.load(std::memory_order_relaxed) + 1,
+				std::memory_order_release);
+	}
+
+	// Returns the first mapping that starts in [address, limit).
+	// Must be called with _snapshotMutex held.
+	Mapping *_firstMappingIn(VirtualAddr address, VirtualAddr limit);
+
 	// Splits some memory range from a hole mapping.
 	void _splitHole(Hole *hole, VirtualAddr offset, VirtualAddr length);
 
+	// Returns a hole to the hole tree, merging it with adjacent holes.
+	// Must be called with _snapshotMutex held.
+	void _freeHole(VirtualAddr address, size_t length);
+
+	// Acquires _rangeLock for a range that covers [address, address + length),
+	// including all mappings that straddle the boundaries of that range.
+	coroutine<void> _lockRange(VirtualRangeLock::Node *node, VirtualAddr address, size_t length);
+
+	// Splits the mapping that contains address (if any) into two parts at address.
+	// The caller must hold a range lock that covers the mapping.
+	coroutine<void> _splitMappingAt(VirtualAddr address);
+
 	// Potentially splits mappings into two parts at (address) and (address + size).
-	// Returns the start and end mappings that are within the specified range.
-	coroutine<frg::tuple<Mapping *, Mapping *>> _splitMappings(uintptr_t address, size_t size);
+	coroutine<void> _splitMappings(uintptr_t address, size_t size) {
+		co_await _splitMappingAt(address);
+		co_await _splitMappingAt(address + size);
+	}
+
+	// Implementation of collapseHugePage(). The caller holds a range lock.
+	coroutine<frg::expected<Error>> _collapseHugePage(VirtualAddr address);
 
 	// Used in conjunction with _splitMappings.
-	// Unmaps and removes all mappings between start and end that fall within the specified range.
-	// Returns whether shootdown needs to be performed (any of the mappings got unmapped).
-	coroutine<bool> _unmapMappings(VirtualAddr address, size_t length, Mapping *start, Mapping *end);
+	// Unmaps and removes all mappings that fall within the specified range,
+	// performs shootdown (if necessary) and returns the range to the hole tree.
+	coroutine<void> _unmapMappings(VirtualAddr address, size_t length);
 
 	VirtualOperations *_ops;
 
 	// Since changing memory mappings requires TLB shootdown, most mapping-related operations
-	// of VirtualSpace are async. Thus, we use an async mutex to serialize these operations.
-	async::shared_mutex _consistencyMutex;
+	// of VirtualSpace are async. These operations lock the range that they modify;
+	// operations on disjoint ranges can run concurrently.
+	VirtualRangeLock _rangeLock;
 
-	// To avoid taking _consistencyMutex for operations that only need to look at the current
+	// To avoid taking _rangeLock for operations that only need to look at the current
 	// state of the VirtualSpace (and that can run concurrently with mapping-related that
 	// perform TLB shootdown), we have another mutex that only protects _holes and _mappings.
 	// We make sure that we "commit" changes to _holes and _mappings before changing page
@@ -518,7 +681,12 @@ private:
 	frg::ticket_spinlock _snapshotMutex;
 
 	HoleTree _holes;
+
+	// Writers hold _snapshotMutex. Readers (see _findMapping()) do not take any lock;
+	// they traverse the tree under RCU and retry if _mappingSeq changes concurrently.
+	// Removed mappings keep their tree reference until the RCU grace period ends.
 	MappingTree _mappings;
+	std::atomic<uint64_t> _mappingSeq{0};
 };
 
 struct AddressSpace final : VirtualSpace, smarter::crtp_counter<AddressSpace, BindableHandle> {
@@ -556,6 +724,21 @@ struct AddressSpace final : VirtualSpace, smarter::crtp_counter<AddressSpace, Bi
 			return space_->pageSpace_.isMapped(pointer);
 		}
 
+#ifdef __x86_64__
+		bool supportsHugePages() override {
+			return true;
+		}
+
+		bool isHugePage(VirtualAddr va) override {
+			return space_->pageSpace_.isMapped2m(va);
+		}
+
+		PhysicalAddr mapHugePage(VirtualAddr va, PhysicalAddr physical,
+				PageFlags flags, CachingMode cachingMode) override {
+			return space_->pageSpace_.mapSingle2m(va, physical, true, flags, cachingMode);
+		}
+#endif
+
 	private:
 		AddressSpace *space_;
 	};
@@ -569,12 +752,7 @@ public:
 		return smarter::shared_ptr<AddressSpace, BindableHandle>{smarter::adopt_rc, space, space};
 	}
 
-	static smarter::shared_ptr<AddressSpace, BindableHandle> create() {
-		auto ptr = smarter::allocate_shared<AddressSpace>(Allocator{});
-		ptr->selfPtr = ptr;
-		ptr->setupInitialHole(0x100000, 0x7ffffff00000);
-		return constructHandle(std::move(ptr));
-	}
+	static smarter::shared_ptr<AddressSpace, BindableHandle> create();
 
 	static void activate(smarter::shared_ptr<AddressSpace, BindableHandle> space);
 
@@ -584,8 +762,6 @@ public:
 
 	void dispose(BindableHandle);
 
-	FutexRealm localFutexRealm;
-
 	bool updatePageAccess(VirtualAddr address) {
 		return pageSpace_.updatePageAccess(address);
 	}
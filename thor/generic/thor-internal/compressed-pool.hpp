@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <frg/list.hpp>
+#include <frg/optional.hpp>
+#include <frg/spinlock.hpp>
+#include <thor-internal/arch/paging.hpp>
+#include <thor-internal/types.hpp>
+
+namespace thor {
+
+// Compresses a single page using the LZ4 block format.
+// Returns the compressed size or zero if the result does not fit into dest.
+size_t compressPage(const void *page, void *dest, size_t destSize);
+
+// Decompresses an LZ4 block into a single page.
+// Returns false if the input is corrupted or does not decompress to exactly one page.
+bool decompressPage(const void *source, size_t size, void *page);
+
+// Storage for compressed anonymous pages (similar to Linux' zsmalloc).
+// Objects are packed into physical pages that are dedicated to a single size class;
+// objects never straddle a page boundary.
+struct CompressedPool {
+	// Granularity of the size classes.
+	static constexpr size_t classShift = 6;
+	static constexpr size_t classGranularity = size_t(1) << classShift;
+
+	// Pages that do not compress below this size are not stored in the pool.
+	static constexpr size_t maxObjectSize = kPageSize * 3 / 4;
+
+	static constexpr size_t numClasses = maxObjectSize / classGranularity;
+
+	struct ZsPage {
+		PhysicalAddr physical = PhysicalAddr(-1);
+		unsigned int sizeClass = 0;
+		unsigned int numFree = 0;
+		// Bit i is set if slot i is in use.
+		uint64_t usedMap = 0;
+		frg::default_list_hook<ZsPage> listHook;
+	};
+
+	struct Handle {
+		ZsPage *page = nullptr;
+		uint16_t slot = 0;
+		uint16_t size = 0;
+	};
+
+	struct Stats {
+		size_t storedPages;
+		size_t storedBytes;
+		size_t poolPages;
+		size_t rejectedPages;
+	};
+
+	CompressedPool();
+
+	CompressedPool(const CompressedPool &) = delete;
+
+	CompressedPool &operator= (const CompressedPool &) = delete;
+
+	// Compresses the page at the given physical address.
+	// Fails if the page is incompressible or if no memory is available.
+	// Compression runs with IRQs enabled and without holding the pool's lock.
+	frg::optional<Handle> store(PhysicalAddr physical);
+
+	// Decompresses an object into the page at the given physical address.
+	// The object remains in the pool.
+	void load(Handle handle, PhysicalAddr physical);
+
+	void discard(Handle handle);
+
+	Stats getStats();
+
+private:
+	using ZsPageList = frg::intrusive_list<
+		ZsPage,
+		frg::locate_member<
+			ZsPage,
+			frg::default_list_hook<ZsPage>,
+			&ZsPage::listHook
+		>
+	>;
+
+	static size_t slotsPerPage_(unsigned int sizeClass) {
+		// Since objects are at least 64 bytes large, this fits into usedMap.
+		return kPageSize / ((sizeClass + 1) << classShift);
+	}
+
+	// Protects the pool pages and the statistics (but not the contents of the slots).
+	frg::ticket_spinlock _mutex;
+
+	// Pages that have at least one free slot, per size class.
+	ZsPageList _partialPages[numClasses];
+
+	size_t _storedPages = 0;
+	size_t _storedBytes = 0;
+	size_t _poolPages = 0;
+	size_t _rejectedPages = 0;
+};
+
+CompressedPool *getCompressedPool();
+
+} // namespace thor
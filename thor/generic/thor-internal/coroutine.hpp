@@ -1,6 +1,7 @@
 #pragma once
 
 #include <async/basic.hpp>
+#include <thor-internal/action-arena.hpp>
 #include <thor-internal/debug.hpp>
 
 template<typename T>
@@ -393,6 +394,35 @@ struct detached_coroutine_promise {
 	}
 };
 
+// Like enable_detached_coroutine but allocates the coroutine frame from an ActionArena.
+// Must be passed as last argument to the function.
+struct detached_in_arena {
+	smarter::shared_ptr<thor::ActionArena> arena;
+};
+
+template<typename T>
+T &last_argument(T &x) {
+	return x;
+}
+
+template<typename T, typename... Ts>
+auto &last_argument(T &, Ts &...xs) {
+	return last_argument(xs...);
+}
+
+struct detached_arena_coroutine_promise : detached_coroutine_promise {
+	// Note that the arguments of the coroutine are passed to operator new.
+	template<typename... Args>
+	void *operator new(size_t size, Args &...args) {
+		detached_in_arena &tag = last_argument(args...);
+		return thor::allocateArenaFrame(tag.arena, size);
+	}
+
+	void operator delete(void *p, size_t size) {
+		thor::freeArenaFrame(p, size);
+	}
+};
+
 template<typename... Ts>
 struct last_type {
     using type = typename decltype((std::detail::type_identity<Ts>{}, ...))::type;
@@ -413,4 +443,16 @@ namespace std::experimental {
 	struct coroutine_traits<void, X, Args...> {
 		using promise_type = detached_coroutine_promise;
 	};
+
+	template<typename... Args>
+	requires (std::is_same_v<last_type_t<Args...>, detached_in_arena>)
+	struct coroutine_traits<void, Args...> {
+		using promise_type = detached_arena_coroutine_promise;
+	};
+
+	template<typename X, typename... Args>
+	requires (std::is_same_v<last_type_t<Args...>, detached_in_arena>)
+	struct coroutine_traits<void, X, Args...> {
+		using promise_type = detached_arena_coroutine_promise;
+	};
 }
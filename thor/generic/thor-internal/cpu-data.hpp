@@ -33,12 +33,30 @@ struct CpuData : public PlatformCpuData {
 
 	int cpuIndex;
 
+	// Topology of the CPU; filled in by initializeThisProcessor().
+	// CPUs with equal coreId are SMT siblings. CPUs with equal llcId share the last-level cache.
+	uint32_t coreId = 0;
+	uint32_t llcId = 0;
+	// Circular lists of the CPUs with equal coreId (resp. llcId), including this CPU.
+	// CPUs are only ever inserted (by linkCpuTopology()), hence readers can traverse
+	// the lists without locking.
+	std::atomic<CpuData *> nextSmtSibling{this};
+	std::atomic<CpuData *> nextLlcPeer{this};
+
+	// Scratch page that receives the output of CompressedPool::store().
+	// Users claim it through compressionScratchBusy since they can migrate to other CPUs.
+	PhysicalAddr compressionScratch = PhysicalAddr(-1);
+	std::atomic<bool> compressionScratchBusy{false};
+
 	ExecutorContext *executorContext = nullptr;
 	KernelFiber *activeFiber;
 	KernelFiber *wqFiber = nullptr;
 	smarter::shared_ptr<WorkQueue> generalWorkQueue;
 	std::atomic<uint64_t> heartbeat;
 
+	// Epoch of the current RCU read-side critical section (zero if there is none).
+	std::atomic<uint64_t> rcuEpoch{0};
+
 	unsigned int irqEntropySeq = 0;
 	std::atomic<ProfileMechanism> profileMechanism{};
 	// TODO: This should be a unique_ptr instead.
@@ -48,6 +66,10 @@ struct CpuData : public PlatformCpuData {
 CpuData *getCpuData(size_t k);
 int getCpuCount();
 
+// Inserts the CPU into the SMT sibling and LLC peer lists of the CPUs that are already known.
+// Called by the architecture-specific code once coreId and llcId are set.
+void linkCpuTopology(CpuData *cpuData);
+
 inline CpuData *getCpuData() {
 	return static_cast<CpuData *>(getPlatformCpuData());
 }
@@ -1,8 +1,9 @@
 #pragma once
 
+#include <atomic>
+
 #include <async/cancellation.hpp>
 #include <frg/functional.hpp>
-#include <frg/hash_map.hpp>
 #include <frg/list.hpp>
 #include <frg/spinlock.hpp>
 
@@ -54,12 +55,14 @@ concept Futex = requires(F f) {
 
 struct FutexRealm {
 private:
+	struct Bucket;
+
 	// Represents a single waiter.
 	struct Node {
 		friend struct FutexRealm;
 
 		Node(FutexRealm *realm, FutexIdentity id)
-		: realm_{realm}, id_{id}, cobs_{this} { }
+		: realm_{realm}, id_{id}, bucket_{realm->_getBucket(id)}, cobs_{this} { }
 
 	protected:
 		virtual void complete() = 0;
@@ -70,51 +73,64 @@ private:
 		void cancel_() {
 			{
 				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&realm_->_mutex);
+				auto bucket = realm_->_lockBucketOf(this);
 
 				if(!result_) {
-					auto sit = realm_->_slots.get(id_);
-					// Invariant: If the slot exists then its queue is not empty.
-					assert(!sit->queue.empty());
-
-					auto nit = sit->queue.iterator_to(this);
-					sit->queue.erase(nit);
+					auto nit = bucket->queue.iterator_to(this);
+					bucket->queue.erase(nit);
 					result_ = Error::cancelled;
-
-					if(sit->queue.empty())
-						realm_->_slots.remove(id_);
 				}else{
 					assert(!queueHook_.in_list);
 				}
+
+				bucket->mutex.unlock();
 			}
 
 			complete();
 		}
 
 		FutexRealm *realm_;
+		// id_ and bucket_ change when the node is requeued.
+		// This only happens while holding the lock of the bucket that contains the node.
 		FutexIdentity id_;
+		std::atomic<Bucket *> bucket_;
 		frg::optional<Error> result_; // Set after completion.
 		async::cancellation_observer<frg::bound_mem_fn<&Node::cancel_>> cobs_;
 		frg::default_list_hook<Node> queueHook_;
 	};
 
-	struct Slot {
-		frg::intrusive_list<
+	using NodeList = frg::intrusive_list<
+		Node,
+		frg::locate_member<
 			Node,
-			frg::locate_member<
-				Node,
-				frg::default_list_hook<Node>,
-				&Node::queueHook_
-			>
-		> queue;
+			frg::default_list_hook<Node>,
+			&Node::queueHook_
+		>
+	>;
+
+	// The realm is sharded into buckets that are selected by the futex identity.
+	// Each bucket has its own lock and contains the waiters of all futexes that map to it.
+	// Buckets are aligned to cache lines such that unrelated futexes do not contend.
+	struct alignas(64) Bucket {
+		frg::ticket_spinlock mutex;
+		NodeList queue;
 	};
 
 public:
-	FutexRealm()
-	: _slots{FutexIdentity::Hash{}, *kernelAlloc} { }
+	static constexpr size_t numBuckets = 256;
+	static_assert(!(numBuckets & (numBuckets - 1)), "numBuckets must be a power of two");
+
+	FutexRealm() = default;
 
 	bool empty() {
-		return _slots.empty();
+		for(size_t i = 0; i < numBuckets; i++) {
+			auto irqLock = frg::guard(&irqMutex());
+			auto lock = frg::guard(&_buckets[i].mutex);
+
+			if(!_buckets[i].queue.empty())
+				return false;
+		}
+		return true;
 	}
 
 	// ----------------------------------------------------------------------------------
@@ -140,7 +156,8 @@ public:
 
 			auto fastPath = [&] {
 				auto irqLock = frg::guard(&irqMutex());
-				auto lock = frg::guard(&realm_->_mutex);
+				auto bucket = realm_->_getBucket(id_);
+				auto lock = frg::guard(&bucket->mutex);
 
 				if(f.read() != expected_) {
 					result_ = Error::futexRace;
@@ -152,14 +169,8 @@ public:
 					return true;
 				}
 
-				auto sit = realm_->_slots.get(id_);
-				if(!sit) {
-					realm_->_slots.insert(id_, Slot());
-					sit = realm_->_slots.get(id_);
-				}
-
 				assert(!queueHook_.in_list);
-				sit->queue.push_back(this);
+				bucket->queue.push_back(this);
 				return false;
 			}(); // Immediately invoked.
 
@@ -210,60 +221,162 @@ public:
 
 	// ----------------------------------------------------------------------------------
 
-	void wake(FutexIdentity id) {
-		frg::intrusive_list<
-			Node,
-			frg::locate_member<
-				Node,
-				frg::default_list_hook<Node>,
-				&Node::queueHook_
-			>
-		> pending;
+	// Wakes up to count waiters. Returns the number of woken waiters.
+	size_t wake(FutexIdentity id, size_t count = static_cast<size_t>(-1)) {
+		NodeList pending;
+		size_t numWoken;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto bucket = _getBucket(id);
+			auto lock = frg::guard(&bucket->mutex);
+
+			numWoken = _wakeLocked(bucket, id, count, pending);
+		}
+
+		_completePending(pending);
+		return numWoken;
+	}
+
+	// Wakes up to wakeCount waiters of the futex and moves up to requeueCount
+	// of the remaining waiters to the target futex (without waking them).
+	// Fails with futexRace if the futex does not hold the expected value.
+	// Returns the number of woken waiters.
+	template<Futex F>
+	frg::expected<Error, size_t> requeue(F f, FutexIdentity target, unsigned int expected,
+			size_t wakeCount, size_t requeueCount) {
+		auto id = f.getIdentity();
+
+		NodeList pending;
+		size_t numWoken = 0;
+		bool race = false;
 		{
 			auto irqLock = frg::guard(&irqMutex());
-			auto lock = frg::guard(&_mutex);
-
-			auto sit = _slots.get(id);
-			if(!sit)
-				return;
-			// Invariant: If the slot exists then its queue is not empty.
-			assert(!sit->queue.empty());
-
-			// TODO: Enable users to only wake a certain number of waiters.
-			while(!sit->queue.empty()) {
-				auto node = sit->queue.front();
-				assert(!node->result_);
-				sit->queue.pop_front();
-
-				if(node->cobs_.try_reset()) {
-					node->result_ = Error::success;
-					pending.push_back(node);
+			auto source = _getBucket(id);
+			auto dest = _getBucket(target);
+			_lockPair(source, dest);
+
+			if(f.read() == expected) {
+				numWoken = _wakeLocked(source, id, wakeCount, pending);
+
+				size_t numMoved = 0;
+				auto it = source->queue.begin();
+				while(it != source->queue.end() && numMoved < requeueCount) {
+					auto node = *it;
+					++it;
+					if(!(node->id_ == id))
+						continue;
+					source->queue.erase(source->queue.iterator_to(node));
+					node->id_ = target;
+					node->bucket_.store(dest, std::memory_order_relaxed);
+					dest->queue.push_back(node);
+					++numMoved;
 				}
+			}else{
+				race = true;
 			}
 
-			if(sit->queue.empty())
-				_slots.remove(id);
+			_unlockPair(source, dest);
+		}
+
+		f.retire();
+
+		_completePending(pending);
+		if(race)
+			return Error::futexRace;
+		return numWoken;
+	}
+
+	// Calls modify() while holding the locks of both futexes. Wakes up to count waiters
+	// of the first futex and, if modify() returned true, up to count2 waiters of the second.
+	// Returns the total number of woken waiters.
+	template<typename M>
+	size_t wakeOp(FutexIdentity id, FutexIdentity id2, size_t count, size_t count2, M modify) {
+		NodeList pending;
+		size_t numWoken;
+		{
+			auto irqLock = frg::guard(&irqMutex());
+			auto bucket = _getBucket(id);
+			auto bucket2 = _getBucket(id2);
+			_lockPair(bucket, bucket2);
+
+			bool wakeSecond = modify();
+			numWoken = _wakeLocked(bucket, id, count, pending);
+			if(wakeSecond)
+				numWoken += _wakeLocked(bucket2, id2, count2, pending);
+
+			_unlockPair(bucket, bucket2);
+		}
+
+		_completePending(pending);
+		return numWoken;
+	}
+
+private:
+	Bucket *_getBucket(FutexIdentity id) {
+		return &_buckets[FutexIdentity::Hash{}(id) & (numBuckets - 1)];
+	}
+
+	// Locks the bucket that currently contains the node.
+	// Since the node can be requeued concurrently, we need to retry.
+	Bucket *_lockBucketOf(Node *node) {
+		while(true) {
+			auto bucket = node->bucket_.load(std::memory_order_relaxed);
+			bucket->mutex.lock();
+			if(node->bucket_.load(std::memory_order_relaxed) == bucket)
+				return bucket;
+			bucket->mutex.unlock();
+		}
+	}
+
+	// Locks two buckets in a consistent order to avoid deadlocks.
+	void _lockPair(Bucket *a, Bucket *b) {
+		if(a == b) {
+			a->mutex.lock();
+		}else if(a < b) {
+			a->mutex.lock();
+			b->mutex.lock();
+		}else{
+			b->mutex.lock();
+			a->mutex.lock();
+		}
+	}
+
+	void _unlockPair(Bucket *a, Bucket *b) {
+		a->mutex.unlock();
+		if(a != b)
+			b->mutex.unlock();
+	}
+
+	// Must be called with the bucket's lock held.
+	size_t _wakeLocked(Bucket *bucket, FutexIdentity id, size_t count, NodeList &pending) {
+		size_t numWoken = 0;
+		auto it = bucket->queue.begin();
+		while(it != bucket->queue.end() && numWoken < count) {
+			auto node = *it;
+			++it;
+			if(!(node->id_ == id))
+				continue;
+			assert(!node->result_);
+
+			// If this fails, the node is being cancelled; cancel_() removes it from the queue.
+			if(!node->cobs_.try_reset())
+				continue;
+			bucket->queue.erase(bucket->queue.iterator_to(node));
+			node->result_ = Error::success;
+			pending.push_back(node);
+			++numWoken;
 		}
+		return numWoken;
+	}
 
+	void _completePending(NodeList &pending) {
 		while(!pending.empty()) {
 			auto node = pending.pop_front();
 			node->complete();
 		}
 	}
 
-private:
-	using Mutex = frg::ticket_spinlock;
-
-	// TODO: use a scalable hash table with fine-grained locks to
-	// improve the scalability of the futex algorithm.
-	Mutex _mutex;
-
-	frg::hash_map<
-		FutexIdentity,
-		Slot,
-		FutexIdentity::Hash,
-		KernelAlloc
-	> _slots;
+	Bucket _buckets[numBuckets];
 };
 
 } // namespace thor
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <frg/list.hpp>
+#include <frg/spinlock.hpp>
+#include <thor-internal/address-space.hpp>
+#include <thor-internal/types.hpp>
+
+namespace thor {
+
+// Background promotion of 4 KiB mappings to huge pages (similar to Linux' khugepaged).
+// A fiber periodically scans registered spaces for 2 MiB ranges that are completely
+// populated; these ranges are migrated into contiguous physical memory and remapped.
+struct HugePageCollapser {
+	// Default scan rate: examine 64 ranges (i.e., up to 128 MiB) every 100 ms.
+	static constexpr size_t defaultRangesPerScan = 64;
+	static constexpr uint64_t defaultScanInterval = 100'000'000;
+
+	struct Stats {
+		uint64_t scannedRanges;
+		uint64_t promotions;
+		uint64_t failures;
+		// Populated ranges that were skipped since their memory cannot be migrated
+		// (e.g., non-swappable AllocatedMemory).
+		uint64_t skippedRanges;
+	};
+
+	HugePageCollapser() = default;
+
+	HugePageCollapser(const HugePageCollapser &) = delete;
+
+	HugePageCollapser &operator= (const HugePageCollapser &) = delete;
+
+	// Spaces must be unregistered before they are destructed.
+	void registerSpace(VirtualSpace *space);
+	void unregisterSpace(VirtualSpace *space);
+
+	// Sets the number of 2 MiB ranges that are examined per scan
+	// and the time between two scans (in nanoseconds).
+	void setScanRate(size_t rangesPerScan, uint64_t scanInterval);
+
+	Stats getStats();
+
+	void run();
+
+private:
+	void _scan();
+
+	frg::ticket_spinlock _mutex;
+
+	frg::intrusive_list<
+		VirtualSpace,
+		frg::locate_member<
+			VirtualSpace,
+			frg::default_list_hook<VirtualSpace>,
+			&VirtualSpace::collapseHook
+		>
+	> _spaces;
+
+	// Current position of the scan.
+	VirtualSpace *_current = nullptr;
+	VirtualAddr _cursor = 0;
+
+	size_t _rangesPerScan = defaultRangesPerScan;
+	uint64_t _scanInterval = defaultScanInterval;
+
+	uint64_t _scannedRanges = 0;
+	uint64_t _promotions = 0;
+	uint64_t _failures = 0;
+	uint64_t _skippedRanges = 0;
+};
+
+HugePageCollapser *getHugePageCollapser();
+
+} // namespace thor
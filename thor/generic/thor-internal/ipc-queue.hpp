@@ -19,7 +19,9 @@ static const int kHeadWaiters = (1 << 24);
 
 struct QueueStruct {
 	int headFutex;
-	char padding[4];
+	// Duration (in nanoseconds) that consumers should poll before they block on a futex.
+	// Only written by the kernel for queues that use adaptive spinning.
+	unsigned int spinHint;
 	int indexQueue[];
 };
 
@@ -93,7 +95,26 @@ private:
 	using Mutex = frg::ticket_spinlock;
 
 public:
-	IpcQueue(unsigned int ringShift, unsigned int numChunks, size_t chunkSize);
+	struct Stats {
+		// Number of elements that were written to user space.
+		uint64_t numElements;
+		// Number of times that the progress futex was published.
+		uint64_t numBatches;
+		// Number of chunks that were retired.
+		uint64_t numChunks;
+		// Number of futex wakes (i.e., batches that found a blocked consumer).
+		uint64_t numWakes;
+		// Number of batches after which consumers were told to poll (adaptive spinning only).
+		uint64_t numSpinHints;
+		// Most recently published spinHint.
+		unsigned int spinHint;
+	};
+
+	// Upper bound for spinHint.
+	static constexpr uint64_t maxSpinNanos = 50'000;
+
+	IpcQueue(unsigned int ringShift, unsigned int numChunks, size_t chunkSize,
+			bool adaptiveSpin = false);
 
 	IpcQueue(const IpcQueue &) = delete;
 
@@ -109,6 +130,8 @@ public:
 
 	void submit(IpcNode *node);
 
+	Stats getStats();
+
 	// ----------------------------------------------------------------------------------
 	// Sender boilerplate for submit()
 	// ----------------------------------------------------------------------------------
@@ -166,6 +189,10 @@ public:
 private:
 	coroutine<void> _runQueue();
 
+	static size_t _elementLength(IpcNode *node);
+
+	void _updateSpinHint(QueueStruct *head);
+
 private:
 	Mutex _mutex;
 
@@ -173,6 +200,7 @@ private:
 
 	unsigned int _ringShift;
 	size_t _chunkSize;
+	bool _adaptiveSpin;
 
 	frg::vector<size_t, KernelAlloc> _chunkOffsets;
 
@@ -195,6 +223,18 @@ private:
 	// Stores whether any nodes are in the queue.
 	// Written only when _mutex is held (but read outside of _mutex).
 	std::atomic<bool> _anyNodes;
+
+	// Written only by _runQueue().
+	std::atomic<uint64_t> _numElements{0};
+	std::atomic<uint64_t> _numBatches{0};
+	std::atomic<uint64_t> _numChunks{0};
+	std::atomic<uint64_t> _numWakes{0};
+	std::atomic<uint64_t> _numSpinHints{0};
+	std::atomic<unsigned int> _spinHint{0};
+
+	// State of the adaptive spinning heuristic. Accessed only by _runQueue().
+	uint64_t _lastBatchNanos = 0;
+	uint64_t _avgGapNanos = 0;
 };
 
 } // namespace thor
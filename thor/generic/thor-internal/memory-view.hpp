@@ -3,6 +3,7 @@
 #include <cstddef>
 
 #include <async/algorithm.hpp>
+#include <async/cancellation.hpp>
 #include <async/oneshot-event.hpp>
 #include <async/post-ack.hpp>
 #include <async/recurring-event.hpp>
@@ -10,6 +11,7 @@
 #include <frg/vector.hpp>
 #include <frg/expected.hpp>
 #include <thor-internal/arch/paging.hpp>
+#include <thor-internal/compressed-pool.hpp>
 #include <thor-internal/error.hpp>
 #include <thor-internal/futex.hpp>
 #include <thor-internal/types.hpp>
@@ -282,6 +284,11 @@ public:
 
 	virtual void fork(async::any_receiver<frg::tuple<Error, smarter::shared_ptr<MemoryView>>> receiver);
 
+	// Like fork() but the new view only covers a page-aligned range of this view.
+	// Other pages of this view are not affected.
+	virtual coroutine<frg::expected<Error, smarter::shared_ptr<MemoryView>>>
+	forkRange(uintptr_t offset, size_t size);
+
 	virtual coroutine<frg::expected<Error>> copyTo(uintptr_t offset,
 			const void *pointer, size_t size,
 			smarter::shared_ptr<WorkQueue> wq);
@@ -316,6 +323,11 @@ public:
 	// Marks a range of pages as dirty.
 	virtual void markDirty(uintptr_t offset, size_t size) = 0;
 
+	// Makes a fully populated, 2 MiB-aligned range physically contiguous
+	// (by migrating pages if necessary) and returns its physical address.
+	// Like the result of peekRange(), the result stays valid until the range is evicted.
+	virtual coroutine<frg::expected<Error, PhysicalAddr>> collapseRange(uintptr_t offset);
+
 	virtual void submitManage(ManageNode *handle);
 
 	// Called (e.g. by user space) to update a range after loading or writeback.
@@ -523,6 +535,11 @@ public:
 		return {this};
 	}
 
+	friend async::sender_awaiter<ForkSender, frg::tuple<Error, smarter::shared_ptr<MemoryView>>>
+	operator co_await(ForkSender sender) {
+		return {sender};
+	}
+
 	template<typename R>
 	struct ForkOperation {
 		ForkOperation(ForkSender s, R receiver)
@@ -790,9 +807,99 @@ private:
 	CachingMode _cacheMode;
 };
 
+// Physical memory of the initrd image.
+// eir reserves the image outside of the regions of the physical allocator,
+// hence its pages stay allocated even if no InitrdMemory refers to them anymore.
+struct InitrdImage {
+	InitrdImage(PhysicalAddr base, size_t length);
+
+	InitrdImage(const InitrdImage &) = delete;
+
+	InitrdImage &operator= (const InitrdImage &) = delete;
+
+	PhysicalAddr physicalBase() {
+		return _base;
+	}
+
+	size_t length() {
+		return _length;
+	}
+
+	// Copies data out of the image (through the physical memory window).
+	void read(uintptr_t offset, void *pointer, size_t size);
+
+private:
+	PhysicalAddr _base;
+	size_t _length;
+};
+
+// Memory that backs a file of the initrd image without copying it upfront.
+// Pages that are page-aligned within the image are mapped directly. All other pages
+// (including the partial page at the end of the file) are copied on first access.
+// Note that CPIO only aligns file data to 4 bytes; hence, only files that happen
+// to start at a page boundary are mapped directly.
+struct InitrdMemory final : MemoryView {
+	InitrdMemory(smarter::shared_ptr<InitrdImage> image, uintptr_t imageOffset,
+			size_t fileSize);
+	InitrdMemory(const InitrdMemory &) = delete;
+	~InitrdMemory();
+
+	InitrdMemory &operator= (const InitrdMemory &) = delete;
+
+	size_t getLength() override;
+	frg::expected<Error, frg::tuple<smarter::shared_ptr<GlobalFutexSpace>, uintptr_t>>
+			resolveGlobalFutex(uintptr_t offset) override;
+	coroutine<frg::expected<Error>> copyFrom(uintptr_t offset,
+			void *pointer, size_t size,
+			smarter::shared_ptr<WorkQueue> wq) override;
+	Error lockRange(uintptr_t offset, size_t size) override;
+	void unlockRange(uintptr_t offset, size_t size) override;
+	frg::tuple<PhysicalAddr, CachingMode> peekRange(uintptr_t offset) override;
+	coroutine<frg::expected<Error, PhysicalRange>>
+			fetchRange(uintptr_t offset, FetchFlags flags,
+			smarter::shared_ptr<WorkQueue> wq) override;
+	void markDirty(uintptr_t offset, size_t size) override;
+
+private:
+	// Number of pages at the start of the file that are mapped directly.
+	size_t _numDirectPages() {
+		if(_imageOffset & (kPageSize - 1))
+			return 0;
+		return _fileSize >> kPageShift;
+	}
+
+	frg::ticket_spinlock _mutex;
+
+	smarter::shared_ptr<InitrdImage> _image;
+	uintptr_t _imageOffset;
+	size_t _fileSize;
+
+	// Private copies of pages that are not mapped directly.
+	frg::vector<PhysicalAddr, KernelAlloc> _copies;
+	// Number of pages that still need to be copied out of the image.
+	size_t _numPending;
+};
+
+struct AllocatedMemory;
+
+// Reclaim state of swappable AllocatedMemory. This is kept separate from the
+// AllocatedMemory since the swap-out coroutine can outlive the memory object.
+struct AnonymousSwapBundle : CacheBundle {
+	frg::ticket_spinlock mutex;
+
+	// Protected by mutex. Reset to nullptr when the AllocatedMemory is destructed.
+	AllocatedMemory *owner = nullptr;
+
+	async::cancellation_event cancelReclaim;
+	EvictionQueue evictQueue;
+};
+
 struct AllocatedMemory final : MemoryView, GlobalFutexSpace {
+	// If swappable is true, pages can be evicted and compressed by the reclaimer.
+	// This requires chunkSize == kPageSize.
 	AllocatedMemory(size_t length, int addressBits = 64,
-			size_t chunkSize = kPageSize, size_t chunkAlign = kPageSize);
+			size_t chunkSize = kPageSize, size_t chunkAlign = kPageSize,
+			bool swappable = false);
 	AllocatedMemory(const AllocatedMemory &) = delete;
 	~AllocatedMemory();
 
@@ -809,6 +916,7 @@ struct AllocatedMemory final : MemoryView, GlobalFutexSpace {
 			fetchRange(uintptr_t offset, FetchFlags flags,
 			smarter::shared_ptr<WorkQueue> wq) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	coroutine<frg::expected<Error, PhysicalAddr>> collapseRange(uintptr_t offset) override;
 
 	coroutine<frg::expected<Error, PhysicalAddr>> takeGlobalFutex(uintptr_t offset,
 			smarter::shared_ptr<WorkQueue> wq) override;
@@ -818,11 +926,60 @@ public:
 	// Contract: set by the code that constructs this object.
 	smarter::borrowed_ptr<AllocatedMemory> selfPtr;
 private:
+	enum class SwapState {
+		// No physical page is allocated.
+		missing,
+		// Page is present; it is in the reclaimer's LRU iff lockCount is zero.
+		present,
+		// Page is being unmapped from all mappings before compression.
+		evicting,
+		// Page is owned by the swap-out coroutine while it is being compressed.
+		compressing,
+		// Page is being copied into a huge page by collapseRange().
+		migrating,
+		// Page only exists in compressed form.
+		swapped,
+		// Page is being decompressed by _loadCompressed().
+		loading
+	};
+
+	struct SwapPage {
+		SwapPage(CacheBundle *bundle, uint64_t identity) {
+			cachePage.bundle = bundle;
+			cachePage.identity = identity;
+		}
+
+		SwapPage(const SwapPage &) = delete;
+
+		SwapPage &operator= (const SwapPage &) = delete;
+
+		SwapState state = SwapState::missing;
+		unsigned int lockCount = 0;
+		CompressedPool::Handle compressed;
+		CachePage cachePage;
+	};
+
+	AllocatedMemory(size_t length, int addressBits, size_t chunkSize, size_t chunkAlign,
+			smarter::shared_ptr<AnonymousSwapBundle> swap);
+
+	// Decompresses the page at index (if it is swapped out) without holding _mutex.
+	coroutine<void> _loadCompressed(size_t index);
+
+	// Called with _mutex held. Makes the page at index present,
+	// unless it is compressed (see _loadCompressed()).
+	void _swapIn(size_t index, SwapPage *page);
+
 	frg::ticket_spinlock _mutex;
 
 	frg::vector<PhysicalAddr, KernelAlloc> _physicalChunks;
 	int _addressBits;
 	size_t _chunkSize, _chunkAlign;
+
+	// Only used for swappable memory.
+	smarter::shared_ptr<AnonymousSwapBundle> _swap;
+	frg::rcu_radixtree<SwapPage, KernelAlloc> _swapPages;
+	// Raised when a page leaves the loading state.
+	async::recurring_event _loadEvent;
 };
 
 struct ManagedSpace : CacheBundle {
@@ -1034,6 +1191,8 @@ struct CowChain {
 
 	smarter::shared_ptr<CowChain> _superChain;
 	frg::rcu_radixtree<std::atomic<PhysicalAddr>, KernelAlloc> _pages;
+	// Number of chains (including this one) that lookups may need to walk.
+	unsigned int _depth;
 };
 
 struct CopyOnWriteMemory final : MemoryView, GlobalFutexSpace /*, MemoryObserver */ {
@@ -1049,6 +1208,8 @@ public:
 
 	size_t getLength() override;
 	void fork(async::any_receiver<frg::tuple<Error, smarter::shared_ptr<MemoryView>>> receiver) override;
+	coroutine<frg::expected<Error, smarter::shared_ptr<MemoryView>>>
+			forkRange(uintptr_t offset, size_t size) override;
 	frg::expected<Error, frg::tuple<smarter::shared_ptr<GlobalFutexSpace>, uintptr_t>>
 			resolveGlobalFutex(uintptr_t offset) override;
 	Error lockRange(uintptr_t offset, size_t size) override;
@@ -1140,6 +1301,20 @@ struct GlobalFutex {
 		return __atomic_load_n(accessPtr, __ATOMIC_RELAXED);
 	}
 
+	// Atomically replaces the futex word by fn(word). Returns the previous value.
+	template<typename Fn>
+	unsigned int update(Fn fn) {
+		PageAccessor accessor{physical_};
+		auto offsetOfWord = offset_ & (kPageSize - 1);
+		auto accessPtr = reinterpret_cast<unsigned int *>(
+				reinterpret_cast<std::byte *>(accessor.get()) + offsetOfWord);
+		auto word = __atomic_load_n(accessPtr, __ATOMIC_RELAXED);
+		while(!__atomic_compare_exchange_n(accessPtr, &word, fn(word), false,
+				__ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+			;
+		return word;
+	}
+
 	void retire() {
 		space_->retireGlobalFutex(offset_);
 		space_ = nullptr;
@@ -36,6 +36,9 @@ public:
 	PhysicalAddr allocate(size_t size, int addressBits = 64);
 	void free(PhysicalAddr address, size_t size);
 
+	// Splits an allocated chunk such that its pages can be freed individually.
+	void split(PhysicalAddr address, size_t size);
+
 	size_t numTotalPages() {
 		return _totalPages.load(std::memory_order_relaxed);
 	}
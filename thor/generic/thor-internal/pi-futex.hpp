@@ -0,0 +1,129 @@
+#pragma once
+
+#include <async/oneshot-event.hpp>
+#include <frg/hash_map.hpp>
+#include <frg/list.hpp>
+#include <frg/spinlock.hpp>
+#include <thor-internal/error.hpp>
+#include <thor-internal/futex.hpp>
+#include <thor-internal/kernel_heap.hpp>
+#include <thor-internal/memory-view.hpp>
+
+namespace thor {
+
+struct Thread;
+
+// Priority-inheritance futexes (similar to Linux' FUTEX_LOCK_PI).
+// The futex word contains the TID of the owner; user space acquires and releases
+// uncontended locks by compare-and-swap and only enters the kernel on contention.
+// While threads are blocked on the futex, the owner inherits the highest priority
+// of all blocked threads. Boosts propagate along chains of blocked owners.
+//
+// All PI state is protected by a single lock. The kernel is only entered on contention,
+// thus we prefer the simplicity of the global lock over finer-grained locking.
+//
+// Known limitation: inherited priorities only affect the fair scheduling class.
+// Real-time (FIFO/RR) priorities of blocked threads are not inherited by owners,
+// and owners in the real-time classes ignore inherited priorities.
+struct PiFutexRealm {
+	// Layout of the futex word.
+	static constexpr unsigned int ownerMask = 0x3FFF'FFFF;
+	// Set if the previous owner terminated while holding the lock.
+	static constexpr unsigned int ownerDiedBit = 0x4000'0000;
+	// Set if there are blocked threads; the owner needs to unlock through the kernel.
+	static constexpr unsigned int waitersBit = 0x8000'0000;
+
+	// Boosts are propagated along at most this many owners.
+	// This bounds the time spent in the realm's lock and breaks cycles of blocked threads.
+	static constexpr int maxChainDepth = 16;
+
+	// Returns the TID that identifies the thread in futex words.
+	static uint32_t tidOf(Thread *thread);
+
+	PiFutexRealm();
+
+	PiFutexRealm(const PiFutexRealm &) = delete;
+
+	PiFutexRealm &operator= (const PiFutexRealm &) = delete;
+
+	// Called when threads are created and when they terminate.
+	// Locks that are held by a terminating thread are passed on to blocked threads.
+	// releaseThread() may be called multiple times; only the first call has an effect.
+	void registerThread(Thread *thread);
+	void releaseThread(Thread *thread);
+
+	// The following functions write the futex word. Hence, callers must only pass
+	// futexes that are grabbed from writable mappings.
+
+	// Blocks the current thread until it owns the futex.
+	// Returns illegalState if the current thread already owns the futex.
+	Error lock(GlobalFutex &futex);
+
+	// Passes the futex on to the highest-priority blocked thread (if any).
+	// Returns illegalState if the current thread does not own the futex.
+	Error unlock(GlobalFutex &futex);
+
+private:
+	struct Owner;
+
+	// Represents a thread that is blocked in lock().
+	struct Waiter {
+		FutexIdentity id;
+		// Pinned by the blocked thread until it returns from lock().
+		GlobalFutex *futex;
+		// PI state of the blocked thread.
+		Owner *self;
+		// Current owner of the futex (which inherits our priority).
+		Owner *owner;
+		// Effective priority of the blocked thread.
+		int priority;
+		async::oneshot_event granted;
+		frg::default_list_hook<Waiter> hook;
+	};
+
+	using WaiterList = frg::intrusive_list<
+		Waiter,
+		frg::locate_member<
+			Waiter,
+			frg::default_list_hook<Waiter>,
+			&Waiter::hook
+		>
+	>;
+
+	// PI state of a single thread.
+	struct Owner {
+		Thread *thread;
+		uint32_t tid;
+		// Threads that are blocked on futexes that are owned by this thread.
+		WaiterList waiters;
+		// Set while this thread is blocked in lock().
+		Waiter *blockedOn = nullptr;
+		// Priority that was passed to Scheduler::setInheritedPriority().
+		int inheritedPriority;
+	};
+
+	Owner *_findOwner(Thread *thread);
+
+	// Priority of the thread including inherited priority.
+	static int effectivePriority_(Owner *owner);
+
+	// Passes the futex (which is held by the owner) on to its highest-priority waiter.
+	// Returns that waiter (which needs to be woken up) or null if there are no waiters.
+	Waiter *_handOver(Owner *owner, FutexIdentity id, unsigned int extraBits);
+
+	// Recomputes the inherited priority of the owner and propagates it along the chain.
+	void _propagate(Owner *owner);
+
+	frg::ticket_spinlock _mutex;
+
+	frg::hash_map<
+		uint32_t,
+		Owner *,
+		frg::hash<uint32_t>,
+		KernelAlloc
+	> _owners;
+};
+
+PiFutexRealm *getPiFutexRealm();
+
+} // namespace thor
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+
+#include <frg/list.hpp>
+#include <thor-internal/arch/ints.hpp>
+#include <thor-internal/cpu-data.hpp>
+
+namespace thor {
+
+// Epoch-based read-copy-update.
+//
+// Readers publish the global epoch in their CpuData while they are inside a
+// read-side critical section. Objects that are unlinked from a data structure
+// are retired with the current epoch; they are reclaimed once no CPU is inside
+// a critical section that started before the object was unlinked.
+//
+// Read-side critical sections must run with IRQs disabled and must not block.
+
+extern std::atomic<uint64_t> globalRcuEpoch;
+
+struct RcuReadGuard {
+	RcuReadGuard()
+	: _cpuData{getCpuData()} {
+		assert(!intsAreEnabled());
+		_outer = _cpuData->rcuEpoch.load(std::memory_order_relaxed);
+		if(!_outer) {
+			_cpuData->rcuEpoch.store(globalRcuEpoch.load(std::memory_order_seq_cst),
+					std::memory_order_relaxed);
+			// Orders the epoch before all reads of the protected data (a seq_cst store
+			// alone does not order later plain loads on all architectures).
+			// Pairs with the fence in the grace-period scan.
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+		}
+	}
+
+	RcuReadGuard(const RcuReadGuard &) = delete;
+
+	~RcuReadGuard() {
+		if(!_outer)
+			_cpuData->rcuEpoch.store(0, std::memory_order_release);
+	}
+
+	RcuReadGuard &operator= (const RcuReadGuard &) = delete;
+
+private:
+	CpuData *_cpuData;
+	uint64_t _outer;
+};
+
+struct RcuCallback {
+protected:
+	~RcuCallback() = default;
+
+public:
+	// Called (from a kernel fiber) after the grace period has elapsed.
+	virtual void reclaim() = 0;
+
+	uint64_t epoch = 0;
+	frg::default_list_hook<RcuCallback> hook;
+};
+
+// Calls callback->reclaim() once all readers that might still see the object are done.
+// The object must already be unreachable for new readers.
+void rcuRetire(RcuCallback *callback);
+
+} // namespace thor
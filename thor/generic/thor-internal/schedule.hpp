@@ -1,15 +1,19 @@
 #pragma once
 
+#include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <atomic>
 
 #include <frg/list.hpp>
 #include <frg/pairing_heap.hpp>
 #include <frg/spinlock.hpp>
+#include <smarter.hpp>
 
 namespace thor {
 
 struct Scheduler;
+struct RtRunQueue;
 struct CpuData;
 
 enum class ScheduleType {
@@ -18,6 +22,26 @@ enum class ScheduleType {
 	regular
 };
 
+enum class SchedulePolicy {
+	// Fair-share scheduling among entities of equal priority.
+	fair,
+	// Fixed-priority real-time scheduling (similar to SCHED_FIFO and SCHED_RR).
+	// Real-time entities always preempt entities of the fair class.
+	fifo,
+	roundRobin,
+	// Earliest-deadline-first scheduling of CPU reservations (similar to SCHED_DEADLINE).
+	// Deadline entities always preempt real-time and fair entities.
+	deadline
+};
+
+// Reservation of a deadline entity: it may run for runtime ns within deadline ns
+// after the start of each period. All values are in nanoseconds.
+struct DeadlineParameters {
+	uint64_t runtime;
+	uint64_t deadline;
+	uint64_t period;
+};
+
 enum class ScheduleState {
 	null,
 	attached,
@@ -29,8 +53,87 @@ enum class ScheduleState {
 // For now, store it as 55.8 0 signed integer nanoseconds.
 using Progress = int64_t;
 
+// Group of entities that shares a weight and a bandwidth quota (similar to the weight
+// and max controls of Linux' cgroup CPU controller). Only entities of the fair class
+// are affected; real-time and deadline entities are accounted but never throttled.
+// The weight and the quota are fixed when the group is created.
+// Unlike cgroups, groups are flat: a group cannot be nested into another group.
+struct ScheduleGroup {
+	friend struct ScheduleEntity;
+	friend struct Scheduler;
+
+	// Weight of entities that are not part of any group.
+	static constexpr uint64_t defaultWeight = 100;
+	static constexpr uint64_t maxWeight = 10'000;
+
+	struct Stats {
+		// Time that the group's entities ran (in ns).
+		uint64_t usage;
+		// Number of periods in which the group exhausted its quota.
+		uint64_t throttles;
+	};
+
+	// The entities of the group may run for at most quota ns per period ns
+	// (summed over all CPUs). A quota of zero disables throttling.
+	ScheduleGroup(uint64_t weight, uint64_t quota, uint64_t period);
+
+	ScheduleGroup(const ScheduleGroup &) = delete;
+
+	ScheduleGroup &operator= (const ScheduleGroup &) = delete;
+
+	uint64_t weight() const {
+		return _weight;
+	}
+
+	Stats getStats();
+
+private:
+	// Called by schedulers with the runtime of the group's entities.
+	void _charge(uint64_t now, uint64_t runtime);
+
+	bool _isThrottled(uint64_t now);
+
+	// Remaining quota in the current period. Only valid if there is a quota.
+	uint64_t _quotaLeft(uint64_t now);
+
+	// Periods are aligned to multiples of the period length,
+	// hence all CPUs agree on the end of the current period.
+	uint64_t _periodEnd(uint64_t now) {
+		return (now / _period + 1) * _period;
+	}
+
+	// Starts a new period if necessary. Called with _mutex held.
+	void _refresh(uint64_t now);
+
+	const uint64_t _weight;
+	const uint64_t _quota;
+	const uint64_t _period;
+
+	// Protects the state of the current period.
+	frg::ticket_spinlock _mutex;
+
+	uint64_t _periodIndex = 0;
+	uint64_t _consumed = 0;
+
+	std::atomic<uint64_t> _usage{0};
+	std::atomic<uint64_t> _numThrottles{0};
+
+	// Number of active (i.e., queued or running) entities of the group on all CPUs.
+	// The group's weight is divided among them.
+	std::atomic<uint64_t> _numActive{0};
+};
+
 struct ScheduleEntity {
 	friend struct Scheduler;
+	friend struct RtRunQueue;
+	friend struct DeadlineGreater;
+	friend struct ReplenishGreater;
+
+	// Value of the inherited priority if the entity does not inherit any priority.
+	static constexpr int noInheritedPriority = INT_MIN;
+
+	// Real-time priorities are 0, ..., numRtPriorities - 1; larger values are preferred.
+	static constexpr int numRtPriorities = 64;
 
 	static int orderPriority(const ScheduleEntity *a, const ScheduleEntity *b);
 	static bool scheduleBefore(const ScheduleEntity *a, const ScheduleEntity *b);
@@ -53,11 +156,82 @@ public:
 
 	virtual void handlePreemption(IrqImageAccessor image) = 0;
 
+	// Called by the load balancer to decide whether a waiting entity can be moved
+	// to another CPU. Entities that are bound to their CPU keep the default.
+	virtual bool mayMigrateTo(int cpu) {
+		(void)cpu;
+		return false;
+	}
+
+	// Called by Scheduler::resumeNear() to decide whether a waking entity can be moved
+	// to another CPU. Called with the same locks held as resumeNear().
+	virtual bool mayWakeOn(int cpu) {
+		(void)cpu;
+		return false;
+	}
+
 	uint64_t runTime() {
 		return _runTime;
 	}
 
+	uint64_t numMigrations() {
+		return _numMigrations;
+	}
+
+	// Priority that was set by Scheduler::setPriority(), i.e., without inherited priority.
+	int basePriority() const {
+		return priority;
+	}
+
+	SchedulePolicy policy() const {
+		return policy_;
+	}
+
+	int rtPriority() const {
+		return rtPriority_;
+	}
+
+	bool isRealTime() const {
+		return policy_ == SchedulePolicy::fifo || policy_ == SchedulePolicy::roundRobin;
+	}
+
+	// Deadline entities that overran their budget are demoted to the fair class
+	// until their budget is replenished at the start of the next period.
+	bool isDeadline() const {
+		return policy_ == SchedulePolicy::deadline && !dlDemoted;
+	}
+
+	bool isFair() const {
+		return !isRealTime() && !isDeadline();
+	}
+
+	uint64_t numDeadlineMisses() {
+		return _numDeadlineMisses;
+	}
+
+	uint64_t numBudgetOverruns() {
+		return _numBudgetOverruns;
+	}
+
+	// Weight within the fair class. Entities of a group share the group's weight,
+	// such that adding entities to a group does not increase the group's share of the CPU.
+	// Each entity gets a weight of at least one, even if the group has more active
+	// entities than its weight.
+	uint64_t weight() const {
+		if(!_group)
+			return ScheduleGroup::defaultWeight;
+		auto numActive = _group->_numActive.load(std::memory_order_relaxed);
+		if(numActive <= 1)
+			return _group->weight();
+		auto share = _group->weight() / numActive;
+		return share ? share : 1;
+	}
+
 private:
+	int effectivePriority_() const {
+		return priority > inheritedPriority ? priority : inheritedPriority;
+	}
+
 	const ScheduleType type_;
 
 	frg::ticket_spinlock _associationMutex;
@@ -66,11 +240,71 @@ private:
 	ScheduleState state;
 	int priority;
 
+	// Priority inherited through priority-inheritance futexes.
+	// Only changed by the entity's scheduler since the wait queue is ordered by it.
+	int inheritedPriority;
+
+	// Set by Scheduler::setInheritedPriority(), applied by the scheduler in update().
+	// Protected by the scheduler's _mutex.
+	int requestedInheritance;
+	bool inheritanceQueued;
+
+	// Only changed by the entity's scheduler since it determines the run queue.
+	SchedulePolicy policy_;
+	int rtPriority_;
+
+	// Set by Scheduler::setPolicy(), applied by the scheduler in update().
+	// Protected by the scheduler's _mutex.
+	SchedulePolicy requestedPolicy;
+	int requestedRtPriority;
+	DeadlineParameters requestedDlParams;
+	bool policyQueued;
+
+	// Remaining time of the round-robin quantum.
+	int64_t rrTimeLeft;
+
+	// State of deadline entities. Only changed by the entity's scheduler.
+	DeadlineParameters dlParams_;
+	uint64_t dlAbsDeadline;
+	int64_t dlBudget;
+	bool dlDemoted;
+	// Start of the next period. Demoted entities are replenished at this time.
+	uint64_t dlReplenishAt;
+
+	// Bandwidth that is reserved on the entity's scheduler (see Scheduler::setDeadline()).
+	// Protected by _associationMutex.
+	uint64_t dlReserved;
+
+	// Only changed by the entity's scheduler since the weight affects the unfairness.
+	smarter::shared_ptr<ScheduleGroup> _group;
+
+	// Set by Scheduler::setGroup(), applied by the scheduler in update().
+	// Protected by the scheduler's _mutex.
+	smarter::shared_ptr<ScheduleGroup> requestedGroup;
+	bool groupQueued;
+
+	// Set while the entity is parked in the scheduler's _throttledList.
+	bool groupThrottled;
+
+	// Weight that was added to the scheduler's _waitingWeight when the entity was queued.
+	// The weight can change while the entity is queued (see weight()).
+	uint64_t queuedWeight;
+
 	frg::default_list_hook<ScheduleEntity> listHook;
+	frg::default_list_hook<ScheduleEntity> inheritanceHook;
+	frg::default_list_hook<ScheduleEntity> policyHook;
+	frg::default_list_hook<ScheduleEntity> groupHook;
+	frg::default_list_hook<ScheduleEntity> throttleHook;
+	frg::default_list_hook<ScheduleEntity> rtHook;
 	frg::pairing_heap_hook<ScheduleEntity> heapHook;
+	frg::pairing_heap_hook<ScheduleEntity> dlHeapHook;
+	frg::pairing_heap_hook<ScheduleEntity> replenishHeapHook;
 
 	uint64_t _refClock;
 	uint64_t _runTime;
+	uint64_t _numMigrations;
+	uint64_t _numDeadlineMisses;
+	uint64_t _numBudgetOverruns;
 
 	// Scheduler::_systemProgress value at some slice T.
 	// Invariant: This entity's state did not change since T.
@@ -88,6 +322,48 @@ struct ScheduleGreater {
 	}
 };
 
+struct DeadlineGreater {
+	bool operator() (const ScheduleEntity *a, const ScheduleEntity *b) {
+		return a->dlAbsDeadline > b->dlAbsDeadline; // Prefer earlier deadlines.
+	}
+};
+
+struct ReplenishGreater {
+	bool operator() (const ScheduleEntity *a, const ScheduleEntity *b) {
+		return a->dlReplenishAt > b->dlReplenishAt;
+	}
+};
+
+// Run queue of the real-time class. Contains one FIFO list per priority and a bitmap
+// of non-empty lists, such that all operations take O(1) time.
+struct RtRunQueue {
+	bool empty() const {
+		return !_bitmap;
+	}
+
+	// Returns the first entity of the highest non-empty priority.
+	ScheduleEntity *top();
+
+	void pushBack(ScheduleEntity *entity);
+	void pushFront(ScheduleEntity *entity);
+	void remove(ScheduleEntity *entity);
+
+private:
+	using List = frg::intrusive_list<
+		ScheduleEntity,
+		frg::locate_member<
+			ScheduleEntity,
+			frg::default_list_hook<ScheduleEntity>,
+			&ScheduleEntity::rtHook
+		>
+	>;
+
+	static_assert(ScheduleEntity::numRtPriorities <= 64);
+
+	List _lists[ScheduleEntity::numRtPriorities];
+	uint64_t _bitmap = 0;
+};
+
 struct Scheduler {
 	// Note: the scheduler's methods (e.g., associate, unassociate, resume, ...)
 	// may be called from any CPU, *however*, calling them on the same ScheduleEntity is
@@ -96,11 +372,75 @@ struct Scheduler {
 	static void associate(ScheduleEntity *entity, Scheduler *scheduler);
 	static void unassociate(ScheduleEntity *entity);
 
+	// Moves an attached entity to another scheduler.
+	static void migrate(ScheduleEntity *entity, Scheduler *scheduler);
+
 	static void setPriority(ScheduleEntity *entity, int priority);
 
+	// Changes the priority that the entity inherits (in addition to its own priority).
+	// Unlike setPriority(), this can be called on entities that are not current.
+	// The change is applied asynchronously by the entity's scheduler.
+	static void setInheritedPriority(ScheduleEntity *entity, int priority);
+
+	// Changes the scheduling policy (and the real-time priority).
+	// Like setInheritedPriority(), this can be called on entities that are not current.
+	static void setPolicy(ScheduleEntity *entity, SchedulePolicy policy, int rtPriority);
+
+	// Moves the entity into a group (or out of its group if the group is null).
+	// Like setInheritedPriority(), this can be called on entities that are not current.
+	static void setGroup(ScheduleEntity *entity, smarter::shared_ptr<ScheduleGroup> group);
+
+	// Returns the entity's group, including changes that were not applied yet.
+	static smarter::shared_ptr<ScheduleGroup> getGroup(ScheduleEntity *entity);
+
+	// Turns the entity into a deadline entity with the given reservation.
+	// Returns false if the reservation does not fit onto the entity's CPU
+	// (i.e., if the sum of runtime / period would exceed the admission limit).
+	static bool setDeadline(ScheduleEntity *entity, DeadlineParameters params);
+
+	struct RealTimeConfig {
+		// Time slice of roundRobin entities (among entities of equal priority).
+		uint64_t rrQuantum;
+		// Real-time entities may only run for rtRuntime ns in each rtPeriod ns
+		// while fair entities are waiting. This prevents run-away real-time entities
+		// from starving the rest of the system. rtRuntime must be less than rtPeriod.
+		uint64_t rtRuntime;
+		uint64_t rtPeriod;
+	};
+
+	// Global parameters of the real-time class; they apply to all CPUs.
+	static RealTimeConfig getRealTimeConfig();
+	static void setRealTimeConfig(RealTimeConfig config);
+
 	static void resume(ScheduleEntity *entity);
 	static void suspendCurrent();
 
+	// Like resume() but hands the local CPU off to the entity (similar to L4's direct
+	// process switch): if the local CPU has nothing else to run, the entity is moved to
+	// the local scheduler and inherits the unfairness of the current entity.
+	// Only the first wake-up within a handoff window (see beginHandoff()) hands off;
+	// otherwise, this behaves like resumeNear().
+	// The caller has to ensure that the entity may run on the local CPU.
+	static void resumeWithHandoff(ScheduleEntity *entity);
+
+	// Like resume() but moves the entity to an idle CPU that shares the last-level cache
+	// with the local CPU (if there is one and ScheduleEntity::mayWakeOn() allows it).
+	// This keeps the caches of communicating entities warm.
+	static void resumeNear(ScheduleEntity *entity);
+
+	struct Stats {
+		// Ping IPIs that were sent to this scheduler.
+		uint64_t sentPings;
+		// Ping IPIs that were not necessary because the scheduler was local or polling.
+		uint64_t avoidedPings;
+		// Number of times that the real-time class exhausted its bandwidth.
+		uint64_t rtThrottles;
+		// Bandwidth that is reserved by deadline entities (as a fraction of 1 << 20).
+		uint64_t dlBandwidth;
+		// Wake-ups on this CPU that moved the entity to an idle CPU.
+		uint64_t affineWakeups;
+	};
+
 	Scheduler(CpuData *cpu_context);
 
 	Scheduler(const Scheduler &) = delete;
@@ -114,6 +454,10 @@ private:
 public:
 	void update();
 
+	// Performs load balancing. Called after update() when no locks are held.
+	// Serves requests of idle CPUs and periodically pushes entities to less loaded CPUs.
+	void balance();
+
 	bool maybeReschedule();
 	void forceReschedule();
 
@@ -122,10 +466,94 @@ public:
 
 	ScheduleEntity *currentRunnable();
 
+	// Called (with IRQs disabled) when a thread enters a syscall or a page fault.
+	// Until the thread calls endDeferredPings() before it returns to user space
+	// (or until the next context switch), local wake-ups do not send a ping IPI.
+	void beginDeferredPings() {
+		_deferLocalPings = true;
+	}
+
+	// Returns true if entities were resumed in the meantime.
+	// In this case, the caller needs to call update() and maybeReschedule().
+	bool endDeferredPings() {
+		_deferLocalPings = false;
+		return _needsReschedule.load(std::memory_order_relaxed);
+	}
+
+	// Called (with IRQs disabled) around wake-ups on the synchronous IPC reply path,
+	// i.e., when the woken entity is expected to consume what the current entity produced.
+	// Outside of this window, resumeWithHandoff() does not hand off the CPU.
+	void beginHandoff() {
+		_handoffWindow = true;
+	}
+
+	void endHandoff() {
+		_handoffWindow = false;
+	}
+
+	// Called by the idle task. Polls for resumed entities for a short time
+	// such that other CPUs do not need to send a ping IPI.
+	// Returns true if there are new entities.
+	bool pollIdle();
+
+	// Called by the idle task. Waits until entities are resumed and switches to them.
+	// If the architecture can monitor memory, stores to _needsReschedule wake up the CPU
+	// (without the need for a ping IPI). Otherwise, we halt until the next IRQ.
+	[[noreturn]] void runIdle();
+
+	Stats getStats();
+
 private:
-	void _unschedule();
+	// If preempted is false, the current entity yields (real-time entities are moved
+	// to the end of their priority's list).
+	void _unschedule(bool preempted);
 	void _schedule();
 
+	// Inserts an active entity into the run queue of its class.
+	// Preempted real-time entities keep their position within their priority.
+	void _enqueue(ScheduleEntity *entity, bool preempted);
+	void _dequeue(ScheduleEntity *entity);
+
+	// Changes the policy of an entity that is not in a run queue.
+	void _applyPolicy(ScheduleEntity *entity, SchedulePolicy policy, int rtPriority,
+			DeadlineParameters dlParams);
+
+	// Queues a policy change. Called with the entity's _associationMutex held.
+	static void _requestPolicy(ScheduleEntity *entity, SchedulePolicy policy, int rtPriority,
+			DeadlineParameters dlParams);
+
+	// Called when a deadline entity becomes active. Assigns a new deadline if necessary.
+	void _activateDeadline(ScheduleEntity *entity);
+
+	// Demotes the current entity on budget overruns and counts deadline misses.
+	void _checkDeadline(ScheduleEntity *entity);
+
+	// Promotes demoted entities whose budget is replenished.
+	void _replenishDeadlines();
+
+	// True if the entity belongs to a group that exhausted its quota.
+	bool _isThrottled(ScheduleEntity *entity);
+
+	// Moves entities whose group is not throttled anymore back to the wait queue.
+	void _unthrottleGroups();
+
+	// Starts new bandwidth periods and throttles the real-time class if necessary.
+	void _updateRtBandwidth();
+
+private:
+	// Makes sure that the scheduler notices pending work. Sends a ping IPI if necessary.
+	void _notify();
+
+	void _publishLoad();
+	void _requestWork();
+	void _pushTo(Scheduler *target);
+
+	// Whether the scheduler runs its idle task and has no pending work. This is only a hint.
+	bool _isIdle();
+
+	// Chooses the scheduler that an entity woken up by this CPU is resumed on.
+	Scheduler *_selectWakeTarget(ScheduleEntity *entity);
+
 private:
 	void _updatePreemption();
 
@@ -151,6 +579,110 @@ private:
 
 	size_t _numWaiting = 0;
 
+	// Sum of the weights of all entities in _waitQueue.
+	uint64_t _waitingWeight = 0;
+
+	// Active fair entities whose group exhausted its quota.
+	// They are neither in _waitQueue nor do they accumulate unfairness.
+	frg::intrusive_list<
+		ScheduleEntity,
+		frg::locate_member<
+			ScheduleEntity,
+			frg::default_list_hook<ScheduleEntity>,
+			&ScheduleEntity::throttleHook
+		>
+	> _throttledList;
+
+	// ----------------------------------------------------------------------------------
+	// Real-time class.
+	// ----------------------------------------------------------------------------------
+
+	RtRunQueue _rtQueue;
+
+	size_t _numRtWaiting = 0;
+
+	// Start of the current bandwidth period and the real-time runtime within it.
+	uint64_t _rtPeriodStart = 0;
+	uint64_t _rtRuntime = 0;
+
+	// Set while the real-time class exhausted its bandwidth.
+	// Real-time entities then only run if no fair entities are waiting.
+	bool _rtThrottled = false;
+
+	std::atomic<uint64_t> _numRtThrottles{0};
+
+	// ----------------------------------------------------------------------------------
+	// Deadline class.
+	// ----------------------------------------------------------------------------------
+
+	frg::pairing_heap<
+		ScheduleEntity,
+		frg::locate_member<
+			ScheduleEntity,
+			frg::pairing_heap_hook<ScheduleEntity>,
+			&ScheduleEntity::dlHeapHook
+		>,
+		DeadlineGreater
+	> _dlQueue;
+
+	size_t _numDlWaiting = 0;
+
+	// Demoted deadline entities that are active (i.e., queued or running).
+	// Demoted entities that are not active are replenished when they are resumed.
+	frg::pairing_heap<
+		ScheduleEntity,
+		frg::locate_member<
+			ScheduleEntity,
+			frg::pairing_heap_hook<ScheduleEntity>,
+			&ScheduleEntity::replenishHeapHook
+		>,
+		ReplenishGreater
+	> _dlReplenishQueue;
+
+	// Sum of runtime / period of all associated deadline entities (as a fraction of 1 << 20).
+	// Updated with atomic operations since entities on other CPUs may reserve bandwidth.
+	std::atomic<uint64_t> _dlBandwidth{0};
+
+	// ----------------------------------------------------------------------------------
+	// Load balancing.
+	// ----------------------------------------------------------------------------------
+
+	// Number of runnable entities (including the current one).
+	// Published for other CPUs; this is only a hint.
+	std::atomic<size_t> _load{0};
+
+	// Set by an idle CPU that wants this scheduler to push an entity to it.
+	std::atomic<Scheduler *> _stealRequest{nullptr};
+
+	// Next time at which the periodic balancer runs.
+	uint64_t _balanceDeadline = 0;
+
+	std::atomic<uint64_t> _numAffineWakeups{0};
+
+	// ----------------------------------------------------------------------------------
+	// IPI avoidance.
+	// ----------------------------------------------------------------------------------
+
+	// Set when work is queued for this scheduler; cleared by update().
+	std::atomic<bool> _needsReschedule{false};
+
+	// Set while the idle task polls or monitors _needsReschedule.
+	std::atomic<bool> _idlePolling{false};
+
+	// Only accessed by the local CPU. See beginDeferredPings().
+	bool _deferLocalPings = false;
+
+	std::atomic<uint64_t> _numSentPings{0};
+	std::atomic<uint64_t> _numAvoidedPings{0};
+
+	// Only accessed by the local CPU. See beginHandoff().
+	bool _handoffWindow = false;
+
+	// Entity that was resumed by resumeWithHandoff() and the entity that resumed it.
+	// The donor is only compared against _current, it is never dereferenced.
+	ScheduleEntity *_handoff = nullptr;
+	ScheduleEntity *_handoffDonor = nullptr;
+
 	// The last tick at which the scheduler's state (i.e. progress) was updated.
 	// In our model this is the time point at which slice T started.
 	uint64_t _refClock = 0;
@@ -166,7 +698,8 @@ private:
 	// Management of pending entities.
 	// ----------------------------------------------------------------------------------
 
-	// Note that _mutex *only* protects _pendingList and nothing more!
+	// Note that _mutex *only* protects _pendingList, _inheritanceList, _policyList,
+	// _groupList and the associated fields of the entities in these lists and nothing more!
 	frg::ticket_spinlock _mutex;
 
 	frg::intrusive_list<
@@ -177,8 +710,42 @@ private:
 			&ScheduleEntity::listHook
 		>
 	> _pendingList;
+
+	// Entities whose inherited priority needs to be updated.
+	frg::intrusive_list<
+		ScheduleEntity,
+		frg::locate_member<
+			ScheduleEntity,
+			frg::default_list_hook<ScheduleEntity>,
+			&ScheduleEntity::inheritanceHook
+		>
+	> _inheritanceList;
+
+	// Entities whose scheduling policy needs to be updated.
+	frg::intrusive_list<
+		ScheduleEntity,
+		frg::locate_member<
+			ScheduleEntity,
+			frg::default_list_hook<ScheduleEntity>,
+			&ScheduleEntity::policyHook
+		>
+	> _policyList;
+
+	// Entities whose group needs to be updated.
+	frg::intrusive_list<
+		ScheduleEntity,
+		frg::locate_member<
+			ScheduleEntity,
+			frg::default_list_hook<ScheduleEntity>,
+			&ScheduleEntity::groupHook
+		>
+	> _groupList;
 };
 
 Scheduler *localScheduler();
 
+// Called by the architecture's monitored idle loop (with IRQs disabled)
+// when the monitored flag is set.
+void handleIdleWake();
+
 } // namespace thor
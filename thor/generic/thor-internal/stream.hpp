@@ -72,11 +72,23 @@ inline bool usesFlowProtocol(int tag) {
 	return tag == kTagSendFlow || tag == kTagRecvFlow;
 }
 
+struct MemorySlice;
+struct PinnedVirtualRange;
+
 struct FlowPacket {
 	void *data = nullptr;
 	size_t size = 0;
 	bool terminate = false;
 	bool fault = false;
+	// Sent by the receiver before any data is transferred.
+	// If non-null, the sender copies directly into the pinned buffer.
+	PinnedVirtualRange *pin = nullptr;
+	// Sent by the receiver to ask the sender to lend its pages.
+	bool lend = false;
+	// Copy-on-write snapshot of the sender's buffer (if the sender lends its pages)
+	// and the protection (kMapProt* flags) of the sender's mapping.
+	smarter::shared_ptr<MemorySlice> lentSlice;
+	uint32_t lentProtection = 0;
 };
 
 struct StreamNode {
@@ -118,9 +130,30 @@ public:
 
 	frg::array<char, 16> _inCredentials;
 	size_t _maxLength;
+	// Set for flows that may transfer pages instead of copying them.
+	bool _lendPages = false;
 	frg::unique_memory<KernelAlloc> _inBuffer;
+	// Instead of _inBuffer, senders can pass buffers that they own themselves.
+	// Such buffers must remain valid until the node completes.
+	const void *_inData = nullptr;
+	size_t _inSize = 0;
+	// Receivers of kernel buffers can provide storage for _maxLength bytes.
+	// If they do, the data is copied into it and its size is stored in _actualLength.
+	void *_recvStorage = nullptr;
 	AnyDescriptor _inDescriptor;
 
+	const void *inBufferData() {
+		if(_inData)
+			return _inData;
+		return _inBuffer.data();
+	}
+
+	size_t inBufferSize() {
+		if(_inData)
+			return _inSize;
+		return _inBuffer.size();
+	}
+
 	StreamNode *peerNode = nullptr;
 
 	async::oneshot_event issueFlow;
@@ -4,6 +4,7 @@
 #include <atomic>
 
 #include <frg/container_of.hpp>
+#include <thor-internal/action-arena.hpp>
 #include <thor-internal/cpu-data.hpp>
 #include <thor-internal/error.hpp>
 #include <thor-internal/schedule.hpp>
@@ -177,6 +178,10 @@ public:
 
 	static void raiseSignals(SyscallImageAccessor image);
 
+	// Ends the deferral of local ping IPIs (see Scheduler::beginDeferredPings())
+	// before a page fault returns to user space. raiseSignals() does the same for syscalls.
+	static void checkReschedule(FaultImageAccessor image);
+
 	// State transitions that apply to arbitrary threads.
 	// TODO: interruptOther() needs an Interrupt argument.
 	static void unblockOther(smarter::borrowed_ptr<Thread> thread);
@@ -212,6 +217,10 @@ public:
 		return &_pagingWorkQueue;
 	}
 
+	const smarter::shared_ptr<ActionArena> &actionArena() {
+		return _actionArena;
+	}
+
 	UserContext &getContext();
 	smarter::borrowed_ptr<Universe> getUniverse();
 	smarter::borrowed_ptr<AddressSpace, BindableHandle> getAddressSpace();
@@ -273,16 +282,36 @@ public:
 
 	void handlePreemption(IrqImageAccessor accessor) override;
 
+	bool mayMigrateTo(int cpu) override;
+
+	bool mayWakeOn(int cpu) override;
+
 private:
 	void _uninvoke();
 	void _kill();
 
+	template<typename ImageAccessor>
+	static void _rescheduleCurrent(ImageAccessor image, frg::unique_lock<frg::ticket_spinlock> lock);
+
 public:
 	void setAffinityMask(frg::vector<uint8_t, KernelAlloc> &&mask) {
 		auto lock = frg::guard(&_mutex);
 		_affinityMask = std::move(mask);
 	}
 
+private:
+	// Threads without an affinity mask may run on all CPUs.
+	// Must be called with _mutex held.
+	bool _mayRunOn(int cpu) {
+		if(_affinityMask.empty())
+			return true;
+		if(static_cast<size_t>(cpu) / 8 >= _affinityMask.size())
+			return false;
+		return _affinityMask[cpu / 8] & (1 << (cpu % 8));
+	}
+
+public:
+
 	// TODO: Tidy this up.
 	smarter::borrowed_ptr<Thread> self;
 
@@ -353,6 +382,9 @@ private:
 	smarter::shared_ptr<Universe> _universe;
 	smarter::shared_ptr<AddressSpace, BindableHandle> _addressSpace;
 
+	// Backs the state of asynchronous actions that this thread submits.
+	smarter::shared_ptr<ActionArena> _actionArena;
+
 	using ObserveQueue = frg::intrusive_list<
 		ObserveNode,
 		frg::locate_member<
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <atomic>
+
 #include <frg/variant.hpp>
+#include <frg/vector.hpp>
 #include <assert.h>
 #include <smarter.hpp>
 #include <thor-internal/mm-rc.hpp>
@@ -14,6 +17,7 @@ struct MemoryView;
 struct AddressSpace;
 struct IoSpace;
 struct Thread;
+struct ScheduleGroup;
 struct Universe;
 struct IpcQueue;
 struct MemorySlice;
@@ -21,6 +25,7 @@ struct NamedMemoryViewLock;
 struct KernletObject;
 struct BoundKernlet;
 struct ActiveHandle;
+struct RcuReadGuard;
 
 struct QueueDescriptor {
 	QueueDescriptor(smarter::shared_ptr<IpcQueue> queue)
@@ -94,6 +99,13 @@ struct ThreadDescriptor {
 	smarter::shared_ptr<Thread, ActiveHandle> thread;
 };
 
+struct ScheduleGroupDescriptor {
+	ScheduleGroupDescriptor(smarter::shared_ptr<ScheduleGroup> group)
+	: group(std::move(group)) { }
+
+	smarter::shared_ptr<ScheduleGroup> group;
+};
+
 // --------------------------------------------------------
 // IPC related descriptors
 // --------------------------------------------------------
@@ -203,6 +215,10 @@ struct IoDescriptor {
 // AnyDescriptor
 // --------------------------------------------------------
 
+// Grants access to system-wide kernel tunables.
+// The kernel attaches this descriptor to the servers that it launches.
+struct KernelControlDescriptor { };
+
 struct KernletObjectDescriptor {
 	KernletObjectDescriptor(smarter::shared_ptr<KernletObject> kernlet_object)
 	: kernletObject(std::move(kernlet_object)) { }
@@ -227,13 +243,15 @@ typedef frg::variant<
 	VirtualizedCpuDescriptor,
 	MemoryViewLockDescriptor,
 	ThreadDescriptor,
+	ScheduleGroupDescriptor,
 	LaneDescriptor,
 	IrqDescriptor,
 	OneshotEventDescriptor,
 	BitsetEventDescriptor,
 	IoDescriptor,
 	KernletObjectDescriptor,
-	BoundKernletDescriptor
+	BoundKernletDescriptor,
+	KernelControlDescriptor
 > AnyDescriptor;
 
 // --------------------------------------------------------
@@ -245,6 +263,11 @@ public:
 	typedef frg::ticket_spinlock Lock;
 	typedef frg::unique_lock<frg::ticket_spinlock> Guard;
 
+	// Descriptors are stored in a two-level table that is indexed by handle.
+	// The top level (i.e., the directory) grows on demand.
+	static constexpr size_t slotsPerPage = 512;
+	static constexpr size_t initialPages = 8;
+
 	Universe();
 	~Universe();
 
@@ -252,17 +275,31 @@ public:
 
 	AnyDescriptor *getDescriptor(Guard &guard, Handle handle);
 
+	// Lock-free variant of getDescriptor(). The descriptor must not be modified;
+	// it remains valid until the end of the RCU read-side critical section.
+	AnyDescriptor *getDescriptor(RcuReadGuard &guard, Handle handle);
+
 	frg::optional<AnyDescriptor> detachDescriptor(Guard &guard, Handle handle);
 
+	// Protects attaching and detaching of descriptors.
 	Lock lock;
 
 private:
-	frg::hash_map<
-		Handle,
-		AnyDescriptor,
-		frg::hash<Handle>,
-		KernelAlloc
-	> _descriptorMap;
+	struct DescriptorNode;
+	struct DescriptorDirectory;
+
+	struct DescriptorPage {
+		std::atomic<DescriptorNode *> slots[slotsPerPage]{};
+	};
+
+	DescriptorNode *_lookup(Handle handle);
+
+	// Replaced (and retired through RCU) when the directory grows.
+	std::atomic<DescriptorDirectory *> _directory{nullptr};
+
+	// Handles of detached descriptors. They are reused before allocating new handles
+	// such that the table stays dense.
+	frg::vector<Handle, KernelAlloc> _freeHandles;
 
 	Handle _nextHandle;
 };
@@ -4,6 +4,7 @@
 #include <frg/container_of.hpp>
 
 #include <thor-internal/cpu-data.hpp>
+#include <thor-internal/pi-futex.hpp>
 #include <thor-internal/stream.hpp>
 #include <thor-internal/thread.hpp>
 
@@ -33,8 +34,6 @@ void Thread::migrateCurrent() {
 	this_thread->_runState = kRunDeferred;
 	this_thread->_uninvoke();
 
-	Scheduler::unassociate(this_thread);
-
 	size_t n = -1;
 	for (int i = 0; i < getCpuCount(); i++) {
 		bool bit = 0;
@@ -49,7 +48,7 @@ void Thread::migrateCurrent() {
 
 	auto new_scheduler = &getCpuData(n)->scheduler;
 
-	Scheduler::associate(this_thread, new_scheduler);
+	Scheduler::migrate(this_thread, new_scheduler);
 	Scheduler::resume(this_thread);
 	localScheduler()->forceReschedule();
 
@@ -242,6 +241,19 @@ void Thread::interruptCurrent(Interrupt interrupt, SyscallImageAccessor image) {
 	}, getCpuData()->detachedStack.base(), image, interrupt, this_thread.get(), std::move(lock));
 }
 
+void Thread::checkReschedule(FaultImageAccessor image) {
+	// Faults in the kernel return to code that eventually calls raiseSignals().
+	if(image.inKernelDomain())
+		return;
+
+	auto thisThread = getCurrentThread();
+	StatelessIrqLock irqLock;
+	auto lock = frg::guard(&thisThread->_mutex);
+
+	if(localScheduler()->endDeferredPings())
+		_rescheduleCurrent(image, std::move(lock));
+}
+
 void Thread::raiseSignals(SyscallImageAccessor image) {
 	auto this_thread = getCurrentThread();
 	StatelessIrqLock irq_lock;
@@ -280,6 +292,8 @@ void Thread::raiseSignals(SyscallImageAccessor image) {
 						frg::make_tuple(Error::threadExited, 0, kIntrNull));
 			}
 
+			getPiFutexRealm()->releaseThread(thread);
+
 			localScheduler()->commitReschedule();
 		}, getCpuData()->detachedStack.base(), image, this_thread.get(), std::move(lock));
 	}
@@ -317,6 +331,9 @@ void Thread::raiseSignals(SyscallImageAccessor image) {
 			localScheduler()->commitReschedule();
 		}, getCpuData()->detachedStack.base(), image, this_thread.get(), std::move(lock));
 	}
+
+	if(localScheduler()->endDeferredPings())
+		_rescheduleCurrent(image, std::move(lock));
 }
 
 void Thread::unblockOther(smarter::borrowed_ptr<Thread> thread) {
@@ -338,7 +355,11 @@ void Thread::unblockOther(smarter::borrowed_ptr<Thread> thread) {
 				<< " is deferred (via unblock)" << frg::endlog;
 
 	thread->_runState = kRunDeferred;
-	Scheduler::resume(thread.get());
+	if(thread->_mayRunOn(getCpuData()->cpuIndex)) {
+		Scheduler::resumeWithHandoff(thread.get());
+	}else{
+		Scheduler::resumeNear(thread.get());
+	}
 }
 
 void Thread::killOther(smarter::borrowed_ptr<Thread> thread) {
@@ -380,16 +401,23 @@ Thread::Thread(smarter::shared_ptr<Universe> universe,
 		_pendingKill{false}, _pendingSignal{kSigNone}, _runCount{1},
 		_executor{&_userContext, abi},
 		_universe{std::move(universe)}, _addressSpace{std::move(address_space)},
+		_actionArena{smarter::allocate_shared<ActionArena>(*kernelAlloc)},
 		_affinityMask{*kernelAlloc} {
 	// TODO: Generate real UUIDs instead of ascending numbers.
 	uint64_t id = globalThreadId.fetch_add(1, std::memory_order_relaxed) + 1;
 	memset(_credentials, 0, 16);
 	memcpy(_credentials + 8, &id, sizeof(uint64_t));
+
+	getPiFutexRealm()->registerThread(this);
 }
 
 Thread::~Thread() {
 	assert(_runState == kRunTerminated);
 	assert(_observeQueue.empty());
+
+	// Usually, this was already done on termination. Make sure that the TID does not
+	// stay registered, no matter how the thread terminated.
+	getPiFutexRealm()->releaseThread(this);
 }
 
 // This function has to initiate the thread's shutdown.
@@ -483,6 +511,7 @@ void Thread::handlePreemption(IrqImageAccessor image) {
 	assert(getCurrentThread().get() == this);
 
 	localScheduler()->update();
+	localScheduler()->balance();
 	if(localScheduler()->maybeReschedule()) {
 		auto lock = frg::guard(&_mutex);
 
@@ -508,6 +537,47 @@ void Thread::handlePreemption(IrqImageAccessor image) {
 	}
 }
 
+bool Thread::mayMigrateTo(int cpu) {
+	auto irqLock = frg::guard(&irqMutex());
+	auto lock = frg::guard(&_mutex);
+
+	// Only threads that wait for CPU time are moved by the load balancer.
+	if(_runState != kRunSuspended && _runState != kRunDeferred)
+		return false;
+	return _mayRunOn(cpu);
+}
+
+bool Thread::mayWakeOn(int cpu) {
+	// Wake-ups happen with _mutex held, see unblockOther().
+	return _mayRunOn(cpu);
+}
+
+template<typename ImageAccessor>
+void Thread::_rescheduleCurrent(ImageAccessor image, frg::unique_lock<Mutex> lock) {
+	auto thisThread = getCurrentThread();
+	assert(thisThread->_runState == kRunActive);
+
+	localScheduler()->update();
+	if(!localScheduler()->maybeReschedule()) {
+		// Make sure that newly resumed entities get CPU time eventually.
+		localScheduler()->renewSchedule();
+		return;
+	}
+
+	if(logRunStates)
+		infoLogger() << "thor: " << (void *)thisThread.get() << " is suspended" << frg::endlog;
+
+	thisThread->_runState = kRunSuspended;
+	saveExecutor(&thisThread->_executor, image);
+	thisThread->_uninvoke();
+
+	runOnStack([] (Continuation cont, ImageAccessor image, frg::unique_lock<Mutex> lock) {
+		scrubStack(image, cont);
+		lock.unlock();
+		localScheduler()->commitReschedule();
+	}, getCpuData()->detachedStack.base(), image, std::move(lock));
+}
+
 void Thread::_uninvoke() {
 	UserContext::deactivate();
 }
@@ -534,6 +604,8 @@ void Thread::_kill() {
 			async::execution::set_value(node->receiver,
 					frg::make_tuple(Error::threadExited, 0, kIntrNull));
 		}
+
+		getPiFutexRealm()->releaseThread(this);
 	}else{
 		// TODO: Wake up blocked threads.
 		_pendingKill = true;
@@ -1,3 +1,4 @@
+#include <thor-internal/rcu.hpp>
 #include <thor-internal/universe.hpp>
 
 namespace thor {
@@ -6,32 +7,158 @@ namespace {
 	constexpr bool logCleanup = false;
 }
 
+// Descriptors are retired through RCU such that lock-free lookups can still
+// copy them after they are detached.
+struct Universe::DescriptorNode final : RcuCallback {
+	DescriptorNode(AnyDescriptor descriptor)
+	: descriptor{std::move(descriptor)} { }
+
+	void reclaim() override {
+		frg::destruct(*kernelAlloc, this);
+	}
+
+	AnyDescriptor descriptor;
+};
+
+// Top level of the descriptor table. Lock-free lookups may still access
+// the old directory after it is replaced; hence, it is retired through RCU.
+struct Universe::DescriptorDirectory final : RcuCallback {
+	DescriptorDirectory(size_t numPages)
+	: numPages{numPages} {
+		pages = static_cast<std::atomic<DescriptorPage *> *>(
+				kernelAlloc->allocate(numPages * sizeof(std::atomic<DescriptorPage *>)));
+		for(size_t i = 0; i < numPages; ++i)
+			new (&pages[i]) std::atomic<DescriptorPage *>{nullptr};
+	}
+
+	~DescriptorDirectory() {
+		kernelAlloc->deallocate(pages, numPages * sizeof(std::atomic<DescriptorPage *>));
+	}
+
+	// Note that this only frees the directory itself, not the pages.
+	void reclaim() override {
+		frg::destruct(*kernelAlloc, this);
+	}
+
+	size_t numPages;
+	std::atomic<DescriptorPage *> *pages;
+};
+
 Universe::Universe()
-: _descriptorMap{frg::hash<Handle>{}, *kernelAlloc}, _nextHandle{1} { }
+: _freeHandles{*kernelAlloc}, _nextHandle{1} { }
 
 Universe::~Universe() {
 	if(logCleanup)
 		infoLogger() << "\e[31mthor: Universe is deallocated\e[39m" << frg::endlog;
+
+	// No lookups can be in progress since nobody holds a reference to us anymore.
+	auto directory = _directory.load(std::memory_order_relaxed);
+	if(!directory)
+		return;
+	for(size_t i = 0; i < directory->numPages; ++i) {
+		auto page = directory->pages[i].load(std::memory_order_relaxed);
+		if(!page)
+			continue;
+		for(size_t j = 0; j < slotsPerPage; ++j) {
+			auto node = page->slots[j].load(std::memory_order_relaxed);
+			if(node)
+				frg::destruct(*kernelAlloc, node);
+		}
+		frg::destruct(*kernelAlloc, page);
+	}
+	frg::destruct(*kernelAlloc, directory);
 }
 
 Handle Universe::attachDescriptor(Guard &guard, AnyDescriptor descriptor) {
 	assert(guard.protects(&lock));
 
-	Handle handle = _nextHandle++;
-	_descriptorMap.insert(handle, std::move(descriptor));
+	Handle handle;
+	if(!_freeHandles.empty()) {
+		handle = _freeHandles.pop();
+	}else{
+		handle = _nextHandle++;
+	}
+
+	size_t p = handle / slotsPerPage;
+	auto directory = _directory.load(std::memory_order_relaxed);
+	if(!directory || p >= directory->numPages) {
+		auto numPages = directory ? directory->numPages : initialPages;
+		while(p >= numPages)
+			numPages *= 2;
+
+		auto newDirectory = frg::construct<DescriptorDirectory>(*kernelAlloc, numPages);
+		if(directory) {
+			for(size_t i = 0; i < directory->numPages; ++i)
+				newDirectory->pages[i].store(directory->pages[i].load(std::memory_order_relaxed),
+						std::memory_order_relaxed);
+		}
+		_directory.store(newDirectory, std::memory_order_release);
+		if(directory)
+			rcuRetire(directory);
+		directory = newDirectory;
+	}
+
+	auto page = directory->pages[p].load(std::memory_order_relaxed);
+	if(!page) {
+		page = frg::construct<DescriptorPage>(*kernelAlloc);
+		directory->pages[p].store(page, std::memory_order_release);
+	}
+
+	auto node = frg::construct<DescriptorNode>(*kernelAlloc, std::move(descriptor));
+	auto &slot = page->slots[handle % slotsPerPage];
+	assert(!slot.load(std::memory_order_relaxed));
+	slot.store(node, std::memory_order_release);
 	return handle;
 }
 
 AnyDescriptor *Universe::getDescriptor(Guard &guard, Handle handle) {
 	assert(guard.protects(&lock));
 
-	return _descriptorMap.get(handle);
+	auto node = _lookup(handle);
+	if(!node)
+		return nullptr;
+	return &node->descriptor;
+}
+
+AnyDescriptor *Universe::getDescriptor(RcuReadGuard &, Handle handle) {
+	auto node = _lookup(handle);
+	if(!node)
+		return nullptr;
+	return &node->descriptor;
 }
 
 frg::optional<AnyDescriptor> Universe::detachDescriptor(Guard &guard, Handle handle) {
 	assert(guard.protects(&lock));
 
-	return _descriptorMap.remove(handle);
+	auto directory = _directory.load(std::memory_order_relaxed);
+	if(handle <= 0 || !directory
+			|| static_cast<size_t>(handle) / slotsPerPage >= directory->numPages)
+		return frg::null_opt;
+	auto page = directory->pages[handle / slotsPerPage].load(std::memory_order_relaxed);
+	if(!page)
+		return frg::null_opt;
+	auto node = page->slots[handle % slotsPerPage].exchange(nullptr, std::memory_order_relaxed);
+	if(!node)
+		return frg::null_opt;
+	_freeHandles.push_back(handle);
+
+	// Concurrent lookups may still copy the descriptor; hence, we have to copy it here.
+	frg::optional<AnyDescriptor> descriptor{node->descriptor};
+	rcuRetire(node);
+	return descriptor;
+}
+
+Universe::DescriptorNode *Universe::_lookup(Handle handle) {
+	// Callers either hold the lock or are inside an RCU read-side critical section;
+	// both prevent the directory from being reclaimed.
+	auto directory = _directory.load(std::memory_order_acquire);
+	if(handle <= 0 || !directory
+			|| static_cast<size_t>(handle) / slotsPerPage >= directory->numPages)
+		return nullptr;
+	auto page = directory->pages[handle / slotsPerPage].load(std::memory_order_acquire);
+	if(!page)
+		return nullptr;
+	return page->slots[handle % slotsPerPage].load(std::memory_order_acquire);
 }
 
 } // namespace thor